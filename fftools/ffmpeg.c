@@ -144,6 +144,9 @@ static atomic_int transcode_init_done = 0;
 static volatile int ffmpeg_exited = 0;
 static int64_t copy_ts_first_pts = AV_NOPTS_VALUE;
 
+/* FrameData buffers are allocated for every packet and frame, recycle them */
+static AVBufferPool *frame_data_pool;
+
 static void
 sigterm_handler(int sig)
 {
@@ -334,6 +337,8 @@ static void ffmpeg_cleanup(int ret)
         dec_free(&decoders[i]);
     av_freep(&decoders);
 
+    av_buffer_pool_uninit(&frame_data_pool);
+
     if (vstats_file) {
         if (fclose(vstats_file))
             av_log(NULL, AV_LOG_ERROR,
@@ -409,6 +414,22 @@ static void frame_data_free(void *opaque, uint8_t *data)
     av_free(data);
 }
 
+static AVBufferRef *frame_data_alloc(size_t size)
+{
+    AVBufferRef *buf;
+    FrameData *fd;
+
+    fd = av_mallocz(size);
+    if (!fd)
+        return NULL;
+
+    buf = av_buffer_create((uint8_t *)fd, size, frame_data_free, NULL, 0);
+    if (!buf)
+        av_free(fd);
+
+    return buf;
+}
+
 static int frame_data_ensure(AVBufferRef **dst, int writable)
 {
     AVBufferRef *src = *dst;
@@ -416,18 +437,18 @@ static int frame_data_ensure(AVBufferRef **dst, int writable)
     if (!src || (writable && !av_buffer_is_writable(src))) {
         FrameData *fd;
 
-        fd = av_mallocz(sizeof(*fd));
-        if (!fd)
-            return AVERROR(ENOMEM);
-
-        *dst = av_buffer_create((uint8_t *)fd, sizeof(*fd),
-                                frame_data_free, NULL, 0);
+        *dst = av_buffer_pool_get(frame_data_pool);
         if (!*dst) {
             av_buffer_unref(&src);
-            av_freep(&fd);
             return AVERROR(ENOMEM);
         }
 
+        // recycled buffers still hold the data of their previous user
+        fd = (FrameData *)(*dst)->data;
+        av_frame_side_data_free(&fd->side_data, &fd->nb_side_data);
+        avcodec_parameters_free(&fd->par_enc);
+        memset(fd, 0, sizeof(*fd));
+
         if (src) {
             const FrameData *fd_src = (const FrameData *)src->data;
 
@@ -568,7 +589,8 @@ void update_benchmark(const char *fmt, ...)
     }
 }
 
-static void print_report(int is_last_report, int64_t timer_start, int64_t cur_time, int64_t pts)
+static void print_report(Scheduler *sch, int is_last_report,
+                         int64_t timer_start, int64_t cur_time, int64_t pts)
 {
     AVBPrint buf, buf_script;
     int64_t total_size = of_filesize(output_files[0]);
@@ -714,6 +736,11 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     av_bprint_finalize(&buf, NULL);
 
     if (progress_avio) {
+        if (print_sched_stats) {
+            av_bprintf(&buf_script, "sched_stats=");
+            sch_print_stats(sch, &buf_script);
+            av_bprint_chars(&buf_script, '\n', 1);
+        }
         av_bprintf(&buf_script, "progress=%s\n",
                    is_last_report ? "end" : "continue");
         avio_write(progress_avio, buf_script.str,
@@ -914,7 +941,7 @@ static int transcode(Scheduler *sch)
                 break;
 
         /* dump report by using the output first video and audio streams */
-        print_report(0, timer_start, cur_time, transcode_ts);
+        print_report(sch, 0, timer_start, cur_time, transcode_ts);
     }
 
     ret = sch_stop(sch, &transcode_ts);
@@ -928,7 +955,7 @@ static int transcode(Scheduler *sch)
     term_exit();
 
     /* dump report by using the first video and audio streams */
-    print_report(1, timer_start, av_gettime_relative(), transcode_ts);
+    print_report(sch, 1, timer_start, av_gettime_relative(), transcode_ts);
 
     return ret;
 }
@@ -999,7 +1026,8 @@ int main(int argc, char **argv)
     show_banner(argc, argv, options);
 
     sch = sch_alloc();
-    if (!sch) {
+    frame_data_pool = av_buffer_pool_init(sizeof(FrameData), frame_data_alloc);
+    if (!sch || !frame_data_pool) {
         ret = AVERROR(ENOMEM);
         goto finish;
     }
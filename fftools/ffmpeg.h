@@ -773,6 +773,7 @@ extern int exit_on_error;
 extern int abort_on_flags;
 extern int print_stats;
 extern int64_t stats_period;
+extern int print_sched_stats;
 extern int stdin_interaction;
 extern AVIOContext *progress_avio;
 extern float max_error_rate;
@@ -780,6 +781,8 @@ extern float max_error_rate;
 extern char *filter_nbthreads;
 extern int filter_complex_nbthreads;
 extern int filter_buffered_frames;
+extern int filter_parallel;
+extern int filter_fuse;
 extern int vstats_version;
 extern int print_graphs;
 extern char *print_graphs_file;
@@ -2114,6 +2114,18 @@ static int configure_filtergraph(FilterGraph *fg, FilterGraphThread *fgt)
             return ret;
     }
 
+    if (filter_parallel) {
+        ret = av_opt_set(fgt->graph, "thread_type", "slice+graph", 0);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (filter_fuse) {
+        ret = av_opt_set_int(fgt->graph, "fuse_filters", 1, 0);
+        if (ret < 0)
+            return ret;
+    }
+
     hw_device = hw_device_for_filter();
 
     ret = graph_parse(fg, fgt->graph, graph_desc, &inputs, &outputs, hw_device);
@@ -76,12 +76,15 @@ float max_error_rate  = 2.0/3;
 char *filter_nbthreads;
 int filter_complex_nbthreads = 0;
 int filter_buffered_frames = 0;
+int filter_parallel = 0;
+int filter_fuse = 0;
 int vstats_version = 2;
 int print_graphs = 0;
 char *print_graphs_file = NULL;
 char *print_graphs_format = NULL;
 int auto_conversion_filters = 1;
 int64_t stats_period = 500000;
+int print_sched_stats = 0;
 
 
 static int file_overwrite     = 0;
@@ -717,6 +720,20 @@ static int opt_sdp_file(void *optctx, const char *opt, const char *arg)
     return sch_sdp_filename(go->sch, arg);
 }
 
+static int opt_sched_pool(void *optctx, const char *opt, const char *arg)
+{
+    GlobalOptionsContext *go = optctx;
+    double pool_size;
+    int ret;
+
+    ret = parse_number(opt, arg, OPT_TYPE_INT, 0, INT_MAX, &pool_size);
+    if (ret < 0)
+        return ret;
+
+    sch_set_pool_size(go->sch, pool_size);
+    return 0;
+}
+
 #if CONFIG_VAAPI
 static int opt_vaapi_device(void *optctx, const char *opt, const char *arg)
 {
@@ -1808,6 +1825,12 @@ const OptionDef options[] = {
     { "filter_buffered_frames", OPT_TYPE_INT, OPT_EXPERT,
         { &filter_buffered_frames },
         "maximum number of buffered frames in a filter graph" },
+    { "filter_parallel",        OPT_TYPE_BOOL, OPT_EXPERT,
+        { &filter_parallel },
+        "activate independent filters of a filter graph concurrently" },
+    { "filter_fuse",            OPT_TYPE_BOOL, OPT_EXPERT,
+        { &filter_fuse },
+        "fuse chains of per-pixel filters into a single pass" },
 #if FFMPEG_OPT_FILTER_SCRIPT
     { "filter_script",          OPT_TYPE_STRING, OPT_PERSTREAM | OPT_EXPERT | OPT_OUTPUT,
         { .off = OFFSET(filter_scripts) },
@@ -1851,6 +1874,12 @@ const OptionDef options[] = {
     { "stats_period",        OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
         { .func_arg = opt_stats_period },
         "set the period at which ffmpeg updates stats and -progress output", "time" },
+    { "stats_sched",         OPT_TYPE_BOOL, OPT_EXPERT,
+        { &print_sched_stats },
+        "add per-task pipeline statistics as JSON to -progress output" },
+    { "sched_pool",          OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
+        { .func_arg = opt_sched_pool },
+        "limit the number of pipeline tasks running concurrently (0 = unlimited)", "nb_tasks" },
     { "attach",              OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_PERFILE | OPT_EXPERT | OPT_OUTPUT,
         { .func_arg = opt_attach },
         "add an attachment to the output file", "filename" },
@@ -32,6 +32,7 @@
 #include "libavcodec/packet.h"
 
 #include "libavutil/avassert.h"
+#include "libavutil/bprint.h"
 #include "libavutil/error.h"
 #include "libavutil/fifo.h"
 #include "libavutil/frame.h"
@@ -69,6 +70,21 @@ typedef struct SchTask {
 
     pthread_t           thread;
     int                 thread_running;
+
+    /* Statistics, written by the task thread and read by sch_print_stats().
+     * All times are in microseconds, relative to av_gettime_relative(). */
+    atomic_int_least64_t time_start;
+    atomic_int_least64_t time_end;
+    // time spent blocked waiting for input/output/a free pool slot
+    atomic_int_least64_t time_wait_in;
+    atomic_int_least64_t time_wait_out;
+    atomic_int_least64_t time_wait_pool;
+    // number of packets/frames received (or sent, for demuxers)
+    atomic_uint_least64_t nb_items;
+
+    // state of the last sch_print_stats() call, only accessed from it
+    int64_t             stats_last_time;
+    uint64_t            stats_last_items;
 } SchTask;
 
 typedef struct SchDecOutput {
@@ -309,8 +325,99 @@ struct Scheduler {
     pthread_mutex_t     schedule_lock;
 
     atomic_int_least64_t last_dts;
+
+    /**
+     * Maximum number of tasks allowed to run concurrently, 0 for no limit.
+     *
+     * A task occupies a pool slot while it is executing its own code, and
+     * gives it up for the duration of every scheduler call that may block
+     * (receiving input, sending output, waiting while choked). Tasks that are
+     * merely waiting on their neighbours thus do not count against the limit,
+     * which bounds CPU oversubscription without risking deadlocks.
+     */
+    unsigned            pool_size;
+    // protected by pool_lock
+    unsigned            pool_busy;
+    pthread_mutex_t     pool_lock;
+    pthread_cond_t      pool_cond;
+};
+
+/**
+ * Wait for a free slot in the task pool and occupy it.
+ */
+static void pool_enter(Scheduler *sch)
+{
+    if (!sch->pool_size)
+        return;
+
+    pthread_mutex_lock(&sch->pool_lock);
+
+    while (sch->pool_busy >= sch->pool_size)
+        pthread_cond_wait(&sch->pool_cond, &sch->pool_lock);
+    sch->pool_busy++;
+
+    pthread_mutex_unlock(&sch->pool_lock);
+}
+
+/**
+ * Give up a slot occupied by pool_enter().
+ */
+static void pool_leave(Scheduler *sch)
+{
+    if (!sch->pool_size)
+        return;
+
+    pthread_mutex_lock(&sch->pool_lock);
+
+    av_assert0(sch->pool_busy > 0);
+    sch->pool_busy--;
+    pthread_cond_signal(&sch->pool_cond);
+
+    pthread_mutex_unlock(&sch->pool_lock);
+}
+
+enum SchWaitType {
+    SCH_WAIT_IN,
+    SCH_WAIT_OUT,
 };
 
+/**
+ * Called by a task before a scheduler call that may block.
+ *
+ * @return timestamp to be passed to the matching task_block_end()
+ */
+static int64_t task_block_start(SchTask *task)
+{
+    pool_leave(task->parent);
+    return av_gettime_relative();
+}
+
+/**
+ * Called by a task after a scheduler call that may block.
+ *
+ * @param t_start value returned by the matching task_block_start()
+ * @param item 1 if the call passed a packet/frame that should be counted
+ *             towards the task throughput
+ */
+static void task_block_end(SchTask *task, int64_t t_start,
+                           enum SchWaitType type, int item)
+{
+    int64_t t_end = av_gettime_relative();
+
+    atomic_fetch_add_explicit(type == SCH_WAIT_IN ? &task->time_wait_in :
+                                                    &task->time_wait_out,
+                              t_end - t_start, memory_order_relaxed);
+    if (item)
+        atomic_fetch_add_explicit(&task->nb_items, 1, memory_order_relaxed);
+
+    if (task->parent->pool_size) {
+        pool_enter(task->parent);
+        atomic_fetch_add_explicit(&task->time_wait_pool,
+                                  av_gettime_relative() - t_end,
+                                  memory_order_relaxed);
+    }
+}
+
 /**
  * Wait until this task is allowed to proceed.
  *
@@ -584,6 +691,9 @@ void sch_free(Scheduler **psch)
     pthread_mutex_destroy(&sch->finish_lock);
     pthread_cond_destroy(&sch->finish_cond);
 
+    pthread_mutex_destroy(&sch->pool_lock);
+    pthread_cond_destroy(&sch->pool_cond);
+
     av_freep(psch);
 }
 
@@ -620,6 +730,14 @@ Scheduler *sch_alloc(void)
     if (ret)
         goto fail;
 
+    ret = pthread_mutex_init(&sch->pool_lock, NULL);
+    if (ret)
+        goto fail;
+
+    ret = pthread_cond_init(&sch->pool_cond, NULL);
+    if (ret)
+        goto fail;
+
     return sch;
 fail:
     sch_free(&sch);
@@ -633,6 +751,12 @@ int sch_sdp_filename(Scheduler *sch, const char *sdp_filename)
     return sch->sdp_filename ? 0 : AVERROR(ENOMEM);
 }
 
+void sch_set_pool_size(Scheduler *sch, unsigned pool_size)
+{
+    av_assert0(sch->state == SCH_STATE_UNINIT);
+    sch->pool_size = pool_size;
+}
+
 static const AVClass sch_mux_class = {
     .class_name                = "SchMux",
     .version                   = LIBAVUTIL_VERSION_INT,
@@ -1787,6 +1911,77 @@ int sch_wait(Scheduler *sch, uint64_t timeout_us, int64_t *transcode_ts)
     return ret;
 }
 
+static void task_print_stats(SchTask *task, const char *type, unsigned idx,
+                             ThreadQueue *queue, int64_t now, AVBPrint *bp,
+                             unsigned *nb_printed)
+{
+    int64_t time_start, time_end, elapsed, busy;
+    int64_t wait_in, wait_out, wait_pool;
+    uint64_t nb_items;
+    const char *state;
+    double rate = 0.0;
+
+    if (!task->parent)
+        return;
+
+    time_start = atomic_load(&task->time_start);
+    time_end   = atomic_load(&task->time_end);
+    wait_in    = atomic_load_explicit(&task->time_wait_in,   memory_order_relaxed);
+    wait_out   = atomic_load_explicit(&task->time_wait_out,  memory_order_relaxed);
+    wait_pool  = atomic_load_explicit(&task->time_wait_pool, memory_order_relaxed);
+    nb_items   = atomic_load_explicit(&task->nb_items,       memory_order_relaxed);
+
+    state   = !time_start ? "pending"  :
+               time_end   ? "finished" : "running";
+    elapsed = time_start ? (time_end ? time_end : now) - time_start : 0;
+    busy    = FFMAX(elapsed - wait_in - wait_out - wait_pool, 0);
+
+    // throughput since the previous report, or since start for the first one
+    if (task->stats_last_time && now > task->stats_last_time)
+        rate = (nb_items - task->stats_last_items) * 1e6 / (now - task->stats_last_time);
+    else if (elapsed > 0)
+        rate = nb_items * 1e6 / elapsed;
+    task->stats_last_time  = now;
+    task->stats_last_items = nb_items;
+
+    av_bprintf(bp, "%s{\"type\":\"%s\",\"index\":%u,\"state\":\"%s\","
+               "\"busy_us\":%"PRId64",\"wait_in_us\":%"PRId64","
+               "\"wait_out_us\":%"PRId64",\"wait_pool_us\":%"PRId64","
+               "\"items\":%"PRIu64",\"rate\":%.2f",
+               (*nb_printed)++ ? "," : "", type, idx, state,
+               busy, wait_in, wait_out, wait_pool, nb_items, rate);
+    if (queue)
+        av_bprintf(bp, ",\"queue\":%zu,\"queue_max\":%zu",
+                   tq_occupancy(queue), tq_occupancy_max(queue));
+    av_bprint_chars(bp, '}', 1);
+}
+
+void sch_print_stats(Scheduler *sch, AVBPrint *bp)
+{
+    int64_t now = av_gettime_relative();
+    unsigned nb_printed = 0;
+
+    av_bprintf(bp, "{\"time_us\":%"PRId64",\"tasks\":[", now);
+
+    for (unsigned i = 0; i < sch->nb_demux; i++)
+        task_print_stats(&sch->demux[i].task,   "demux",  i, NULL,
+                         now, bp, &nb_printed);
+    for (unsigned i = 0; i < sch->nb_dec; i++)
+        task_print_stats(&sch->dec[i].task,     "dec",    i, sch->dec[i].queue,
+                         now, bp, &nb_printed);
+    for (unsigned i = 0; i < sch->nb_filters; i++)
+        task_print_stats(&sch->filters[i].task, "filter", i, sch->filters[i].queue,
+                         now, bp, &nb_printed);
+    for (unsigned i = 0; i < sch->nb_enc; i++)
+        task_print_stats(&sch->enc[i].task,     "enc",    i, sch->enc[i].queue,
+                         now, bp, &nb_printed);
+    for (unsigned i = 0; i < sch->nb_mux; i++)
+        task_print_stats(&sch->mux[i].task,     "mux",    i, sch->mux[i].queue,
+                         now, bp, &nb_printed);
+
+    av_bprintf(bp, "]}");
+}
+
 static int enc_open(Scheduler *sch, SchEnc *enc, const AVFrame *frame)
 {
     int ret;
@@ -2134,8 +2329,8 @@ static int demux_flush(Scheduler *sch, SchDemux *d, AVPacket *pkt)
     return 0;
 }
 
-int sch_demux_send(Scheduler *sch, unsigned demux_idx, AVPacket *pkt,
-                   unsigned flags)
+static int demux_send(Scheduler *sch, unsigned demux_idx, AVPacket *pkt,
+                      unsigned flags)
 {
     SchDemux *d;
     int terminate;
@@ -2156,6 +2351,26 @@ int sch_demux_send(Scheduler *sch, unsigned demux_idx, AVPacket *pkt,
     return demux_send_for_stream(sch, d, &d->streams[pkt->stream_index], pkt, flags);
 }
 
+int sch_demux_send(Scheduler *sch, unsigned demux_idx, AVPacket *pkt,
+                   unsigned flags)
+{
+    SchTask *task;
+    int64_t t;
+    int ret, item;
+
+    av_assert0(demux_idx < sch->nb_demux);
+    task = &sch->demux[demux_idx].task;
+
+    // seek flushes are not counted as packets
+    item = pkt->stream_index >= 0;
+
+    t   = task_block_start(task);
+    ret = demux_send(sch, demux_idx, pkt, flags);
+    task_block_end(task, t, SCH_WAIT_OUT, item && ret >= 0);
+
+    return ret;
+}
+
 static int demux_done(Scheduler *sch, unsigned demux_idx)
 {
     SchDemux *d = &sch->demux[demux_idx];
@@ -2178,7 +2393,7 @@ static int demux_done(Scheduler *sch, unsigned demux_idx)
     return ret;
 }
 
-int sch_mux_receive(Scheduler *sch, unsigned mux_idx, AVPacket *pkt)
+static int mux_receive(Scheduler *sch, unsigned mux_idx, AVPacket *pkt)
 {
     SchMux *mux;
     int ret, stream_idx;
@@ -2191,6 +2406,22 @@ int sch_mux_receive(Scheduler *sch, unsigned mux_idx, AVPacket *pkt)
     return ret;
 }
 
+int sch_mux_receive(Scheduler *sch, unsigned mux_idx, AVPacket *pkt)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(mux_idx < sch->nb_mux);
+    task = &sch->mux[mux_idx].task;
+
+    t   = task_block_start(task);
+    ret = mux_receive(sch, mux_idx, pkt);
+    task_block_end(task, t, SCH_WAIT_IN, ret >= 0);
+
+    return ret;
+}
+
 void sch_mux_receive_finish(Scheduler *sch, unsigned mux_idx, unsigned stream_idx)
 {
     SchMux *mux;
@@ -2209,8 +2440,8 @@ void sch_mux_receive_finish(Scheduler *sch, unsigned mux_idx, unsigned stream_id
     pthread_mutex_unlock(&sch->schedule_lock);
 }
 
-int sch_mux_sub_heartbeat(Scheduler *sch, unsigned mux_idx, unsigned stream_idx,
-                          const AVPacket *pkt)
+static int mux_sub_heartbeat(Scheduler *sch, unsigned mux_idx, unsigned stream_idx,
+                             const AVPacket *pkt)
 {
     SchMux       *mux;
     SchMuxStream *ms;
@@ -2235,6 +2466,23 @@ int sch_mux_sub_heartbeat(Scheduler *sch, unsigned mux_idx, unsigned stream_idx,
     return 0;
 }
 
+int sch_mux_sub_heartbeat(Scheduler *sch, unsigned mux_idx, unsigned stream_idx,
+                          const AVPacket *pkt)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(mux_idx < sch->nb_mux);
+    task = &sch->mux[mux_idx].task;
+
+    t   = task_block_start(task);
+    ret = mux_sub_heartbeat(sch, mux_idx, stream_idx, pkt);
+    task_block_end(task, t, SCH_WAIT_OUT, 0);
+
+    return ret;
+}
+
 static int mux_done(Scheduler *sch, unsigned mux_idx)
 {
     SchMux *mux = &sch->mux[mux_idx];
@@ -2262,7 +2510,7 @@ static int mux_done(Scheduler *sch, unsigned mux_idx)
     return 0;
 }
 
-int sch_dec_receive(Scheduler *sch, unsigned dec_idx, AVPacket *pkt)
+static int dec_receive(Scheduler *sch, unsigned dec_idx, AVPacket *pkt)
 {
     SchDec *dec;
     int ret, dummy;
@@ -2291,6 +2539,22 @@ int sch_dec_receive(Scheduler *sch, unsigned dec_idx, AVPacket *pkt)
     return ret;
 }
 
+int sch_dec_receive(Scheduler *sch, unsigned dec_idx, AVPacket *pkt)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(dec_idx < sch->nb_dec);
+    task = &sch->dec[dec_idx].task;
+
+    t   = task_block_start(task);
+    ret = dec_receive(sch, dec_idx, pkt);
+    task_block_end(task, t, SCH_WAIT_IN, ret >= 0);
+
+    return ret;
+}
+
 static int send_to_filter(Scheduler *sch, SchFilterGraph *fg,
                           unsigned in_idx, AVFrame *frame)
 {
@@ -2344,8 +2608,8 @@ finish:
     return AVERROR_EOF;
 }
 
-int sch_dec_send(Scheduler *sch, unsigned dec_idx,
-                 unsigned out_idx, AVFrame *frame)
+static int dec_send(Scheduler *sch, unsigned dec_idx,
+                    unsigned out_idx, AVFrame *frame)
 {
     SchDec *dec;
     SchDecOutput *o;
@@ -2388,6 +2652,23 @@ int sch_dec_send(Scheduler *sch, unsigned dec_idx,
     return (nb_done == o->nb_dst) ? AVERROR_EOF : 0;
 }
 
+int sch_dec_send(Scheduler *sch, unsigned dec_idx,
+                 unsigned out_idx, AVFrame *frame)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(dec_idx < sch->nb_dec);
+    task = &sch->dec[dec_idx].task;
+
+    t   = task_block_start(task);
+    ret = dec_send(sch, dec_idx, out_idx, frame);
+    task_block_end(task, t, SCH_WAIT_OUT, 0);
+
+    return ret;
+}
+
 static int dec_done(Scheduler *sch, unsigned dec_idx)
 {
     SchDec *dec = &sch->dec[dec_idx];
@@ -2413,7 +2694,7 @@ static int dec_done(Scheduler *sch, unsigned dec_idx)
     return ret;
 }
 
-int sch_enc_receive(Scheduler *sch, unsigned enc_idx, AVFrame *frame)
+static int enc_receive(Scheduler *sch, unsigned enc_idx, AVFrame *frame)
 {
     SchEnc *enc;
     int ret, dummy;
@@ -2427,6 +2708,22 @@ int sch_enc_receive(Scheduler *sch, unsigned enc_idx, AVFrame *frame)
     return ret;
 }
 
+int sch_enc_receive(Scheduler *sch, unsigned enc_idx, AVFrame *frame)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(enc_idx < sch->nb_enc);
+    task = &sch->enc[enc_idx].task;
+
+    t   = task_block_start(task);
+    ret = enc_receive(sch, enc_idx, frame);
+    task_block_end(task, t, SCH_WAIT_IN, ret >= 0);
+
+    return ret;
+}
+
 static int enc_send_to_dst(Scheduler *sch, const SchedulerNode dst,
                            uint8_t *dst_finished, AVPacket *pkt)
 {
@@ -2457,7 +2754,7 @@ finish:
     return AVERROR_EOF;
 }
 
-int sch_enc_send(Scheduler *sch, unsigned enc_idx, AVPacket *pkt)
+static int enc_send(Scheduler *sch, unsigned enc_idx, AVPacket *pkt)
 {
     SchEnc *enc;
     int ret;
@@ -2490,6 +2787,22 @@ int sch_enc_send(Scheduler *sch, unsigned enc_idx, AVPacket *pkt)
     return 0;
 }
 
+int sch_enc_send(Scheduler *sch, unsigned enc_idx, AVPacket *pkt)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(enc_idx < sch->nb_enc);
+    task = &sch->enc[enc_idx].task;
+
+    t   = task_block_start(task);
+    ret = enc_send(sch, enc_idx, pkt);
+    task_block_end(task, t, SCH_WAIT_OUT, 0);
+
+    return ret;
+}
+
 static int enc_done(Scheduler *sch, unsigned enc_idx)
 {
     SchEnc *enc = &sch->enc[enc_idx];
@@ -2506,8 +2819,8 @@ static int enc_done(Scheduler *sch, unsigned enc_idx)
     return ret;
 }
 
-int sch_filter_receive(Scheduler *sch, unsigned fg_idx,
-                       unsigned *in_idx, AVFrame *frame)
+static int filter_receive(Scheduler *sch, unsigned fg_idx,
+                          unsigned *in_idx, AVFrame *frame)
 {
     SchFilterGraph *fg;
 
@@ -2550,6 +2863,23 @@ int sch_filter_receive(Scheduler *sch, unsigned fg_idx,
     }
 }
 
+int sch_filter_receive(Scheduler *sch, unsigned fg_idx,
+                       unsigned *in_idx, AVFrame *frame)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(fg_idx < sch->nb_filters);
+    task = &sch->filters[fg_idx].task;
+
+    t   = task_block_start(task);
+    ret = filter_receive(sch, fg_idx, in_idx, frame);
+    task_block_end(task, t, SCH_WAIT_IN, ret >= 0);
+
+    return ret;
+}
+
 void sch_filter_receive_finish(Scheduler *sch, unsigned fg_idx, unsigned in_idx)
 {
     SchFilterGraph *fg;
@@ -2577,7 +2907,7 @@ void sch_filter_receive_finish(Scheduler *sch, unsigned fg_idx, unsigned in_idx)
     pthread_mutex_unlock(&sch->schedule_lock);
 }
 
-int sch_filter_send(Scheduler *sch, unsigned fg_idx, unsigned out_idx, AVFrame *frame)
+static int filter_send(Scheduler *sch, unsigned fg_idx, unsigned out_idx, AVFrame *frame)
 {
     SchFilterGraph *fg;
     SchedulerNode  dst;
@@ -2601,6 +2931,22 @@ int sch_filter_send(Scheduler *sch, unsigned fg_idx, unsigned out_idx, AVFrame *
     return ret;
 }
 
+int sch_filter_send(Scheduler *sch, unsigned fg_idx, unsigned out_idx, AVFrame *frame)
+{
+    SchTask *task;
+    int64_t t;
+    int ret;
+
+    av_assert0(fg_idx < sch->nb_filters);
+    task = &sch->filters[fg_idx].task;
+
+    t   = task_block_start(task);
+    ret = filter_send(sch, fg_idx, out_idx, frame);
+    task_block_end(task, t, SCH_WAIT_OUT, 0);
+
+    return ret;
+}
+
 static int filter_done(Scheduler *sch, unsigned fg_idx)
 {
     SchFilterGraph *fg = &sch->filters[fg_idx];
@@ -2671,7 +3017,13 @@ static void *task_wrapper(void *arg)
     int ret;
     int err = 0;
 
+    pool_enter(sch);
+    atomic_store(&task->time_start, av_gettime_relative());
+
     ret = task->func(task->func_arg);
+
+    atomic_store(&task->time_end, av_gettime_relative());
+    pool_leave(sch);
     if (ret < 0)
         av_log(task->func_arg, AV_LOG_ERROR,
                "Task finished with error code: %d (%s)\n", ret, av_err2str(ret));
@@ -85,6 +85,7 @@
  * knowledge about the whole transcoding pipeline.
  */
 
+struct AVBPrint;
 struct AVFrame;
 struct AVPacket;
 
@@ -149,6 +150,34 @@ int sch_stop(Scheduler *sch, int64_t *finish_ts);
  */
 int sch_wait(Scheduler *sch, uint64_t timeout_us, int64_t *transcode_ts);
 
+/**
+ * Append per-task pipeline statistics to bp, as a single-line JSON object.
+ *
+ * The object contains the current time and a "tasks" array with one entry
+ * per demuxer, decoder, filtergraph, encoder and muxer, containing the
+ * time it spent busy, blocked on input, blocked on output and waiting for a
+ * pool slot (see sch_set_pool_size()), the number of packets or frames it
+ * processed, its throughput since the previous call and, where applicable,
+ * the current and maximum fill of its input queue.
+ *
+ * Must only be called from one thread at a time.
+ */
+void sch_print_stats(Scheduler *sch, struct AVBPrint *bp);
+
+/**
+ * Limit the number of tasks that may execute concurrently. Must be called
+ * before sch_start().
+ *
+ * Every task still runs in its own thread, but a task only executes its own
+ * code while holding one of pool_size slots; the slot is released for the
+ * duration of every blocking scheduler call (sch_*_receive(), sch_*_send()
+ * etc.), so tasks waiting for their neighbours never hold up the others.
+ *
+ * @param pool_size maximum number of concurrently running tasks, 0 (the
+ *                  default) means no limit
+ */
+void sch_set_pool_size(Scheduler *sch, unsigned pool_size);
+
 /**
  * Add a demuxer to the scheduler.
  *
@@ -16,15 +16,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "libavutil/avassert.h"
-#include "libavutil/container_fifo.h"
 #include "libavutil/error.h"
-#include "libavutil/fifo.h"
 #include "libavutil/frame.h"
-#include "libavutil/intreadwrite.h"
 #include "libavutil/mem.h"
 #include "libavutil/thread.h"
 
@@ -37,15 +35,47 @@ enum {
     FINISHED_RECV = (1 << 1),
 };
 
+/*
+ * The queue is a bounded multi-producer single-consumer ring buffer. Every
+ * slot carries a sequence number which tells its state for the current lap:
+ * - seq == pos         the slot is free for the producer claiming position pos
+ * - seq == pos + 1     the slot contains an item for the consumer at pos
+ * - seq == pos + size  the consumer released the slot for the next lap
+ *
+ * Producers claim positions by advancing tail with a CAS, the (single)
+ * consumer advances head. Items are never copied, the AVFrame/AVPacket
+ * references are moved into objects preallocated in the slots.
+ *
+ * The mutex and condition variable are only used for sleeping when the ring
+ * is full (producers) or has nothing to deliver (consumer), and for the rare
+ * state changes - finishing streams and choking. Waiting threads advertise
+ * themselves in nb_waiting_*, so that the fast paths only need to touch the
+ * lock when somebody actually needs to be woken up.
+ */
+typedef struct TQSlot {
+    atomic_uint_least64_t seq;
+    unsigned              stream_idx;
+    void                 *obj;
+} TQSlot;
+
 struct ThreadQueue {
-    int             choked;
-    int              *finished;
+    atomic_int      choked;
+    atomic_int     *finished;
     unsigned int    nb_streams;
 
     enum ThreadQueueType type;
 
-    AVContainerFifo *fifo;
-    AVFifo          *fifo_stream_index;
+    TQSlot         *slots;
+    size_t          nb_slots;
+
+    atomic_uint_least64_t tail;
+    atomic_uint_least64_t head;
+
+    atomic_uint     nb_waiting_send;
+    atomic_uint     nb_waiting_recv;
+
+    // highest number of items ever stored in the queue
+    atomic_size_t   occupancy_max;
 
     pthread_mutex_t lock;
     pthread_cond_t  cond;
@@ -58,8 +88,15 @@ void tq_free(ThreadQueue **ptq)
     if (!tq)
         return;
 
-    av_container_fifo_free(&tq->fifo);
-    av_fifo_freep2(&tq->fifo_stream_index);
+    if (tq->slots) {
+        for (size_t i = 0; i < tq->nb_slots; i++) {
+            if (tq->type == THREAD_QUEUE_FRAMES)
+                av_frame_free((AVFrame **)&tq->slots[i].obj);
+            else
+                av_packet_free((AVPacket **)&tq->slots[i].obj);
+        }
+    }
+    av_freep(&tq->slots);
 
     av_freep(&tq->finished);
 
@@ -75,6 +112,8 @@ ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
     ThreadQueue *tq;
     int ret;
 
+    av_assert0(queue_size > 0);
+
     tq = av_mallocz(sizeof(*tq));
     if (!tq)
         return NULL;
@@ -92,21 +131,36 @@ ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
         return NULL;
     }
 
+    atomic_init(&tq->choked,          0);
+    atomic_init(&tq->tail,            0);
+    atomic_init(&tq->head,            0);
+    atomic_init(&tq->nb_waiting_send, 0);
+    atomic_init(&tq->nb_waiting_recv, 0);
+    atomic_init(&tq->occupancy_max,   0);
+
     tq->finished = av_calloc(nb_streams, sizeof(*tq->finished));
     if (!tq->finished)
         goto fail;
+    for (unsigned int i = 0; i < nb_streams; i++)
+        atomic_init(&tq->finished[i], 0);
     tq->nb_streams = nb_streams;
 
     tq->type = type;
 
-    tq->fifo = (type == THREAD_QUEUE_FRAMES) ?
-               av_container_fifo_alloc_avframe(0) : av_container_fifo_alloc_avpacket(0);
-    if (!tq->fifo)
+    tq->slots = av_calloc(queue_size, sizeof(*tq->slots));
+    if (!tq->slots)
         goto fail;
+    tq->nb_slots = queue_size;
 
-    tq->fifo_stream_index = av_fifo_alloc2(queue_size, sizeof(unsigned), 0);
-    if (!tq->fifo_stream_index)
-        goto fail;
+    for (size_t i = 0; i < queue_size; i++) {
+        TQSlot *slot = &tq->slots[i];
+
+        atomic_init(&slot->seq, i);
+        slot->obj = (type == THREAD_QUEUE_FRAMES) ?
+                    (void*)av_frame_alloc() : (void*)av_packet_alloc();
+        if (!slot->obj)
+            goto fail;
+    }
 
     return tq;
 fail:
@@ -114,60 +168,162 @@ fail:
     return NULL;
 }
 
+static void wake_waiters(ThreadQueue *tq, atomic_uint *nb_waiting)
+{
+    if (!atomic_load(nb_waiting))
+        return;
+
+    pthread_mutex_lock(&tq->lock);
+    pthread_cond_broadcast(&tq->cond);
+    pthread_mutex_unlock(&tq->lock);
+}
+
+/**
+ * Block until the slot at the given position is released by the consumer or
+ * the stream is finished from the receiving side.
+ */
+static void wait_send(ThreadQueue *tq, atomic_int *finished, uint64_t pos)
+{
+    TQSlot *slot = &tq->slots[pos % tq->nb_slots];
+
+    pthread_mutex_lock(&tq->lock);
+
+    atomic_fetch_add(&tq->nb_waiting_send, 1);
+
+    while (!(atomic_load(finished) & FINISHED_RECV) &&
+           atomic_load(&slot->seq) < pos)
+        pthread_cond_wait(&tq->cond, &tq->lock);
+
+    atomic_fetch_sub(&tq->nb_waiting_send, 1);
+
+    pthread_mutex_unlock(&tq->lock);
+}
+
 int tq_send(ThreadQueue *tq, unsigned int stream_idx, void *data)
 {
-    int *finished;
-    int ret;
+    atomic_int *finished;
+    TQSlot *slot;
+    uint64_t pos;
+    size_t occupancy, occupancy_max;
 
     av_assert0(stream_idx < tq->nb_streams);
     finished = &tq->finished[stream_idx];
 
-    pthread_mutex_lock(&tq->lock);
+    if (atomic_load(finished) & FINISHED_SEND)
+        return AVERROR(EINVAL);
 
-    if (*finished & FINISHED_SEND) {
-        ret = AVERROR(EINVAL);
-        goto finish;
-    }
+    while (1) {
+        uint64_t seq;
 
-    while (!(*finished & FINISHED_RECV) && !av_fifo_can_write(tq->fifo_stream_index))
-        pthread_cond_wait(&tq->cond, &tq->lock);
+        if (atomic_load(finished) & FINISHED_RECV) {
+            atomic_fetch_or(finished, FINISHED_SEND);
+            return AVERROR_EOF;
+        }
 
-    if (*finished & FINISHED_RECV) {
-        ret = AVERROR_EOF;
-        *finished |= FINISHED_SEND;
-    } else {
-        ret = av_fifo_write(tq->fifo_stream_index, &stream_idx, 1);
-        if (ret < 0)
-            goto finish;
+        pos  = atomic_load(&tq->tail);
+        slot = &tq->slots[pos % tq->nb_slots];
+        seq  = atomic_load(&slot->seq);
 
-        ret = av_container_fifo_write(tq->fifo, data, 0);
-        if (ret < 0)
-            goto finish;
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak(&tq->tail, &pos, pos + 1))
+                break;
+        } else if (seq < pos)
+            wait_send(tq, finished, pos);
 
-        pthread_cond_broadcast(&tq->cond);
+        // otherwise another producer claimed this position, retry
     }
 
-finish:
-    pthread_mutex_unlock(&tq->lock);
+    if (tq->type == THREAD_QUEUE_FRAMES)
+        av_frame_move_ref(slot->obj, data);
+    else
+        av_packet_move_ref(slot->obj, data);
+    slot->stream_idx = stream_idx;
 
-    return ret;
+    occupancy = pos + 1 - atomic_load(&tq->head);
+
+    atomic_store(&slot->seq, pos + 1);
+
+    wake_waiters(tq, &tq->nb_waiting_recv);
+
+    occupancy_max = atomic_load_explicit(&tq->occupancy_max, memory_order_relaxed);
+    while (occupancy > occupancy_max &&
+           !atomic_compare_exchange_weak_explicit(&tq->occupancy_max, &occupancy_max,
+                                                  occupancy, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+
+    return 0;
+}
+
+/**
+ * Check whether tq_receive() has anything to return without blocking.
+ * Must be called with the lock held.
+ */
+static int receive_ready(ThreadQueue *tq)
+{
+    uint64_t head = atomic_load(&tq->head);
+
+    if (atomic_load(&tq->choked))
+        return 0;
+
+    if (atomic_load(&tq->slots[head % tq->nb_slots].seq) == head + 1)
+        return 1;
+
+    // items still being written, their producers will wake us up
+    if (atomic_load(&tq->tail) != head)
+        return 0;
+
+    // an EOF to report
+    for (unsigned int i = 0; i < tq->nb_streams; i++)
+        if (atomic_load(&tq->finished[i]) == FINISHED_SEND)
+            return 1;
+
+    return 0;
+}
+
+static void wait_receive(ThreadQueue *tq)
+{
+    pthread_mutex_lock(&tq->lock);
+
+    atomic_fetch_add(&tq->nb_waiting_recv, 1);
+
+    while (!receive_ready(tq))
+        pthread_cond_wait(&tq->cond, &tq->lock);
+
+    atomic_fetch_sub(&tq->nb_waiting_recv, 1);
+
+    pthread_mutex_unlock(&tq->lock);
 }
 
-static int receive_locked(ThreadQueue *tq, int *stream_idx,
-                          void *data)
+static int receive_item(ThreadQueue *tq, int *stream_idx, void *data)
 {
     unsigned int nb_finished = 0;
+    uint64_t head;
 
-    if (tq->choked)
+    if (atomic_load(&tq->choked))
         return AVERROR(EAGAIN);
 
-    while (av_container_fifo_read(tq->fifo, data, 0) >= 0) {
+    head = atomic_load(&tq->head);
+
+    while (1) {
+        TQSlot *slot = &tq->slots[head % tq->nb_slots];
         unsigned idx;
-        int ret;
 
-        ret = av_fifo_read(tq->fifo_stream_index, &idx, 1);
-        av_assert0(ret >= 0);
-        if (tq->finished[idx] & FINISHED_RECV) {
+        if (atomic_load(&slot->seq) != head + 1)
+            break;
+
+        idx = slot->stream_idx;
+        if (tq->type == THREAD_QUEUE_FRAMES)
+            av_frame_move_ref(data, slot->obj);
+        else
+            av_packet_move_ref(data, slot->obj);
+
+        atomic_store(&slot->seq, head + tq->nb_slots);
+        atomic_store(&tq->head, ++head);
+
+        wake_waiters(tq, &tq->nb_waiting_send);
+
+        if (atomic_load(&tq->finished[idx]) & FINISHED_RECV) {
             (tq->type == THREAD_QUEUE_FRAMES) ?
             av_frame_unref(data) : av_packet_unref(data);
             continue;
@@ -178,13 +334,20 @@ static int receive_locked(ThreadQueue *tq, int *stream_idx,
     }
 
     for (unsigned int i = 0; i < tq->nb_streams; i++) {
-        if (!tq->finished[i])
+        int finished = atomic_load(&tq->finished[i]);
+
+        if (!finished)
             continue;
 
         /* return EOF to the consumer at most once for each stream */
-        if (!(tq->finished[i] & FINISHED_RECV)) {
-            tq->finished[i] |= FINISHED_RECV;
-            *stream_idx   = i;
+        if (!(finished & FINISHED_RECV)) {
+            /* the producer may have queued more items before marking the
+             * stream as finished, those must be delivered first */
+            if (atomic_load(&tq->tail) != head)
+                return AVERROR(EAGAIN);
+
+            atomic_fetch_or(&tq->finished[i], FINISHED_RECV);
+            *stream_idx = i;
             return AVERROR_EOF;
         }
 
@@ -200,27 +363,14 @@ int tq_receive(ThreadQueue *tq, int *stream_idx, void *data)
 
     *stream_idx = -1;
 
-    pthread_mutex_lock(&tq->lock);
-
     while (1) {
-        size_t can_read = av_container_fifo_can_read(tq->fifo);
+        ret = receive_item(tq, stream_idx, data);
+        if (ret != AVERROR(EAGAIN))
+            break;
 
-        ret = receive_locked(tq, stream_idx, data);
-
-        // signal other threads if the fifo state changed
-        if (can_read != av_container_fifo_can_read(tq->fifo))
-            pthread_cond_broadcast(&tq->cond);
-
-        if (ret == AVERROR(EAGAIN)) {
-            pthread_cond_wait(&tq->cond, &tq->lock);
-            continue;
-        }
-
-        break;
+        wait_receive(tq);
     }
 
-    pthread_mutex_unlock(&tq->lock);
-
     return ret;
 }
 
@@ -233,8 +383,8 @@ void tq_send_finish(ThreadQueue *tq, unsigned int stream_idx)
     /* mark the stream as send-finished;
      * next time the consumer thread tries to read this stream it will get
      * an EOF and recv-finished flag will be set */
-    tq->finished[stream_idx] |= FINISHED_SEND;
-    tq->choked = 0;
+    atomic_fetch_or(&tq->finished[stream_idx], FINISHED_SEND);
+    atomic_store(&tq->choked, 0);
     pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
@@ -249,7 +399,7 @@ void tq_receive_finish(ThreadQueue *tq, unsigned int stream_idx)
     /* mark the stream as recv-finished;
      * next time the producer thread tries to send for this stream, it will
      * get an EOF and send-finished flag will be set */
-    tq->finished[stream_idx] |= FINISHED_RECV;
+    atomic_fetch_or(&tq->finished[stream_idx], FINISHED_RECV);
     pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
@@ -259,10 +409,22 @@ void tq_choke(ThreadQueue *tq, int choked)
 {
     pthread_mutex_lock(&tq->lock);
 
-    int prev_choked = tq->choked;
-    tq->choked = choked;
+    int prev_choked = atomic_exchange(&tq->choked, choked);
     if (choked != prev_choked)
         pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
 }
+
+size_t tq_occupancy(ThreadQueue *tq)
+{
+    uint64_t head = atomic_load(&tq->head);
+    uint64_t tail = atomic_load(&tq->tail);
+
+    return tail > head ? tail - head : 0;
+}
+
+size_t tq_occupancy_max(ThreadQueue *tq)
+{
+    return atomic_load_explicit(&tq->occupancy_max, memory_order_relaxed);
+}
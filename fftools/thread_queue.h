@@ -48,7 +48,6 @@ void         tq_free(ThreadQueue **tq);
  *             untouched
  * @return
  * - 0 the item was successfully sent
- * - AVERROR(ENOMEM) could not allocate an item for writing to the FIFO
  * - AVERROR(EINVAL) the sending side has previously been marked as finished
  * - AVERROR_EOF the receiving side has marked the given stream as finished
  */
@@ -87,4 +86,16 @@ int tq_receive(ThreadQueue *tq, int *stream_idx, void *data);
  */
 void tq_receive_finish(ThreadQueue *tq, unsigned int stream_idx);
 
+/**
+ * @return number of items currently stored in the queue; this does not
+ *         require any locking, so the value may already be outdated when the
+ *         caller examines it
+ */
+size_t tq_occupancy(ThreadQueue *tq);
+/**
+ * @return the highest number of items that were ever stored in the queue at
+ *         the same time
+ */
+size_t tq_occupancy_max(ThreadQueue *tq);
+
 #endif // FFTOOLS_THREAD_QUEUE_H
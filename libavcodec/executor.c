@@ -20,10 +20,12 @@
 
 #include "config.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 
 #include "libavutil/mem.h"
 #include "libavutil/thread.h"
+#include "libavutil/time.h"
 
 #include "executor.h"
 
@@ -43,16 +45,23 @@
 
 #endif //!HAVE_THREADS
 
-typedef struct ThreadInfo {
-    FFExecutor *e;
-    ExecutorThread thread;
-} ThreadInfo;
-
 typedef struct Queue {
     FFTask *head;
     FFTask *tail;
+    // number of tasks in the queue, readable without holding the lock
+    atomic_int nb_tasks;
 } Queue;
 
+typedef struct ThreadInfo {
+    FFExecutor *e;
+    ExecutorThread thread;
+
+    // tasks assigned to this worker, one queue per priority;
+    // idle workers steal from the queues of the others
+    AVMutex lock;
+    Queue *q;
+} ThreadInfo;
+
 struct FFExecutor {
     FFTaskCallbacks cb;
     int thread_count;
@@ -60,12 +69,18 @@ struct FFExecutor {
 
     ThreadInfo *threads;
     uint8_t *local_contexts;
+    Queue *queues;
+    int nb_queues;  // number of ThreadInfo.q, at least 1 without threads
+    int nb_locks;   // number of initialized ThreadInfo.lock
 
+    // only used to put idle workers to sleep and wake them up
     AVMutex lock;
     AVCond cond;
     int die;
 
-    Queue *q;
+    atomic_int  nb_tasks;
+    atomic_int  nb_sleeping;
+    atomic_uint next_thread;
 };
 
 static FFTask* remove_task(Queue *q)
@@ -76,6 +91,7 @@ static FFTask* remove_task(Queue *q)
         t->next = NULL;
         if (!q->head)
             q->tail = NULL;
+        atomic_fetch_sub_explicit(&q->nb_tasks, 1, memory_order_relaxed);
     }
     return t;
 }
@@ -87,22 +103,48 @@ static void add_task(Queue *q, FFTask *t)
         q->tail = q->head = t;
     else
         q->tail = q->tail->next = t;
+    atomic_fetch_add_explicit(&q->nb_tasks, 1, memory_order_relaxed);
 }
 
-static int run_one_task(FFExecutor *e, void *lc)
+/*
+ * Take the highest priority task, preferring the queues of worker self
+ * over those of the other workers within a priority.
+ */
+static FFTask *get_task(FFExecutor *e, const int self)
 {
-    FFTaskCallbacks *cb = &e->cb;
-    FFTask *t = NULL;
+    for (int p = 0; p < e->cb.priorities; p++) {
+        for (int i = 0; i < e->nb_queues; i++) {
+            ThreadInfo *ti = e->threads + (self + i) % e->nb_queues;
+            Queue *q       = ti->q + p;
+            FFTask *t;
+
+            if (!atomic_load_explicit(&q->nb_tasks, memory_order_relaxed))
+                continue;
+
+            if (e->nb_locks)
+                ff_mutex_lock(&ti->lock);
+            t = remove_task(q);
+            if (e->nb_locks)
+                ff_mutex_unlock(&ti->lock);
+
+            if (t) {
+                atomic_fetch_sub(&e->nb_tasks, 1);
+                return t;
+            }
+        }
+    }
+    return NULL;
+}
 
-    for (int i = 0; i < e->cb.priorities && !t; i++)
-        t = remove_task(e->q + i);
+static int run_one_task(FFExecutor *e, const int self, void *lc)
+{
+    FFTaskCallbacks *cb = &e->cb;
+    FFTask *t = get_task(e, self);
 
     if (t) {
-        if (e->thread_count > 0)
-            ff_mutex_unlock(&e->lock);
+        if (cb->stats)
+            cb->stats(t, av_gettime_relative() - t->queued_time, cb->user_data);
         cb->run(t, lc, cb->user_data);
-        if (e->thread_count > 0)
-            ff_mutex_lock(&e->lock);
         return 1;
     }
     return 0;
@@ -113,18 +155,27 @@ static void *executor_worker_task(void *data)
 {
     ThreadInfo *ti = (ThreadInfo*)data;
     FFExecutor *e  = ti->e;
-    void *lc       = e->local_contexts + (ti - e->threads) * e->cb.local_context_size;
+    const int self = ti - e->threads;
+    void *lc       = e->local_contexts + self * e->cb.local_context_size;
 
-    ff_mutex_lock(&e->lock);
     while (1) {
-        if (e->die) break;
+        int die;
 
-        if (!run_one_task(e, lc)) {
-            //no task in one loop
+        if (run_one_task(e, self, lc))
+            continue;
+
+        //no task in one loop
+        ff_mutex_lock(&e->lock);
+        atomic_fetch_add(&e->nb_sleeping, 1);
+        while (!e->die && !atomic_load(&e->nb_tasks))
             ff_cond_wait(&e->cond, &e->lock);
-        }
+        atomic_fetch_sub(&e->nb_sleeping, 1);
+        die = e->die;
+        ff_mutex_unlock(&e->lock);
+
+        if (die)
+            break;
     }
-    ff_mutex_unlock(&e->lock);
     return NULL;
 }
 #endif
@@ -141,13 +192,15 @@ static av_cold void executor_free(FFExecutor *e, const int has_lock, const int h
         for (int i = 0; i < e->thread_count; i++)
             executor_thread_join(e->threads[i].thread, NULL);
     }
+    for (int i = 0; i < e->nb_locks; i++)
+        ff_mutex_destroy(&e->threads[i].lock);
     if (has_cond)
         ff_cond_destroy(&e->cond);
     if (has_lock)
         ff_mutex_destroy(&e->lock);
 
     av_free(e->threads);
-    av_free(e->q);
+    av_free(e->queues);
     av_free(e->local_contexts);
 
     av_free(e);
@@ -169,14 +222,18 @@ av_cold FFExecutor* ff_executor_alloc(const FFTaskCallbacks *cb, int thread_coun
     if (!e->local_contexts)
         goto free_executor;
 
-    e->q = av_calloc(e->cb.priorities, sizeof(Queue));
-    if (!e->q)
+    e->nb_queues = FFMAX(thread_count, 1);
+    e->queues = av_calloc(e->nb_queues * e->cb.priorities, sizeof(Queue));
+    if (!e->queues)
         goto free_executor;
 
-    e->threads = av_calloc(FFMAX(thread_count, 1), sizeof(*e->threads));
+    e->threads = av_calloc(e->nb_queues, sizeof(*e->threads));
     if (!e->threads)
         goto free_executor;
 
+    for (int i = 0; i < e->nb_queues; i++)
+        e->threads[i].q = e->queues + i * e->cb.priorities;
+
     if (!thread_count)
         return e;
 
@@ -186,6 +243,12 @@ av_cold FFExecutor* ff_executor_alloc(const FFTaskCallbacks *cb, int thread_coun
     if (!has_lock || !has_cond)
         goto free_executor;
 
+    // the workers may steal from any queue as soon as they start
+    for (/* nothing */; e->nb_locks < thread_count; e->nb_locks++) {
+        if (ff_mutex_init(&e->threads[e->nb_locks].lock, NULL))
+            goto free_executor;
+    }
+
     for (/* nothing */; e->thread_count < thread_count; e->thread_count++) {
         ThreadInfo *ti = e->threads + e->thread_count;
         ti->e = e;
@@ -212,11 +275,25 @@ av_cold void ff_executor_free(FFExecutor **executor)
 
 void ff_executor_execute(FFExecutor *e, FFTask *t)
 {
-    if (e->thread_count)
+    if (t) {
+        // spread the tasks over the workers, idle ones steal the rest
+        const unsigned idx = atomic_fetch_add_explicit(&e->next_thread, 1,
+                                                       memory_order_relaxed) % e->nb_queues;
+        ThreadInfo *ti = e->threads + idx;
+
+        if (e->cb.stats)
+            t->queued_time = av_gettime_relative();
+
+        if (e->nb_locks)
+            ff_mutex_lock(&ti->lock);
+        add_task(ti->q + t->priority % e->cb.priorities, t);
+        if (e->nb_locks)
+            ff_mutex_unlock(&ti->lock);
+        atomic_fetch_add(&e->nb_tasks, 1);
+    }
+
+    if (e->thread_count && (!t || atomic_load(&e->nb_sleeping))) {
         ff_mutex_lock(&e->lock);
-    if (t)
-        add_task(e->q + t->priority % e->cb.priorities, t);
-    if (e->thread_count) {
         ff_cond_signal(&e->cond);
         ff_mutex_unlock(&e->lock);
     }
@@ -226,7 +303,7 @@ void ff_executor_execute(FFExecutor *e, FFTask *t)
             return;
         e->recursive = true;
         // We are running in a single-threaded environment, so we must handle all tasks ourselves
-        while (run_one_task(e, e->local_contexts))
+        while (run_one_task(e, 0, e->local_contexts))
             /* nothing */;
         e->recursive = false;
     }
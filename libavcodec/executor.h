@@ -27,12 +27,15 @@
 #ifndef AVCODEC_EXECUTOR_H
 #define AVCODEC_EXECUTOR_H
 
+#include <stdint.h>
+
 typedef struct FFExecutor FFExecutor;
 typedef struct FFTask FFTask;
 
 struct FFTask {
     FFTask *next;
     int priority;   // task priority should >= 0 and < AVTaskCallbacks.priorities
+    int64_t queued_time;    // set by the executor when stats is used
 };
 
 typedef struct FFTaskCallbacks {
@@ -45,6 +48,10 @@ typedef struct FFTaskCallbacks {
 
     // run the task
     int (*run)(FFTask *t, void *local_context, void *user_data);
+
+    // optional, called right before running a task with the time in
+    // microseconds it spent queued; may be called from any worker thread
+    void (*stats)(const FFTask *t, int64_t wait_time, void *user_data);
 } FFTaskCallbacks;
 
 /**
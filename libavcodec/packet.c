@@ -412,21 +412,35 @@ int av_packet_copy_props(AVPacket *dst, const AVPacket *src)
     if (ret < 0)
         return ret;
 
+    if (!src->side_data_elems)
+        return 0;
+
+    // the types in src are unique, so allocate the whole array at once
+    dst->side_data = av_malloc_array(src->side_data_elems, sizeof(*dst->side_data));
+    if (!dst->side_data)
+        goto fail;
+
     for (i = 0; i < src->side_data_elems; i++) {
-        enum AVPacketSideDataType type = src->side_data[i].type;
-        size_t size = src->side_data[i].size;
-        uint8_t *src_data = src->side_data[i].data;
-        uint8_t *dst_data = av_packet_new_side_data(dst, type, size);
-
-        if (!dst_data) {
-            av_buffer_unref(&dst->opaque_ref);
-            av_packet_free_side_data(dst);
-            return AVERROR(ENOMEM);
-        }
-        memcpy(dst_data, src_data, size);
+        const AVPacketSideData *src_sd = &src->side_data[i];
+        AVPacketSideData       *dst_sd = &dst->side_data[i];
+
+        if (src_sd->size > SIZE_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+            goto fail;
+        dst_sd->data = av_malloc(src_sd->size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!dst_sd->data)
+            goto fail;
+        memcpy(dst_sd->data, src_sd->data, src_sd->size);
+        memset(dst_sd->data + src_sd->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        dst_sd->size = src_sd->size;
+        dst_sd->type = src_sd->type;
+        dst->side_data_elems++;
     }
 
     return 0;
+fail:
+    av_buffer_unref(&dst->opaque_ref);
+    av_packet_free_side_data(dst);
+    return AVERROR(ENOMEM);
 }
 
 void av_packet_unref(AVPacket *pkt)
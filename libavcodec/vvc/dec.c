@@ -1241,6 +1241,11 @@ static av_cold int vvc_decode_free(AVCodecContext *avctx)
     ff_cbs_fragment_free(&s->current_frame);
     vvc_decode_flush(avctx);
     ff_vvc_executor_free(&s->executor);
+    if (atomic_load(&s->nb_tasks_run)) {
+        const uint64_t nb_tasks = atomic_load(&s->nb_tasks_run);
+        av_log(avctx, AV_LOG_DEBUG, "%"PRIu64" tasks run, average queue wait %"PRIu64" us\n",
+               nb_tasks, atomic_load(&s->task_wait_time) / nb_tasks);
+    }
     if (s->fcs) {
         for (int i = 0; i < s->nb_fcs; i++)
             frame_context_free(s->fcs + i);
@@ -24,6 +24,8 @@
 #ifndef AVCODEC_VVC_DEC_H
 #define AVCODEC_VVC_DEC_H
 
+#include <stdatomic.h>
+
 #include "libavcodec/videodsp.h"
 #include "libavcodec/vvc.h"
 #include "libavcodec/h274.h"
@@ -242,6 +244,12 @@ typedef struct VVCContext {
     uint16_t seq_output;
 
     struct FFExecutor *executor;
+    /**
+     * Time in microseconds the executor tasks spent queued and the number of
+     * tasks run, only collected when debug logging is enabled
+     */
+    atomic_uint_least64_t task_wait_time;
+    atomic_uint_least64_t nb_tasks_run;
 
     VVCFrameContext *fcs;
     int nb_fcs;
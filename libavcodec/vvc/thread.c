@@ -684,6 +684,14 @@ static int task_run(FFTask *_t, void *local_context, void *user_data)
     return 0;
 }
 
+static void task_stats(const FFTask *t, int64_t wait_time, void *user_data)
+{
+    VVCContext *s = user_data;
+
+    atomic_fetch_add_explicit(&s->task_wait_time, wait_time, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->nb_tasks_run, 1, memory_order_relaxed);
+}
+
 av_cold FFExecutor* ff_vvc_executor_alloc(VVCContext *s, const int thread_count)
 {
     FFTaskCallbacks callbacks = {
@@ -691,6 +699,7 @@ av_cold FFExecutor* ff_vvc_executor_alloc(VVCContext *s, const int thread_count)
         sizeof(VVCLocalContext),
         PRIORITY_LOWEST + 1,
         task_run,
+        av_log_get_level() >= AV_LOG_DEBUG ? task_stats : NULL,
     };
     return ff_executor_alloc(&callbacks, thread_count);
 }
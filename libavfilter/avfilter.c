@@ -204,7 +204,10 @@ static void link_free(AVFilterLink **link)
     li = ff_link_internal(*link);
 
     ff_framequeue_free(&li->fifo);
-    ff_frame_pool_uninit(&li->frame_pool);
+    if (li->l.graph)
+        ff_graph_frame_pool_release(fffiltergraph(li->l.graph), &li->frame_pool);
+    else
+        ff_frame_pool_uninit(&li->frame_pool);
     av_channel_layout_uninit(&(*link)->ch_layout);
     av_frame_side_data_free(&(*link)->side_data, &(*link)->nb_side_data);
 
@@ -621,6 +624,11 @@ int avfilter_process_command(AVFilterContext *filter, const char *cmd, const cha
             av_log(filter, AV_LOG_INFO, "%s", res);
         return 0;
     }else if(!strcmp(cmd, "enable")) {
+        if (fffilter(filter->filter)->fuse) {
+            int ret = fffilter(filter->filter)->fuse(filter, NULL);
+            if (ret < 0)
+                return ret;
+        }
         return set_enable_expr(fffilterctx(filter), arg);
     }else if (fffilter(filter->filter)->process_command) {
         return fffilter(filter->filter)->process_command(filter, cmd, arg, res, res_len, flags);
@@ -269,6 +269,12 @@ unsigned avfilter_filter_pad_count(const AVFilter *filter, int is_output);
  * Process multiple parts of the frame concurrently.
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
+/**
+ * Activate independent filters of a graph concurrently, so that separate
+ * branches and distant parts of long filter chains are processed in parallel.
+ * Only meaningful in AVFilterGraph.thread_type.
+ */
+#define AVFILTER_THREAD_GRAPH (1 << 1)
 
 /** An instance of a filter */
 typedef struct AVFilterContext {
@@ -644,6 +650,15 @@ typedef struct AVFilterGraph {
      * avfilter_graph_config().
      */
     unsigned max_buffered_frames;
+
+    /**
+     * If nonzero, chains of directly connected per-pixel filters (such as
+     * lut, lutyuv and lutrgb) are folded into a single filter pass when
+     * the graph is configured. The output is unchanged.
+     *
+     * This field must be set before calling avfilter_graph_config().
+     */
+    int fuse_filters;
 } AVFilterGraph;
 
 /**
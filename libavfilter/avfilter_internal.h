@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "libavutil/thread.h"
+
 #include "avfilter.h"
 #include "filters.h"
 #include "framequeue.h"
@@ -116,6 +118,15 @@ typedef struct FFFilterContext {
     double *var_values;
 
     struct AVFilterCommand *command_queue;
+
+    /**
+     * Used by ff_filter_graph_run_once() when activating filters concurrently:
+     * the filter lies within FF_GRAPH_ACTIVATE_DISTANCE of a filter already
+     * selected for activation in the batch with the number batch_mark.
+     * batch_depth is the remaining distance at which it was marked.
+     */
+    unsigned batch_mark;
+    int      batch_depth;
 } FFFilterContext;
 
 static inline FFFilterContext *fffilterctx(AVFilterContext *ctx)
@@ -145,6 +156,29 @@ typedef struct FFFilterGraph {
     void *thread;
     avfilter_execute_func *thread_execute;
     FFFrameQueueGlobal frame_queues;
+
+    /**
+     * Worker pool for activating several filters concurrently, non-NULL
+     * when AVFILTER_THREAD_GRAPH is enabled.
+     */
+    void *activate_thread;
+    /// maximum number of filters activated at once
+    int   activate_max;
+    /// filters selected for the current activation batch
+    AVFilterContext **activate_batch;
+    int              *activate_rets;
+    /// number of the current batch, see FFFilterContext.batch_mark
+    unsigned          batch_count;
+
+    /**
+     * Video frame pools shared by the links of the graph, see
+     * ff_graph_video_frame_pool().
+     */
+    struct FFGraphFramePool *frame_pools;
+    int                   nb_frame_pools;
+    /// highest total size of the buffers held by the frame pools
+    size_t                frame_pool_peak;
+    AVMutex               frame_pool_lock;
 } FFFilterGraph;
 
 static inline FFFilterGraph *fffiltergraph(AVFilterGraph *graph)
@@ -152,6 +186,26 @@ static inline FFFilterGraph *fffiltergraph(AVFilterGraph *graph)
     return (FFFilterGraph*)graph;
 }
 
+/**
+ * Replace *pool by the frame pool of the graph for the given video buffer
+ * layout, creating it if necessary. All links of a graph with the same
+ * layout share one pool, so buffers released by any filter are reused by
+ * all of them. The previous *pool, if any, must come from this function.
+ *
+ * This function may be called simultaneously from multiple threads.
+ *
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int ff_graph_video_frame_pool(FFFilterGraph *graph, struct FFFramePool **pool,
+                              int width, int height, enum AVPixelFormat format,
+                              int align);
+
+/**
+ * Release a frame pool obtained with ff_graph_video_frame_pool() and set
+ * *pool to NULL.
+ */
+void ff_graph_frame_pool_release(FFFilterGraph *graph, struct FFFramePool **pool);
+
 /**
  * Update the position of a link in the age heap.
  */
@@ -192,6 +246,29 @@ int ff_graph_thread_init(FFFilterGraph *graph);
 
 void ff_graph_thread_free(FFFilterGraph *graph);
 
+/**
+ * Filters activated concurrently must be at least this far apart in the
+ * graph (counted in links), so that their activations never touch the same
+ * link or filter state.
+ */
+#define FF_GRAPH_ACTIVATE_DISTANCE 5
+
+/**
+ * Create the worker pool used for activating filters concurrently and set
+ * FFFilterGraph.activate_max. Leaves activate_thread NULL if only one thread
+ * is available.
+ */
+int ff_graph_activate_init(FFFilterGraph *graph);
+
+/**
+ * Activate the filters in FFFilterGraph.activate_batch concurrently, storing
+ * the return value of ff_filter_activate() for each of them in
+ * FFFilterGraph.activate_rets.
+ */
+void ff_graph_activate_execute(FFFilterGraph *graph, int nb_filters);
+
+void ff_graph_activate_free(FFFilterGraph *graph);
+
 /**
  * Negotiate the media format, dimensions, etc of all inputs to a filter.
  *
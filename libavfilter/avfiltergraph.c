@@ -38,6 +38,7 @@
 #include "buffersink.h"
 #include "filters.h"
 #include "formats.h"
+#include "framepool.h"
 #include "framequeue.h"
 #include "video.h"
 
@@ -49,6 +50,7 @@ static const AVOption filtergraph_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
         { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, F|V|A, .unit = "thread_type" },
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = F|V|A, .unit = "thread_type" },
+        { "graph", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_GRAPH }, .flags = F|V|A, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads), AV_OPT_TYPE_INT,
         { .i64 = 0 }, 0, INT_MAX, F|V|A, .unit = "threads"},
         {"auto", "autodetect a suitable number of threads to use", 0, AV_OPT_TYPE_CONST, {.i64 = 0 }, .flags = F|V|A, .unit = "threads"},
@@ -58,6 +60,8 @@ static const AVOption filtergraph_options[] = {
         AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, F|A },
     {"max_buffered_frames"  , "maximum number of buffered frames allowed", OFFSET(max_buffered_frames),
         AV_OPT_TYPE_UINT,   {.i64 = 0}, 0, UINT_MAX, F|V|A },
+    {"fuse_filters"         , "fuse chains of per-pixel filters into a single pass", OFFSET(fuse_filters),
+        AV_OPT_TYPE_BOOL,   {.i64 = 0}, 0, 1, F|V },
     { NULL },
 };
 
@@ -80,6 +84,19 @@ int ff_graph_thread_init(FFFilterGraph *graph)
     graph->p.nb_threads  = 1;
     return 0;
 }
+
+int ff_graph_activate_init(FFFilterGraph *graph)
+{
+    return 0;
+}
+
+void ff_graph_activate_execute(FFFilterGraph *graph, int nb_filters)
+{
+}
+
+void ff_graph_activate_free(FFFilterGraph *graph)
+{
+}
 #endif
 
 AVFilterGraph *avfilter_graph_alloc(void)
@@ -95,6 +112,12 @@ AVFilterGraph *avfilter_graph_alloc(void)
     av_opt_set_defaults(ret);
     ff_framequeue_global_init(&graph->frame_queues);
 
+    if (ff_mutex_init(&graph->frame_pool_lock, NULL)) {
+        av_opt_free(ret);
+        av_free(graph);
+        return NULL;
+    }
+
     return ret;
 }
 
@@ -108,14 +131,119 @@ void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter
             graph->nb_filters--;
             filter->graph = NULL;
             for (j = 0; j<filter->nb_outputs; j++)
-                if (filter->outputs[j])
-                    ff_filter_link(filter->outputs[j])->graph = NULL;
+                if (filter->outputs[j]) {
+                    FilterLinkInternal *li = ff_link_internal(filter->outputs[j]);
+                    ff_graph_frame_pool_release(fffiltergraph(graph), &li->frame_pool);
+                    li->l.graph = NULL;
+                }
 
             return;
         }
     }
 }
 
+typedef struct FFGraphFramePool {
+    FFFramePool *pool;
+    int width, height, align;
+    enum AVPixelFormat format;
+    unsigned refcount;
+} FFGraphFramePool;
+
+/* Must be called with frame_pool_lock held. */
+static void frame_pool_unref(FFFilterGraph *graph, FFFramePool **pool)
+{
+    for (int i = 0; i < graph->nb_frame_pools; i++) {
+        FFGraphFramePool *fp = &graph->frame_pools[i];
+        size_t size = 0;
+
+        if (fp->pool != *pool)
+            continue;
+
+        *pool = NULL;
+        if (--fp->refcount)
+            return;
+
+        /* pools never shrink, so the total right before one is freed is
+         * a local maximum of the working set */
+        for (int j = 0; j < graph->nb_frame_pools; j++)
+            size += ff_frame_pool_allocated(graph->frame_pools[j].pool);
+        graph->frame_pool_peak = FFMAX(graph->frame_pool_peak, size);
+
+        ff_frame_pool_uninit(&fp->pool);
+        graph->frame_pools[i] = graph->frame_pools[--graph->nb_frame_pools];
+        return;
+    }
+
+    /* not owned by the graph */
+    ff_frame_pool_uninit(pool);
+}
+
+int ff_graph_video_frame_pool(FFFilterGraph *graph, FFFramePool **pool,
+                              int width, int height, enum AVPixelFormat format,
+                              int align)
+{
+    FFGraphFramePool *fp = NULL;
+    FFFramePool *new_pool;
+    int ret = 0;
+
+    ff_mutex_lock(&graph->frame_pool_lock);
+
+    for (int i = 0; i < graph->nb_frame_pools; i++) {
+        FFGraphFramePool *cur = &graph->frame_pools[i];
+        if (cur->width == width && cur->height == height &&
+            cur->format == format && cur->align == align) {
+            fp = cur;
+            break;
+        }
+    }
+
+    if (!fp) {
+        new_pool = ff_frame_pool_video_init(CONFIG_MEMORY_POISONING ? NULL
+                                                                    : av_buffer_allocz,
+                                            width, height, format, align);
+        if (!new_pool) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        fp = av_dynarray2_add((void **)&graph->frame_pools, &graph->nb_frame_pools,
+                              sizeof(*graph->frame_pools), NULL);
+        if (!fp) {
+            ff_frame_pool_uninit(&new_pool);
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        *fp = (FFGraphFramePool){
+            .pool   = new_pool,
+            .width  = width,
+            .height = height,
+            .format = format,
+            .align  = align,
+        };
+    } else if (fp->pool == *pool) {
+        goto end;
+    }
+
+    fp->refcount++;
+    new_pool = fp->pool;
+    if (*pool)
+        frame_pool_unref(graph, pool);
+    *pool = new_pool;
+
+end:
+    ff_mutex_unlock(&graph->frame_pool_lock);
+    return ret;
+}
+
+void ff_graph_frame_pool_release(FFFilterGraph *graph, FFFramePool **pool)
+{
+    if (!*pool)
+        return;
+
+    ff_mutex_lock(&graph->frame_pool_lock);
+    frame_pool_unref(graph, pool);
+    ff_mutex_unlock(&graph->frame_pool_lock);
+}
+
 void avfilter_graph_free(AVFilterGraph **graphp)
 {
     AVFilterGraph *graph = *graphp;
@@ -128,6 +256,14 @@ void avfilter_graph_free(AVFilterGraph **graphp)
         avfilter_free(graph->filters[0]);
 
     ff_graph_thread_free(graphi);
+    ff_graph_activate_free(graphi);
+
+    av_assert0(!graphi->nb_frame_pools);
+    if (graphi->frame_pool_peak)
+        av_log(graph, AV_LOG_VERBOSE, "Peak frame pool memory: %zu bytes\n",
+               graphi->frame_pool_peak);
+    av_freep(&graphi->frame_pools);
+    ff_mutex_destroy(&graphi->frame_pool_lock);
 
     av_freep(&graphi->sink_links);
 
@@ -1431,6 +1567,41 @@ static int graph_config_pointers(AVFilterGraph *graph, void *log_ctx)
     return 0;
 }
 
+static int can_fuse(const AVFilterContext *f)
+{
+    return fffilter(f->filter)->fuse &&
+           f->nb_inputs == 1 && f->nb_outputs == 1 && !f->enable_str;
+}
+
+/**
+ * Fold chains of directly connected per-pixel filters into their first
+ * filter, so that each frame is only walked once.
+ */
+static int graph_fuse_filters(AVFilterGraph *graph, void *log_ctx)
+{
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *f = graph->filters[i];
+        AVFilterContext *next;
+
+        if (!can_fuse(f))
+            continue;
+
+        for (next = f->outputs[0]->dst; can_fuse(next) &&
+             fffilter(next->filter)->fuse == fffilter(f->filter)->fuse;
+             next = next->outputs[0]->dst) {
+            int ret = fffilter(f->filter)->fuse(f, next);
+            if (ret < 0)
+                return ret;
+            if (!ret)
+                break;
+            av_log(log_ctx, AV_LOG_VERBOSE, "Fused filter '%s' into '%s'\n",
+                   next->name, f->name);
+        }
+    }
+
+    return 0;
+}
+
 int avfilter_graph_config(AVFilterGraph *graphctx, void *log_ctx)
 {
     int ret;
@@ -1447,6 +1618,16 @@ int avfilter_graph_config(AVFilterGraph *graphctx, void *log_ctx)
         return ret;
     if ((ret = graph_config_pointers(graphctx, log_ctx)))
         return ret;
+    if (graphctx->fuse_filters &&
+        (ret = graph_fuse_filters(graphctx, log_ctx)) < 0)
+        return ret;
+
+    if (graphctx->thread_type & AVFILTER_THREAD_GRAPH &&
+        !fffiltergraph(graphctx)->activate_thread) {
+        ret = ff_graph_activate_init(fffiltergraph(graphctx));
+        if (ret < 0)
+            return ret;
+    }
 
     return 0;
 }
@@ -1613,6 +1794,90 @@ int avfilter_graph_request_oldest(AVFilterGraph *graph)
     return 0;
 }
 
+/**
+ * Mark all filters within the given distance from filter as belonging to the
+ * neighbourhood of the current activation batch.
+ */
+static void batch_mark(FFFilterGraph *graphi, AVFilterContext *filter, int depth)
+{
+    FFFilterContext *ctxi = fffilterctx(filter);
+
+    if (ctxi->batch_mark == graphi->batch_count && ctxi->batch_depth >= depth)
+        return;
+    ctxi->batch_mark  = graphi->batch_count;
+    ctxi->batch_depth = depth;
+
+    if (!depth)
+        return;
+
+    for (unsigned i = 0; i < filter->nb_inputs; i++)
+        batch_mark(graphi, filter->inputs[i]->src, depth - 1);
+    for (unsigned i = 0; i < filter->nb_outputs; i++)
+        batch_mark(graphi, filter->outputs[i]->dst, depth - 1);
+}
+
+static int filter_graph_exclusive(const AVFilterContext *filter)
+{
+    return fffilter(filter->filter)->flags_internal &
+           (FF_FILTER_FLAG_GRAPH_EXCLUSIVE | FF_FILTER_FLAG_HWFRAME_AWARE);
+}
+
+/**
+ * Activate first along with as many other ready filters as possible.
+ *
+ * The extra filters are picked so that no two filters in the batch are closer
+ * than FF_GRAPH_ACTIVATE_DISTANCE, so their activations access disjoint
+ * state and commute. In addition, at most one filter in the batch may use
+ * slice threading (the graph slice thread pool is not reentrant) and at most
+ * one may be a sink (sinks update the graph-wide sink link heap).
+ */
+static int filter_graph_run_batch(FFFilterGraph *graphi, AVFilterContext *first)
+{
+    AVFilterGraph *graph = &graphi->p;
+    int nb_batch = 0, have_slice, have_sink, ret;
+
+    if (filter_graph_exclusive(first))
+        return ff_filter_activate(first);
+
+    // 0 means "never marked"
+    if (!++graphi->batch_count)
+        graphi->batch_count++;
+
+    graphi->activate_batch[nb_batch++] = first;
+    batch_mark(graphi, first, FF_GRAPH_ACTIVATE_DISTANCE - 1);
+    have_slice = !!(first->thread_type & AVFILTER_THREAD_SLICE);
+    have_sink  = !first->nb_outputs;
+
+    for (unsigned i = 0; i < graph->nb_filters && nb_batch < graphi->activate_max; i++) {
+        AVFilterContext *filter = graph->filters[i];
+        FFFilterContext *ctxi   = fffilterctx(filter);
+        int slice = !!(filter->thread_type & AVFILTER_THREAD_SLICE);
+        int sink  = !filter->nb_outputs;
+
+        if (!ctxi->ready || ctxi->batch_mark == graphi->batch_count ||
+            filter_graph_exclusive(filter)  ||
+            (slice && have_slice) || (sink && have_sink))
+            continue;
+
+        graphi->activate_batch[nb_batch++] = filter;
+        batch_mark(graphi, filter, FF_GRAPH_ACTIVATE_DISTANCE - 1);
+        have_slice |= slice;
+        have_sink  |= sink;
+    }
+
+    if (nb_batch == 1)
+        return ff_filter_activate(first);
+
+    ff_graph_activate_execute(graphi, nb_batch);
+
+    ret = graphi->activate_rets[0];
+    for (int i = 1; i < nb_batch && ret >= 0; i++)
+        if (graphi->activate_rets[i] < 0)
+            ret = graphi->activate_rets[i];
+
+    return ret;
+}
+
 int ff_filter_graph_run_once(AVFilterGraph *graph)
 {
     FFFilterContext *ctxi;
@@ -1629,5 +1894,7 @@ int ff_filter_graph_run_once(AVFilterGraph *graph)
 
     if (!ctxi->ready)
         return AVERROR(EAGAIN);
+    if (fffiltergraph(graph)->activate_thread)
+        return filter_graph_run_batch(fffiltergraph(graph), &ctxi->p);
     return ff_filter_activate(&ctxi->p);
 }
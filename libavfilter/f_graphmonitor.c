@@ -590,6 +590,7 @@ const FFFilter ff_vf_graphmonitor = {
     FILTER_OUTPUTS(graphmonitor_outputs),
     FILTER_QUERY_FUNC2(query_formats),
     .process_command = ff_filter_process_command,
+    .flags_internal  = FF_FILTER_FLAG_GRAPH_EXCLUSIVE,
 };
 
 #endif // CONFIG_GRAPHMONITOR_FILTER
@@ -608,5 +609,6 @@ const FFFilter ff_avf_agraphmonitor = {
     FILTER_OUTPUTS(graphmonitor_outputs),
     FILTER_QUERY_FUNC2(query_formats),
     .process_command = ff_filter_process_command,
+    .flags_internal  = FF_FILTER_FLAG_GRAPH_EXCLUSIVE,
 };
 #endif // CONFIG_AGRAPHMONITOR_FILTER
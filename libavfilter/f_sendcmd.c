@@ -605,6 +605,7 @@ const FFFilter ff_vf_sendcmd = {
     .p.description = NULL_IF_CONFIG_SMALL("Send commands to filters."),
     .p.flags       = AVFILTER_FLAG_METADATA_ONLY,
     .p.priv_class  = &sendcmd_class,
+    .flags_internal = FF_FILTER_FLAG_GRAPH_EXCLUSIVE,
     .init        = init,
     .uninit      = uninit,
     .priv_size   = sizeof(SendCmdContext),
@@ -629,6 +630,7 @@ const FFFilter ff_af_asendcmd = {
     .p.description = NULL_IF_CONFIG_SMALL("Send commands to filters."),
     .p.priv_class  = &sendcmd_class,
     .p.flags       = AVFILTER_FLAG_METADATA_ONLY,
+    .flags_internal = FF_FILTER_FLAG_GRAPH_EXCLUSIVE,
     .init        = init,
     .uninit      = uninit,
     .priv_size   = sizeof(SendCmdContext),
@@ -221,6 +221,7 @@ const FFFilter ff_vf_zmq = {
     .p.name        = "zmq",
     .p.description = NULL_IF_CONFIG_SMALL("Receive commands through ZMQ and broker them to filters."),
     .p.priv_class  = &zmq_class,
+    .flags_internal = FF_FILTER_FLAG_GRAPH_EXCLUSIVE,
     .init        = init,
     .uninit      = uninit,
     .priv_size   = sizeof(ZMQContext),
@@ -244,6 +245,7 @@ const FFFilter ff_af_azmq = {
     .p.name        = "azmq",
     .p.description = NULL_IF_CONFIG_SMALL("Receive commands through ZMQ and broker them to filters."),
     .p.priv_class  = &zmq_class,
+    .flags_internal = FF_FILTER_FLAG_GRAPH_EXCLUSIVE,
     .init        = init,
     .uninit      = uninit,
     .priv_size   = sizeof(ZMQContext),
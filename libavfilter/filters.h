@@ -206,6 +206,13 @@ static inline FilterLink* ff_filter_link(AVFilterLink *link)
  */
 #define FF_FILTER_FLAG_HWFRAME_AWARE (1 << 0)
 
+/**
+ * The filter accesses other filters of its graph (e.g. by sending commands
+ * to them or reading their links), so it must never be activated
+ * concurrently with other filters.
+ */
+#define FF_FILTER_FLAG_GRAPH_EXCLUSIVE (1 << 1)
+
 /**
  * Find the index of a link.
  *
@@ -445,6 +452,24 @@ typedef struct FFFilter {
      */
     int (*process_command)(AVFilterContext *, const char *cmd, const char *arg, char *res, int res_len, int flags);
 
+    /**
+     * Fold the per-pixel transform of the directly following filter into
+     * this one, so that a chain of such filters is applied in one pass.
+     *
+     * Only called by the graph optimizer after all links are configured,
+     * for single-input single-output filters sharing the same callback and
+     * without timeline support enabled. On success, next must forward its
+     * input frames unchanged from then on and the output of ctx must be
+     * bit-exact with what the unfused chain would have produced.
+     *
+     * When next is NULL, any fusion involving ctx must be undone and every
+     * filter of the chain must apply its own transform again.
+     *
+     * @return 1 if next was fused into ctx, 0 if the filters cannot be
+     *         fused, a negative error code on failure
+     */
+    int (*fuse)(AVFilterContext *ctx, AVFilterContext *next);
+
     /**
      * Filter activation function.
      *
@@ -18,6 +18,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
+
 #include "framepool.h"
 #include "libavutil/avassert.h"
 #include "libavutil/avutil.h"
@@ -47,8 +49,20 @@ struct FFFramePool {
     int linesize[4];
     AVBufferPool *pools[4];
 
+    AVBufferRef* (*alloc)(size_t size);
+    atomic_size_t allocated;
 };
 
+static AVBufferRef *pool_alloc(void *opaque, size_t size)
+{
+    FFFramePool *pool = opaque;
+    AVBufferRef *buf = pool->alloc ? pool->alloc(size) : av_buffer_alloc(size);
+
+    if (buf)
+        atomic_fetch_add_explicit(&pool->allocated, size, memory_order_relaxed);
+    return buf;
+}
+
 FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(size_t size),
                                       int width,
                                       int height,
@@ -65,6 +79,8 @@ FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(size_t size),
         return NULL;
 
     pool->type = AVMEDIA_TYPE_VIDEO;
+    pool->alloc = alloc;
+    atomic_init(&pool->allocated, 0);
     pool->width = width;
     pool->height = height;
     pool->format = format;
@@ -100,7 +116,8 @@ FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(size_t size),
     for (i = 0; i < 4 && sizes[i]; i++) {
         if (sizes[i] > SIZE_MAX - align)
             goto fail;
-        pool->pools[i] = av_buffer_pool_init(sizes[i] + align, alloc);
+        pool->pools[i] = av_buffer_pool_init2(sizes[i] + align, pool,
+                                              pool_alloc, NULL);
         if (!pool->pools[i])
             goto fail;
     }
@@ -128,6 +145,7 @@ FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(size_t size),
     planar = av_sample_fmt_is_planar(format);
 
     pool->type = AVMEDIA_TYPE_AUDIO;
+    atomic_init(&pool->allocated, 0);
     pool->planes = planar ? channels : 1;
     pool->channels = channels;
     pool->nb_samples = nb_samples;
@@ -141,7 +159,8 @@ FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(size_t size),
 
     if (pool->linesize[0] > SIZE_MAX - align)
         goto fail;
-    pool->pools[0] = av_buffer_pool_init(pool->linesize[0] + align, NULL);
+    pool->pools[0] = av_buffer_pool_init2(pool->linesize[0] + align, pool,
+                                          pool_alloc, NULL);
     if (!pool->pools[0])
         goto fail;
 
@@ -280,6 +299,11 @@ fail:
     return NULL;
 }
 
+size_t ff_frame_pool_allocated(FFFramePool *pool)
+{
+    return atomic_load_explicit(&pool->allocated, memory_order_relaxed);
+}
+
 void ff_frame_pool_uninit(FFFramePool **pool)
 {
     int i;
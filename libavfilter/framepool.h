@@ -115,5 +115,13 @@ int ff_frame_pool_get_audio_config(FFFramePool *pool,
  */
 AVFrame *ff_frame_pool_get(FFFramePool *pool);
 
+/**
+ * Get the total size of the buffers allocated by the pool so far. Buffers
+ * are only freed when the pool is uninitialized, so this is the amount of
+ * memory held by the pool.
+ * This function may be called simultaneously from multiple threads.
+ */
+size_t ff_frame_pool_allocated(FFFramePool *pool);
+
 
 #endif /* AVFILTER_FRAMEPOOL_H */
@@ -113,3 +113,52 @@ void ff_graph_thread_free(FFFilterGraph *graph)
         slice_thread_uninit(graph->thread);
     av_freep(&graph->thread);
 }
+
+static void activate_worker(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    FFFilterGraph *graphi = priv;
+    graphi->activate_rets[jobnr] = ff_filter_activate(graphi->activate_batch[jobnr]);
+}
+
+int ff_graph_activate_init(FFFilterGraph *graphi)
+{
+    AVSliceThread *thread;
+    int nb_threads;
+
+    nb_threads = avpriv_slicethread_create(&thread, graphi, activate_worker,
+                                           NULL, graphi->p.nb_threads);
+    if (nb_threads <= 1) {
+        avpriv_slicethread_free(&thread);
+        return FFMIN(nb_threads, 0);
+    }
+
+    graphi->activate_batch = av_calloc(nb_threads, sizeof(*graphi->activate_batch));
+    graphi->activate_rets  = av_calloc(nb_threads, sizeof(*graphi->activate_rets));
+    if (!graphi->activate_batch || !graphi->activate_rets) {
+        avpriv_slicethread_free(&thread);
+        av_freep(&graphi->activate_batch);
+        av_freep(&graphi->activate_rets);
+        return AVERROR(ENOMEM);
+    }
+
+    graphi->activate_thread = thread;
+    graphi->activate_max    = nb_threads;
+
+    return 0;
+}
+
+void ff_graph_activate_execute(FFFilterGraph *graphi, int nb_filters)
+{
+    avpriv_slicethread_execute(graphi->activate_thread, nb_filters, 0);
+}
+
+void ff_graph_activate_free(FFFilterGraph *graphi)
+{
+    AVSliceThread *thread = graphi->activate_thread;
+
+    avpriv_slicethread_free(&thread);
+    graphi->activate_thread = NULL;
+    av_freep(&graphi->activate_batch);
+    av_freep(&graphi->activate_rets);
+    graphi->activate_max = 0;
+}
@@ -72,6 +72,9 @@ typedef struct LutContext {
     int is_planar;
     int is_16bit;
     int step;
+    int passthrough;              ///< table folded into a previous filter
+    AVFilterContext *fused_head;  ///< filter applying the combined table
+    AVFilterContext *fused_next;  ///< next filter folded into this table
 } LutContext;
 
 #define Y 0
@@ -527,6 +530,9 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
     AVFrame *out;
     int direct = 0;
 
+    if (s->passthrough)
+        return ff_filter_frame(outlink, in);
+
     if (av_frame_is_writable(in)) {
         direct = 1;
         out = in;
@@ -570,14 +576,74 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
     return ff_filter_frame(outlink, out);
 }
 
+/**
+ * Restore the own table of every filter of the fused chain ctx belongs to.
+ */
+static int unfuse(AVFilterContext *ctx)
+{
+    LutContext *s = ctx->priv;
+    AVFilterContext *f = s->fused_head ? s->fused_head : ctx;
+
+    while (f) {
+        LutContext *fs = f->priv;
+        AVFilterContext *next = fs->fused_next;
+        int ret;
+
+        fs->passthrough = 0;
+        fs->fused_head  = NULL;
+        fs->fused_next  = NULL;
+        if ((ret = config_props(f->inputs[0])) < 0)
+            return ret;
+        f = next;
+    }
+
+    return 0;
+}
+
+static int fuse(AVFilterContext *ctx, AVFilterContext *next)
+{
+    LutContext *s = ctx->priv, *n;
+    AVFilterContext *last = ctx;
+
+    if (!next)
+        return s->fused_head || s->fused_next ? unfuse(ctx) : 0;
+
+    n = next->priv;
+    if (n->fused_head == ctx)
+        return 1;
+    if (s->fused_head || n->fused_head || next == ctx ||
+        next->inputs[0]->format != ctx->inputs[0]->format)
+        return 0;
+
+    /* Both tables are indexed by the same components of the same pixel
+     * format and hold in-range values, so chaining them is exact. */
+    for (int comp = 0; comp < 4; comp++)
+        for (int val = 0; val < FF_ARRAY_ELEMS(s->lut[comp]); val++)
+            s->lut[comp][val] = n->lut[comp][s->lut[comp][val]];
+
+    while (((LutContext *)last->priv)->fused_next)
+        last = ((LutContext *)last->priv)->fused_next;
+    ((LutContext *)last->priv)->fused_next = next;
+
+    n->passthrough = 1;
+    for (AVFilterContext *f = next; f; f = ((LutContext *)f->priv)->fused_next)
+        ((LutContext *)f->priv)->fused_head = ctx;
+
+    return 1;
+}
+
 static int process_command(AVFilterContext *ctx, const char *cmd, const char *args,
                            char *res, int res_len, int flags)
 {
+    LutContext *s = ctx->priv;
     int ret = ff_filter_process_command(ctx, cmd, args, res, res_len, flags);
 
     if (ret < 0)
         return ret;
 
+    if (s->fused_head || s->fused_next)
+        return unfuse(ctx);
+
     return config_props(ctx->inputs[0]);
 }
 
@@ -603,6 +669,7 @@ static const AVFilterPad inputs[] = {
         FILTER_OUTPUTS(ff_video_default_filterpad),                     \
         FILTER_QUERY_FUNC2(query_formats),                              \
         .process_command = process_command,                             \
+        .fuse            = fuse,                                        \
     }
 
 AVFILTER_DEFINE_CLASS_EXT(lut, "lut/lutyuv/lutrgb", options);
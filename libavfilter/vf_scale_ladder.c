@@ -0,0 +1,442 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * scale one input to several output sizes at once
+ *
+ * Every output is produced by its own SwsContext. Outputs are sorted by
+ * size and, when cascading is enabled, each one is scaled from the smallest
+ * already scaled output covering it instead of from the input, so the full
+ * resolution input and any format conversion are only processed once.
+ * Outputs which do not depend on each other are scaled concurrently.
+ */
+
+#include <stdio.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/internal.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/parseutils.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+
+#include "avfilter.h"
+#include "filters.h"
+#include "formats.h"
+#include "scale_eval.h"
+#include "video.h"
+
+typedef struct LadderRung {
+    int w, h;           ///< requested dimensions, may be -n as in scale
+    SwsContext *sws;
+    AVFrame *frame;     ///< scaled output for the current input frame
+    int src;            ///< index of the rung scaled from, -1 for the input
+    int level;          ///< number of scaling steps from the input
+    int needed;         ///< output for the current input frame is required
+} LadderRung;
+
+typedef struct ScaleLadderContext {
+    const AVClass *class;
+
+    char *sizes_str;
+    enum AVPixelFormat format;
+    int cascade;
+    char *flags_str;
+
+    LadderRung *rungs;
+    int nb_rungs;
+    int nb_levels;
+    int planned;
+
+    /* rungs of the level being processed */
+    int *jobs;
+    int *job_rets;
+    int nb_jobs;
+    AVFrame *in;
+} ScaleLadderContext;
+
+static int config_output(AVFilterLink *outlink);
+
+static av_cold int init(AVFilterContext *ctx)
+{
+    ScaleLadderContext *s = ctx->priv;
+    char *sizes, *saveptr = NULL, *token;
+    int ret = 0;
+
+    sizes = av_strdup(s->sizes_str);
+    if (!sizes)
+        return AVERROR(ENOMEM);
+
+    for (token = av_strtok(sizes, "|", &saveptr); token;
+         token = av_strtok(NULL, "|", &saveptr)) {
+        LadderRung *rung;
+        AVFilterPad pad = { 0 };
+        int w, h;
+
+        if (sscanf(token, "%dx%d", &w, &h) != 2 &&
+            av_parse_video_size(&w, &h, token) < 0) {
+            av_log(ctx, AV_LOG_ERROR, "Invalid size '%s'\n", token);
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        if ((w < 0 && h < 0) || !w || !h) {
+            av_log(ctx, AV_LOG_ERROR, "Invalid size '%s'\n", token);
+            ret = AVERROR(EINVAL);
+            break;
+        }
+
+        rung = av_dynarray2_add((void **)&s->rungs, &s->nb_rungs,
+                                sizeof(*s->rungs), NULL);
+        if (!rung) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        memset(rung, 0, sizeof(*rung));
+        rung->w = w;
+        rung->h = h;
+
+        rung->sws = sws_alloc_context();
+        if (!rung->sws) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        if (s->flags_str && *s->flags_str) {
+            ret = av_opt_set(rung->sws, "sws_flags", s->flags_str, 0);
+            if (ret < 0)
+                break;
+        }
+        rung->sws->threads = ff_filter_get_nb_threads(ctx);
+
+        pad.type = AVMEDIA_TYPE_VIDEO;
+        pad.name = av_asprintf("output%d", s->nb_rungs - 1);
+        if (!pad.name) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        pad.config_props = config_output;
+        if ((ret = ff_append_outpad_free_name(ctx, &pad)) < 0)
+            break;
+    }
+    av_free(sizes);
+    if (ret < 0)
+        return ret;
+
+    if (!s->nb_rungs) {
+        av_log(ctx, AV_LOG_ERROR, "No output sizes specified\n");
+        return AVERROR(EINVAL);
+    }
+
+    s->jobs     = av_calloc(s->nb_rungs, sizeof(*s->jobs));
+    s->job_rets = av_calloc(s->nb_rungs, sizeof(*s->job_rets));
+    if (!s->jobs || !s->job_rets)
+        return AVERROR(ENOMEM);
+
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    ScaleLadderContext *s = ctx->priv;
+
+    for (int i = 0; i < s->nb_rungs; i++) {
+        sws_free_context(&s->rungs[i].sws);
+        av_frame_free(&s->rungs[i].frame);
+    }
+    av_freep(&s->rungs);
+    av_freep(&s->jobs);
+    av_freep(&s->job_rets);
+    s->nb_rungs = 0;
+}
+
+static int query_formats(const AVFilterContext *ctx,
+                         AVFilterFormatsConfig **cfg_in,
+                         AVFilterFormatsConfig **cfg_out)
+{
+    const ScaleLadderContext *s = ctx->priv;
+    AVFilterFormats *formats = NULL;
+    const AVPixFmtDescriptor *desc = NULL;
+    int ret;
+
+    while ((desc = av_pix_fmt_desc_next(desc))) {
+        enum AVPixelFormat pix_fmt = av_pix_fmt_desc_get_id(desc);
+        if (sws_test_format(pix_fmt, 0) &&
+            (s->format != AV_PIX_FMT_NONE || sws_test_format(pix_fmt, 1))) {
+            if ((ret = ff_add_format(&formats, pix_fmt)) < 0)
+                return ret;
+        }
+    }
+
+    if (s->format == AV_PIX_FMT_NONE)
+        return ff_set_common_formats2(ctx, cfg_in, cfg_out, formats);
+
+    if ((ret = ff_formats_ref(formats, &cfg_in[0]->formats)) < 0)
+        return ret;
+    if ((ret = ff_formats_ref(ff_all_color_spaces(), &cfg_in[0]->color_spaces)) < 0 ||
+        (ret = ff_formats_ref(ff_all_color_ranges(), &cfg_in[0]->color_ranges)) < 0)
+        return ret;
+
+    for (int i = 0; i < ctx->nb_outputs; i++) {
+        formats = ff_make_formats_list_singleton(s->format);
+        if ((ret = ff_formats_ref(formats, &cfg_out[i]->formats)) < 0)
+            return ret;
+        if ((ret = ff_formats_ref(ff_all_color_spaces(), &cfg_out[i]->color_spaces)) < 0 ||
+            (ret = ff_formats_ref(ff_all_color_ranges(), &cfg_out[i]->color_ranges)) < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int config_output(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    ScaleLadderContext *s = ctx->priv;
+    AVFilterLink *inlink = ctx->inputs[0];
+    LadderRung *rung = &s->rungs[FF_OUTLINK_IDX(outlink)];
+    int w = rung->w, h = rung->h, ret;
+
+    ret = ff_scale_adjust_dimensions(inlink, &w, &h,
+                                     SCALE_FORCE_OAR_DISABLE, 1, 1.f);
+    if (ret < 0)
+        return ret;
+
+    outlink->w = w;
+    outlink->h = h;
+    if (inlink->sample_aspect_ratio.num)
+        outlink->sample_aspect_ratio = av_mul_q((AVRational){ h * inlink->w, w * inlink->h },
+                                                inlink->sample_aspect_ratio);
+    else
+        outlink->sample_aspect_ratio = inlink->sample_aspect_ratio;
+
+    av_log(ctx, AV_LOG_VERBOSE, "output%d: w:%d h:%d fmt:%s\n",
+           FF_OUTLINK_IDX(outlink), w, h, av_get_pix_fmt_name(outlink->format));
+
+    s->planned = 0;
+    return 0;
+}
+
+/**
+ * Choose the source of every rung: the input, or with cascading the
+ * smallest other rung which is at least as large in both dimensions.
+ */
+static void plan_rungs(AVFilterContext *ctx)
+{
+    ScaleLadderContext *s = ctx->priv;
+
+    s->nb_levels = 0;
+    for (int i = 0; i < s->nb_rungs; i++) {
+        const AVFilterLink *out = ctx->outputs[i];
+        LadderRung *rung = &s->rungs[i];
+        int64_t best_area = INT64_MAX;
+
+        rung->src   = -1;
+        rung->level = 0;
+        if (!s->cascade)
+            continue;
+
+        for (int j = 0; j < s->nb_rungs; j++) {
+            const AVFilterLink *cand = ctx->outputs[j];
+            int64_t area = (int64_t)cand->w * cand->h;
+
+            if (j == i || cand->w < out->w || cand->h < out->h)
+                continue;
+            /* ties are broken by index, so equal sizes cannot form a loop */
+            if (cand->w == out->w && cand->h == out->h && j > i)
+                continue;
+            if (area < best_area) {
+                best_area = area;
+                rung->src = j;
+            }
+        }
+    }
+
+    /* sources always cover their rung, so following them terminates */
+    for (int i = 0; i < s->nb_rungs; i++) {
+        for (int j = s->rungs[i].src; j >= 0; j = s->rungs[j].src)
+            s->rungs[i].level++;
+        s->nb_levels = FFMAX(s->nb_levels, s->rungs[i].level + 1);
+    }
+
+    s->planned = 1;
+}
+
+static int scale_rung(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ScaleLadderContext *s = ctx->priv;
+    AVFilterLink *inlink = ctx->inputs[0];
+    int idx = s->jobs[jobnr];
+    LadderRung *rung = &s->rungs[idx];
+    AVFilterLink *outlink = ctx->outputs[idx];
+    AVFrame *in = rung->src < 0 ? s->in : s->rungs[rung->src].frame;
+    AVFrame *out;
+    int ret;
+
+    out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+    if (!out)
+        return AVERROR(ENOMEM);
+
+    ret = av_frame_copy_props(out, in);
+    if (ret < 0)
+        goto fail;
+    out->width       = outlink->w;
+    out->height      = outlink->h;
+    out->colorspace  = outlink->colorspace;
+    out->color_range = outlink->color_range;
+    av_reduce(&out->sample_aspect_ratio.num, &out->sample_aspect_ratio.den,
+              (int64_t)s->in->sample_aspect_ratio.num * outlink->h * inlink->w,
+              (int64_t)s->in->sample_aspect_ratio.den * outlink->w * inlink->h,
+              INT_MAX);
+
+    if (out->width != in->width || out->height != in->height)
+        av_frame_side_data_remove_by_props(&out->side_data, &out->nb_side_data,
+                                           AV_SIDE_DATA_PROP_SIZE_DEPENDENT);
+
+    if (sws_is_noop(out, in)) {
+        av_frame_free(&out);
+        rung->frame = av_frame_clone(in);
+        return rung->frame ? 0 : AVERROR(ENOMEM);
+    }
+
+    ret = sws_scale_frame(rung->sws, out, in);
+    if (ret < 0)
+        goto fail;
+
+    rung->frame = out;
+    return 0;
+fail:
+    av_frame_free(&out);
+    return ret;
+}
+
+static int filter_frame(AVFilterContext *ctx, AVFrame *in)
+{
+    ScaleLadderContext *s = ctx->priv;
+    int flags_orig, ret = 0;
+
+    if (!s->planned)
+        plan_rungs(ctx);
+
+    /* closed outputs are still scaled if an open one cascades from them */
+    for (int i = 0; i < s->nb_rungs; i++)
+        s->rungs[i].needed = 0;
+    for (int i = 0; i < s->nb_rungs; i++) {
+        if (ff_outlink_get_status(ctx->outputs[i]))
+            continue;
+        for (int j = i; j >= 0; j = s->rungs[j].src)
+            s->rungs[j].needed = 1;
+    }
+
+    /* same defaults as the scale filter: progressive, unknown chroma siting */
+    flags_orig = in->flags;
+    in->flags &= ~AV_FRAME_FLAG_INTERLACED;
+    in->chroma_location = AVCHROMA_LOC_UNSPECIFIED;
+
+    s->in = in;
+    for (int level = 0; level < s->nb_levels && ret >= 0; level++) {
+        s->nb_jobs = 0;
+        for (int i = 0; i < s->nb_rungs; i++)
+            if (s->rungs[i].needed && s->rungs[i].level == level)
+                s->jobs[s->nb_jobs++] = i;
+        if (!s->nb_jobs)
+            continue;
+
+        ff_filter_execute(ctx, scale_rung, NULL, s->job_rets, s->nb_jobs);
+        for (int i = 0; i < s->nb_jobs && ret >= 0; i++)
+            ret = s->job_rets[i];
+    }
+    s->in = NULL;
+    av_frame_free(&in);
+
+    /* outputs are only sent once all rungs are done with their sources */
+    for (int i = 0; i < s->nb_rungs; i++) {
+        AVFrame *out = s->rungs[i].frame;
+
+        s->rungs[i].frame = NULL;
+        if (ret < 0 || !out || ff_outlink_get_status(ctx->outputs[i])) {
+            av_frame_free(&out);
+            continue;
+        }
+        out->flags = flags_orig;
+        ret = ff_filter_frame(ctx->outputs[i], out);
+    }
+
+    return ret;
+}
+
+static int activate(AVFilterContext *ctx)
+{
+    AVFilterLink *inlink = ctx->inputs[0];
+    AVFrame *in;
+    int status, ret, nb_eofs = 0;
+    int64_t pts;
+
+    for (int i = 0; i < ctx->nb_outputs; i++)
+        nb_eofs += ff_outlink_get_status(ctx->outputs[i]) == AVERROR_EOF;
+
+    if (nb_eofs == ctx->nb_outputs) {
+        ff_inlink_set_status(inlink, AVERROR_EOF);
+        return 0;
+    }
+
+    ret = ff_inlink_consume_frame(inlink, &in);
+    if (ret < 0)
+        return ret;
+    if (ret > 0)
+        return filter_frame(ctx, in);
+
+    if (ff_inlink_acknowledge_status(inlink, &status, &pts)) {
+        for (int i = 0; i < ctx->nb_outputs; i++) {
+            if (ff_outlink_get_status(ctx->outputs[i]))
+                continue;
+            ff_outlink_set_status(ctx->outputs[i], status, pts);
+        }
+        return 0;
+    }
+
+    FF_FILTER_FORWARD_WANTED_ANY(ctx, inlink);
+
+    return FFERROR_NOT_READY;
+}
+
+#define OFFSET(x) offsetof(ScaleLadderContext, x)
+#define FLAGS AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_FILTERING_PARAM
+
+static const AVOption scale_ladder_options[] = {
+    { "sizes",   "set the '|'-separated list of output sizes", OFFSET(sizes_str), AV_OPT_TYPE_STRING, { .str = NULL }, .flags = FLAGS },
+    { "format",  "set the output pixel format", OFFSET(format), AV_OPT_TYPE_PIXEL_FMT, { .i64 = AV_PIX_FMT_NONE }, AV_PIX_FMT_NONE, INT_MAX, FLAGS },
+    { "cascade", "scale each output from the next larger one", OFFSET(cascade), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, FLAGS },
+    { "flags",   "set libswscale flags", OFFSET(flags_str), AV_OPT_TYPE_STRING, { .str = "" }, .flags = FLAGS },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(scale_ladder);
+
+const FFFilter ff_vf_scale_ladder = {
+    .p.name        = "scale_ladder",
+    .p.description = NULL_IF_CONFIG_SMALL("Scale the input video to several output sizes at once."),
+    .p.priv_class  = &scale_ladder_class,
+    .p.flags       = AVFILTER_FLAG_DYNAMIC_OUTPUTS | AVFILTER_FLAG_SLICE_THREADS,
+    .priv_size     = sizeof(ScaleLadderContext),
+    .init          = init,
+    .uninit        = uninit,
+    .activate      = activate,
+    FILTER_INPUTS(ff_video_default_filterpad),
+    FILTER_QUERY_FUNC2(query_formats),
+};
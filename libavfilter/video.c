@@ -70,23 +70,21 @@ AVFrame *ff_default_get_video_buffer2(AVFilterLink *link, int w, int h, int alig
         return frame;
     }
 
-    if (!li->frame_pool) {
-        li->frame_pool = ff_frame_pool_video_init(CONFIG_MEMORY_POISONING
-                                                     ? NULL
-                                                     : av_buffer_allocz,
-                                                  w, h, link->format, align);
-        if (!li->frame_pool)
-            return NULL;
-    } else {
-        if (ff_frame_pool_get_video_config(li->frame_pool,
-                                           &pool_width, &pool_height,
-                                           &pool_format, &pool_align) < 0) {
-            return NULL;
-        }
-
-        if (pool_width != w || pool_height != h ||
-            pool_format != link->format || pool_align != align) {
+    if (li->frame_pool &&
+        ff_frame_pool_get_video_config(li->frame_pool,
+                                       &pool_width, &pool_height,
+                                       &pool_format, &pool_align) < 0)
+        return NULL;
 
+    if (!li->frame_pool ||
+        pool_width != w || pool_height != h ||
+        pool_format != link->format || pool_align != align) {
+        if (li->l.graph) {
+            if (ff_graph_video_frame_pool(fffiltergraph(li->l.graph),
+                                          &li->frame_pool,
+                                          w, h, link->format, align) < 0)
+                return NULL;
+        } else {
             ff_frame_pool_uninit(&li->frame_pool);
             li->frame_pool = ff_frame_pool_video_init(CONFIG_MEMORY_POISONING
                                                          ? NULL
@@ -1884,6 +1884,17 @@ typedef struct AVFormatContext {
      * @see skip_estimate_duration_from_pts
      */
     int64_t duration_probesize;
+
+    /**
+     * Directory in which the index built while demuxing is kept between
+     * runs, for inputs that have no index of their own. The cached index
+     * is only used for the exact same input data.
+     *
+     * Demuxing only, set by the caller before avformat_open_input().
+     *
+     * @see avformat_index_load()
+     */
+    char *index_cache;
 } AVFormatContext;
 
 /**
@@ -2775,6 +2786,32 @@ const AVIndexEntry *avformat_index_get_entry_from_timestamp(AVStream *st,
 int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp,
                        int size, int distance, int flags);
 
+/**
+ * Write the index entries of all streams to a file, so that they can be
+ * restored with avformat_index_load() when the same input is opened again.
+ *
+ * The file is tied to the input data by its size, modification time and
+ * a hash of its first and last bytes, so the input must be seekable.
+ *
+ * @param s   opened demuxer context
+ * @param url file to write the index to, it is replaced atomically
+ * @return >= 0 on success, a negative AVERROR code on failure
+ */
+int avformat_index_save(AVFormatContext *s, const char *url);
+
+/**
+ * Load index entries written by avformat_index_save().
+ *
+ * The entries are merged into the index of the streams that match the
+ * saved ones.
+ *
+ * @param s   opened demuxer context
+ * @param url file to read the index from
+ * @return >= 0 on success, AVERROR(ESTALE) if the index was saved for
+ *         different input data, another negative AVERROR code on failure
+ */
+int avformat_index_load(AVFormatContext *s, const char *url);
+
 
 /**
  * Split a URL string into components.
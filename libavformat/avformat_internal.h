@@ -30,6 +30,8 @@
 #include "avformat.h"
 #include "internal.h"
 
+#define FF_INDEX_CACHE_KEY_SIZE 48
+
 typedef struct FormatContextInternal {
     FFFormatContext fc;
 
@@ -93,6 +95,27 @@ typedef struct FormatContextInternal {
              * Set if chapter ids are strictly monotonic.
              */
             int chapter_ids_monotonic;
+
+            /**
+             * File the index is loaded from and saved to, if the index
+             * cache is in use.
+             */
+            char *index_cache_url;
+
+            /**
+             * Set once the cached index has been merged into the index.
+             */
+            int index_cache_loaded;
+
+            /**
+             * Number of index entries taken from the cached index.
+             */
+            int64_t index_cache_nb_entries;
+
+            /**
+             * Identifies the input data the cached index belongs to.
+             */
+            uint8_t index_cache_key[FF_INDEX_CACHE_KEY_SIZE];
         };
     };
 } FormatContextInternal;
@@ -139,6 +162,22 @@ static av_always_inline const FFStreamGroup *cffstreamgroup(const AVStreamGroup
 
 void ff_flush_packet_queue(AVFormatContext *s);
 
+/**
+ * Set up the index cache for the input if AVFormatContext.index_cache is set
+ * and the demuxer did not create an index of its own.
+ */
+void ff_index_cache_open(AVFormatContext *s);
+
+/**
+ * Merge the cached index into the index of the streams, if not done yet.
+ */
+void ff_index_cache_load(AVFormatContext *s);
+
+/**
+ * Save the index to the cache if it was extended since it was loaded.
+ */
+void ff_index_cache_close(AVFormatContext *s);
+
 const struct AVCodec *ff_find_decoder(AVFormatContext *s, const AVStream *st,
                                       enum AVCodecID codec_id);
 
@@ -115,6 +115,43 @@ URLContext *ffio_geturlcontext(AVIOContext *s)
         return NULL;
 }
 
+int ffio_read_ref(AVIOContext *s, int size, int padding, AVBufferRef **buf)
+{
+    FFIOContext *const ctx = ffiocontext(s);
+    URLContext *h = ffio_geturlcontext(s);
+    int64_t pos, ret;
+    int short_seek;
+
+    if (!h || !h->prot->url_get_buffer || s->write_flag || s->update_checksum ||
+        size > INT_MAX - padding)
+        return AVERROR(ENOSYS);
+
+    /* avio_seek() would read shorter skips through the buffer */
+    short_seek = ctx->short_seek_threshold;
+    if (ctx->short_seek_get)
+        short_seek = FFMAX(ctx->short_seek_get(s->opaque), short_seek);
+    if (size <= s->buffer_size + short_seek)
+        return AVERROR(ENOSYS);
+
+    pos = avio_tell(s);
+    if (pos < 0)
+        return pos;
+
+    ret = h->prot->url_get_buffer(h, pos, size + padding, buf);
+    if (ret < 0)
+        return ret;
+    (*buf)->size = size;
+
+    /* let the caller read the data normally instead */
+    ret = avio_seek(s, pos + size, SEEK_SET);
+    if (ret < 0) {
+        av_buffer_unref(buf);
+        return AVERROR(ENOSYS);
+    }
+
+    return size;
+}
+
 static int url_alloc_for_protocol(URLContext **puc, const URLProtocol *up,
                                   const char *filename, int flags,
                                   const AVIOInterruptCB *int_cb)
@@ -413,6 +450,8 @@ fail:
 int ffio_fdopen(AVIOContext **sp, URLContext *h)
 {
     AVIOContext *s;
+    AVBufferPool *pool = NULL;
+    AVBufferRef *ref = NULL;
     uint8_t *buffer = NULL;
     int buffer_size, max_packet_size;
 
@@ -427,17 +466,43 @@ int ffio_fdopen(AVIOContext **sp, URLContext *h)
             return AVERROR(EINVAL);
         buffer_size *= 2;
     }
-    buffer = av_malloc(buffer_size);
+    if ((h->flags & AVIO_FLAG_WRITE) && h->prot->url_write_buffer) {
+        /* the protocol sends from the buffers without copying them,
+         * so each writeout needs a new one */
+        int ret = h->prot->url_write_buffer(h, NULL, 0);
+        if (ret > 0) {
+            if (!max_packet_size)
+                buffer_size = ret;
+            pool = av_buffer_pool_init(buffer_size, NULL);
+            if (!pool || !(ref = av_buffer_pool_get(pool))) {
+                av_buffer_pool_uninit(&pool);
+                return AVERROR(ENOMEM);
+            }
+            buffer = ref->data;
+        }
+    }
+    if (!buffer)
+        buffer = av_malloc(buffer_size);
     if (!buffer)
         return AVERROR(ENOMEM);
 
     *sp = avio_alloc_context(buffer, buffer_size, h->flags & AVIO_FLAG_WRITE, h,
                              ffurl_read2, ffurl_write2, ffurl_seek2);
     if (!*sp) {
-        av_freep(&buffer);
+        if (ref) {
+            av_buffer_unref(&ref);
+            av_buffer_pool_uninit(&pool);
+        } else
+            av_freep(&buffer);
         return AVERROR(ENOMEM);
     }
     s = *sp;
+    if (ref) {
+        FFIOContext *const ctx = ffiocontext(s);
+        ctx->write_buffer_pool   = pool;
+        ctx->write_buffer        = ref;
+        ctx->write_buffer_packet = ffurl_write_buffer;
+    }
     if (h->protocol_whitelist) {
         s->protocol_whitelist = av_strdup(h->protocol_whitelist);
         if (!s->protocol_whitelist) {
@@ -575,6 +640,20 @@ int ffurl_write2(void *urlcontext, const uint8_t *buf, int size)
     return retry_transfer_wrapper(h, NULL, buf, size, size, 0);
 }
 
+int ffurl_write_buffer(void *urlcontext, AVBufferRef *buf, int size)
+{
+    URLContext *h = urlcontext;
+
+    if (!(h->flags & AVIO_FLAG_WRITE))
+        return AVERROR(EIO);
+    if (!h->prot->url_write_buffer)
+        return AVERROR(ENOSYS);
+    if (h->max_packet_size && size > h->max_packet_size)
+        return AVERROR(EIO);
+
+    return h->prot->url_write_buffer(h, buf, size);
+}
+
 int64_t ffurl_seek2(void *urlcontext, int64_t pos, int whence)
 {
     URLContext *h = urlcontext;
@@ -627,7 +706,7 @@ int avio_close(AVIOContext *s)
     h         = s->opaque;
     s->opaque = NULL;
 
-    av_freep(&s->buffer);
+    ffio_free_buffer(s);
     if (s->write_flag)
         av_log(s, AV_LOG_VERBOSE,
                "Statistics: %"PRId64" bytes written, %d seeks, %d writeouts\n",
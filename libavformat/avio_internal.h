@@ -21,6 +21,7 @@
 
 #include "avio.h"
 
+#include "libavutil/buffer.h"
 #include "libavutil/log.h"
 
 extern const AVClass ff_avio_class;
@@ -76,6 +77,15 @@ typedef struct FFIOContext {
      * is updated each time a successful writeout ends up further position-wise
      */
     int64_t written_output_size;
+
+    /**
+     * Pool the write buffer is taken from, if the data is handed over to
+     * write_buffer_packet without copying. A new buffer is taken from the
+     * pool after each writeout.
+     */
+    AVBufferPool *write_buffer_pool;
+    AVBufferRef *write_buffer;
+    int (*write_buffer_packet)(void *opaque, AVBufferRef *buf, int buf_size);
 } FFIOContext;
 
 static av_always_inline FFIOContext *ffiocontext(AVIOContext *ctx)
@@ -92,6 +102,12 @@ void ffio_init_context(FFIOContext *s,
                   int (*write_packet)(void *opaque, const uint8_t *buf, int buf_size),
                   int64_t (*seek)(void *opaque, int64_t offset, int whence));
 
+/**
+ * Free the buffer of s, releasing it to the write buffer pool if it was
+ * taken from one. s->buffer is set to NULL.
+ */
+void ffio_free_buffer(AVIOContext *s);
+
 /**
  * Wrap a buffer in an AVIOContext for reading.
  */
@@ -222,6 +238,19 @@ int ffio_open_dyn_packet_buf(AVIOContext **s, int max_packet_size);
  */
 struct URLContext *ffio_geturlcontext(AVIOContext *s);
 
+/**
+ * Read size bytes by referencing them in the underlying protocol, if it
+ * supports it, instead of copying them, and advance the read position.
+ * Small reads, which are served more cheaply by the I/O buffer, are
+ * refused.
+ *
+ * @param padding number of bytes following the data that must be readable;
+ *                they are not consumed and may be non-zero
+ * @return size on success, AVERROR(ENOSYS) when the data has to be read
+ *         with avio_read(), another negative AVERROR code on failure
+ */
+int ffio_read_ref(AVIOContext *s, int size, int padding, AVBufferRef **buf);
+
 /**
  * Create and initialize a AVIOContext for accessing the
  * resource referenced by the URLContext h.
@@ -143,6 +143,8 @@ static void writeout(AVIOContext *s, const uint8_t *data, int len)
                                      len,
                                      ctx->current_type,
                                      ctx->last_time);
+        else if (ctx->write_buffer && data == s->buffer)
+            ret = ctx->write_buffer_packet(s->opaque, ctx->write_buffer, len);
         else if (s->write_packet)
             ret = s->write_packet(s->opaque, data, len);
         if (ret < 0) {
@@ -165,6 +167,25 @@ static void writeout(AVIOContext *s, const uint8_t *data, int len)
     s->pos += len;
 }
 
+/**
+ * Switch to a new buffer from the write buffer pool, the protocol may still
+ * be sending the data of the previous one.
+ */
+static void next_write_buffer(AVIOContext *s)
+{
+    FFIOContext *const ctx = ffiocontext(s);
+    AVBufferRef *buf = av_buffer_pool_get(ctx->write_buffer_pool);
+
+    if (!buf) {
+        s->error = AVERROR(ENOMEM);
+        return;
+    }
+    av_buffer_unref(&ctx->write_buffer);
+    ctx->write_buffer = buf;
+    s->buffer = s->checksum_ptr = buf->data;
+    s->buf_end = s->buffer + s->buffer_size;
+}
+
 static void flush_buffer(AVIOContext *s)
 {
     s->buf_ptr_max = FFMAX(s->buf_ptr, s->buf_ptr_max);
@@ -175,6 +196,8 @@ static void flush_buffer(AVIOContext *s)
                                                  s->buf_ptr_max - s->checksum_ptr);
             s->checksum_ptr = s->buffer;
         }
+        if (ffiocontext(s)->write_buffer)
+            next_write_buffer(s);
     }
     s->buf_ptr = s->buf_ptr_max = s->buffer;
     if (!s->write_flag)
@@ -994,7 +1017,8 @@ void ffio_write_lines(AVIOContext *s, const unsigned char *buf, int size,
 int ffio_copy_url_options(AVIOContext* pb, AVDictionary** avio_opts)
 {
     const char *opts[] = {
-        "headers", "user_agent", "cookies", "http_proxy", "referer", "rw_timeout", "icy", NULL };
+        "headers", "user_agent", "cookies", "http_proxy", "referer", "rw_timeout", "icy",
+        "pool_size", "pool_idle_timeout", NULL };
     const char **opt = opts;
     uint8_t *buf = NULL;
     int ret = 0;
@@ -1087,6 +1111,18 @@ int ffio_limit(AVIOContext *s, int size)
     return size;
 }
 
+void ffio_free_buffer(AVIOContext *s)
+{
+    FFIOContext *const ctx = ffiocontext(s);
+
+    if (ctx->write_buffer) {
+        av_buffer_unref(&ctx->write_buffer);
+        av_buffer_pool_uninit(&ctx->write_buffer_pool);
+        s->buffer = NULL;
+    } else
+        av_freep(&s->buffer);
+}
+
 static int set_buf_size(AVIOContext *s, int buf_size)
 {
     uint8_t *buffer;
@@ -1094,7 +1130,7 @@ static int set_buf_size(AVIOContext *s, int buf_size)
     if (!buffer)
         return AVERROR(ENOMEM);
 
-    av_free(s->buffer);
+    ffio_free_buffer(s);
     s->buffer = buffer;
     ffiocontext(s)->orig_buffer_size =
     s->buffer_size = buf_size;
@@ -1121,7 +1157,7 @@ int ffio_realloc_buf(AVIOContext *s, int buf_size)
     data_size = s->write_flag ? (s->buf_ptr - s->buffer) : (s->buf_end - s->buf_ptr);
     if (data_size > 0)
         memcpy(buffer, s->write_flag ? s->buffer : s->buf_ptr, data_size);
-    av_free(s->buffer);
+    ffio_free_buffer(s);
     s->buffer = buffer;
     ffiocontext(s)->orig_buffer_size = buf_size;
     s->buffer_size = buf_size;
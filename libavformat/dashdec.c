@@ -21,6 +21,7 @@
  */
 #include <libxml/parser.h>
 #include <time.h>
+#include "config_components.h"
 #include "libavutil/bprint.h"
 #include "libavutil/mem.h"
 #include "libavutil/opt.h"
@@ -30,6 +31,8 @@
 #include "avio_internal.h"
 #include "dash.h"
 #include "demux.h"
+#include "http.h"
+#include "segprefetch.h"
 #include "url.h"
 
 #define INITIAL_BUFFER_SIZE 32768
@@ -109,6 +112,7 @@ struct representation {
     int64_t cur_seg_offset;
     int64_t cur_seg_size;
     struct fragment *cur_seg;
+    SegPrefetchJob *prefetch_job; /* current fragment, if prefetched */
 
     /* Currently active Media Initialization Section */
     struct fragment *init_section;
@@ -160,6 +164,9 @@ typedef struct DASHContext {
     int is_init_section_common_audio;
     int is_init_section_common_subtitle;
 
+    int prefetch_segments;
+    int64_t prefetch_buffer_size;
+    SegPrefetch *prefetch;
 } DASHContext;
 
 static int ishttp(char *url)
@@ -350,6 +357,10 @@ static void free_timelines_list(struct representation *pls)
 
 static void free_representation(struct representation *pls)
 {
+    DASHContext *c = pls->parent ? pls->parent->priv_data : NULL;
+
+    if (c && c->prefetch)
+        ff_segprefetch_release(c->prefetch, &pls->prefetch_job);
     free_fragment_list(pls);
     free_timelines_list(pls);
     free_fragment(&pls->cur_seg);
@@ -1611,6 +1622,30 @@ finish:
     return ret;
 }
 
+static char *get_template_url(struct representation *pls, int64_t seq_no)
+{
+    DASHContext *c = pls->parent->priv_data;
+    char *tmpfilename, *url;
+
+    if (!pls->url_template) {
+        av_log(pls->parent, AV_LOG_ERROR, "Cannot get fragment, missing template URL\n");
+        return NULL;
+    }
+    tmpfilename = av_mallocz(c->max_url_size);
+    if (!tmpfilename)
+        return NULL;
+    ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, seq_no, 0, get_segment_start_time_based_on_timeline(pls, seq_no));
+    url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
+    if (!url) {
+        av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
+        url = av_strdup(pls->url_template);
+        if (!url)
+            av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
+    }
+    av_free(tmpfilename);
+    return url;
+}
+
 static struct fragment *get_current_fragment(struct representation *pls)
 {
     int64_t min_seq_no = 0;
@@ -1664,30 +1699,11 @@ static struct fragment *get_current_fragment(struct representation *pls)
         }
     }
     if (seg) {
-        char *tmpfilename;
-        if (!pls->url_template) {
-            av_log(pls->parent, AV_LOG_ERROR, "Cannot get fragment, missing template URL\n");
-            av_free(seg);
-            return NULL;
-        }
-        tmpfilename = av_mallocz(c->max_url_size);
-        if (!tmpfilename) {
+        seg->url = get_template_url(pls, pls->cur_seq_no);
+        if (!seg->url) {
             av_free(seg);
             return NULL;
         }
-        ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, pls->cur_seq_no, 0, get_segment_start_time_based_on_timeline(pls, pls->cur_seq_no));
-        seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
-        if (!seg->url) {
-            av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
-            seg->url = av_strdup(pls->url_template);
-            if (!seg->url) {
-                av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
-                av_free(tmpfilename);
-                av_free(seg);
-                return NULL;
-            }
-        }
-        av_free(tmpfilename);
         seg->size = -1;
     }
 
@@ -1703,7 +1719,12 @@ static int read_from_url(struct representation *pls, struct fragment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, pls->cur_seg_size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->prefetch_job) {
+        DASHContext *c = pls->parent->priv_data;
+        ret = ff_segprefetch_read(c->prefetch, pls->prefetch_job, buf, buf_size);
+    } else {
+        ret = avio_read(pls->input, buf, buf_size);
+    }
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1742,6 +1763,121 @@ cleanup:
     return ret;
 }
 
+/* Called from the prefetch worker threads. */
+static int prefetch_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+                         int64_t offset, int64_t size, AVDictionary **opts)
+{
+    AVDictionary *tmp = NULL;
+    int ret;
+
+    av_dict_set(&tmp, "multiple_requests", "1", 0);
+    if (size >= 0) {
+        av_dict_set_int(&tmp, "offset", offset, 0);
+        av_dict_set_int(&tmp, "end_offset", offset + size, 0);
+    }
+
+#if CONFIG_HTTP_PROTOCOL
+    /* reuse the connection of the previous fragment of the worker */
+    if (*pb && av_strstart(url, "http", NULL)) {
+        URLContext *uc = ffio_geturlcontext(*pb);
+        AVDictionary *req = NULL;
+
+        av_dict_copy(&req, *opts, 0);
+        av_dict_copy(&req, tmp, 0);
+        (*pb)->eof_reached = 0;
+        ret = uc ? ff_http_do_new_request2(uc, url, &req) : AVERROR(EINVAL);
+        av_dict_free(&req);
+        if (ret >= 0) {
+            av_dict_free(&tmp);
+            return ret;
+        }
+    }
+#endif
+    ff_format_io_close(s, pb);
+
+    ret = open_url(s, pb, url, opts, tmp, NULL);
+    av_dict_free(&tmp);
+    return ret;
+}
+
+/* Get a fragment of a static MPD by number. */
+static struct fragment *get_vod_fragment(struct representation *pls, int64_t seq_no)
+{
+    struct fragment *seg;
+
+    if (pls->n_fragments ? seq_no >= pls->n_fragments : seq_no > pls->last_seq_no)
+        return NULL;
+
+    seg = av_mallocz(sizeof(*seg));
+    if (!seg)
+        return NULL;
+    if (pls->n_fragments) {
+        seg->url        = av_strdup(pls->fragments[seq_no]->url);
+        seg->url_offset = pls->fragments[seq_no]->url_offset;
+        seg->size       = pls->fragments[seq_no]->size;
+    } else {
+        seg->url  = get_template_url(pls, seq_no);
+        seg->size = -1;
+    }
+    if (!seg->url)
+        av_freep(&seg);
+    return seg;
+}
+
+/*
+ * Queue the fragments following the current one of every representation
+ * being read. Fragments are queued by their distance from the current
+ * fragment, alternating between the representations, so that all of them
+ * progress evenly.
+ */
+static void prefetch_fragments(DASHContext *c)
+{
+    struct representation **reps[] = { c->videos,   c->audios,   c->subtitles   };
+    const int n_reps[]             = { c->n_videos, c->n_audios, c->n_subtitles };
+    char *url = av_malloc(c->max_url_size);
+
+    if (!url)
+        return;
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(reps); i++)
+        for (int j = 0; j < n_reps[i]; j++)
+            if (reps[i][j]->ctx)
+                ff_segprefetch_reprioritize(c->prefetch, reps[i][j], reps[i][j]->cur_seq_no);
+
+    for (int dist = 1; dist <= c->prefetch_segments; dist++) {
+        for (int i = 0; i < FF_ARRAY_ELEMS(reps); i++) {
+            for (int j = 0; j < n_reps[i]; j++) {
+                struct representation *pls = reps[i][j];
+                int64_t seq_no = pls->cur_seq_no + dist;
+                struct fragment *seg;
+                int ret;
+
+                if (!pls->ctx || ff_segprefetch_has(c->prefetch, pls, seq_no))
+                    continue;
+                seg = get_vod_fragment(pls, seq_no);
+                if (!seg)
+                    continue;
+                ff_make_absolute_url(url, c->max_url_size, c->base_url, seg->url);
+                ret = ff_segprefetch_add(c->prefetch, pls, seq_no, dist, url,
+                                         seg->url_offset, seg->size, c->avio_opts);
+                free_fragment(&seg);
+                if (ret < 0)
+                    goto end;
+            }
+        }
+    }
+end:
+    av_free(url);
+}
+
+static void prefetch_reset(DASHContext *c, struct representation *pls)
+{
+    if (!c->prefetch)
+        return;
+    ff_segprefetch_release(c->prefetch, &pls->prefetch_job);
+    ff_segprefetch_flush(c->prefetch, pls);
+}
+
 static int update_init_section(struct representation *pls)
 {
     static const int max_init_section_size = 1024 * 1024;
@@ -1792,6 +1928,10 @@ static int64_t seek_data(void *opaque, int64_t offset, int whence)
 {
     struct representation *v = opaque;
     if (v->n_fragments && !v->init_sec_data_len) {
+        if (v->prefetch_job) {
+            DASHContext *c = v->parent->priv_data;
+            return ff_segprefetch_seek(c->prefetch, v->prefetch_job, offset, whence);
+        }
         return avio_seek(v->input, offset, whence);
     }
 
@@ -1805,7 +1945,7 @@ static int read_data(void *opaque, uint8_t *buf, int buf_size)
     DASHContext *c = v->parent->priv_data;
 
 restart:
-    if (!v->input) {
+    if (!v->input && !v->prefetch_job) {
         free_fragment(&v->cur_seg);
         v->cur_seg = get_current_fragment(v);
         if (!v->cur_seg) {
@@ -1818,16 +1958,25 @@ restart:
         if (ret)
             goto end;
 
-        ret = open_input(c, v, v->cur_seg);
-        if (ret < 0) {
-            if (ff_check_interrupt(c->interrupt_callback)) {
-                ret = AVERROR_EXIT;
-                goto end;
+        if (c->prefetch &&
+            (v->prefetch_job = ff_segprefetch_take(c->prefetch, v, v->cur_seq_no))) {
+            v->cur_seg_offset = 0;
+            v->cur_seg_size   = v->cur_seg->size;
+        } else {
+            ret = open_input(c, v, v->cur_seg);
+            if (ret < 0) {
+                if (ff_check_interrupt(c->interrupt_callback)) {
+                    ret = AVERROR_EXIT;
+                    goto end;
+                }
+                av_log(v->parent, AV_LOG_WARNING, "Failed to open fragment of playlist\n");
+                v->cur_seq_no++;
+                goto restart;
             }
-            av_log(v->parent, AV_LOG_WARNING, "Failed to open fragment of playlist\n");
-            v->cur_seq_no++;
-            goto restart;
         }
+
+        if (c->prefetch)
+            prefetch_fragments(c);
     }
 
     if (v->init_sec_buf_read_offset < v->init_sec_data_len) {
@@ -2058,6 +2207,17 @@ static int dash_read_header(AVFormatContext *s)
     if ((ret = parse_manifest(s, s->url, s->pb)) < 0)
         return ret;
 
+    if (c->prefetch_segments && c->is_live) {
+        av_log(s, AV_LOG_WARNING, "Fragment prefetching is only supported for static MPDs\n");
+    } else if (c->prefetch_segments) {
+        ret = ff_segprefetch_alloc(&c->prefetch, s, prefetch_open,
+                                   c->prefetch_segments, c->prefetch_buffer_size);
+        if (ret == AVERROR(ENOSYS))
+            av_log(s, AV_LOG_WARNING, "Fragment prefetching requires threads, disabled\n");
+        else if (ret < 0)
+            return ret;
+    }
+
     /* If this isn't a live stream, fill the total duration of the
      * stream. */
     if (!c->is_live) {
@@ -2177,6 +2337,7 @@ static void recheck_discard_flags(AVFormatContext *s, struct representation **p,
         } else if (!needed && pls->ctx) {
             close_demux_for_component(pls);
             ff_format_io_close(pls->parent, &pls->input);
+            prefetch_reset(s->priv_data, pls);
             av_log(s, AV_LOG_INFO, "No longer receiving stream_index %d\n", pls->stream_index);
         }
     }
@@ -2239,6 +2400,8 @@ static int dash_read_packet(AVFormatContext *s, AVPacket *pkt)
             cur->init_sec_buf_read_offset = 0;
             cur->is_restart_needed = 0;
             ff_format_io_close(cur->parent, &cur->input);
+            if (c->prefetch)
+                ff_segprefetch_release(c->prefetch, &cur->prefetch_job);
             ret = reopen_demux_for_component(s, cur);
         }
     }
@@ -2251,6 +2414,7 @@ static int dash_close(AVFormatContext *s)
     free_audio_list(c);
     free_video_list(c);
     free_subtitle_list(c);
+    ff_segprefetch_freep(&c->prefetch);
     av_dict_free(&c->avio_opts);
     av_freep(&c->base_url);
     return 0;
@@ -2277,6 +2441,7 @@ static int dash_seek(AVFormatContext *s, struct representation *pls, int64_t see
     }
 
     ff_format_io_close(pls->parent, &pls->input);
+    prefetch_reset(s->priv_data, pls);
 
     // find the nearest fragment
     if (pls->n_timelines > 0 && pls->fragment_timescale > 0) {
@@ -2375,6 +2540,10 @@ static const AVOption dash_options[] = {
         {.str = "aac,m4a,m4s,m4v,mov,mp4,webm,ts"},
         INT_MIN, INT_MAX, FLAGS},
     { "cenc_decryption_key", "Media decryption key (hex)", OFFSET(cenc_decryption_key), AV_OPT_TYPE_STRING, {.str = NULL}, INT_MIN, INT_MAX, .flags = FLAGS },
+    {"prefetch_segments", "Number of fragments to download ahead per representation, in parallel",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_buffer_size", "Maximum size of prefetched fragment data held in memory",
+        OFFSET(prefetch_buffer_size), AV_OPT_TYPE_INT64, {.i64 = 64 << 20}, 0, INT64_MAX, FLAGS},
     {NULL}
 };
 
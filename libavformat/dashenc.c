@@ -51,6 +51,7 @@
 #include "internal.h"
 #include "mux.h"
 #include "os_support.h"
+#include "uploadqueue.h"
 #include "url.h"
 #include "dash.h"
 
@@ -200,14 +201,20 @@ typedef struct DASHContext {
     AVRational min_playback_rate;
     AVRational max_playback_rate;
     int64_t update_period;
+    int upload_workers;
+    int upload_retries;
+    int64_t upload_buffer_size;
+    UploadQueue *upload;
 } DASHContext;
 
 static int dashenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
-                           AVDictionary **options) {
+                           AVDictionary **options, int upload_flags) {
     DASHContext *c = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
     int err = AVERROR_MUXER_NOT_FOUND;
-    if (!*pb || !http_base_proto || !c->http_persistent) {
+    if (c->upload && http_base_proto) {
+        err = ff_uploadqueue_open(c->upload, pb, filename, options, upload_flags);
+    } else if (!*pb || !http_base_proto || !c->http_persistent) {
         err = s->io_open(s, pb, filename, AVIO_FLAG_WRITE, options);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -228,7 +235,9 @@ static void dashenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filenam
     if (!*pb)
         return;
 
-    if (!http_base_proto || !c->http_persistent) {
+    if (c->upload && ff_uploadqueue_is_open(c->upload, *pb)) {
+        ff_uploadqueue_close(c->upload, pb);
+    } else if (!http_base_proto || !c->http_persistent) {
         ff_format_io_close(s, pb);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -398,7 +407,7 @@ static void write_hls_media_playlist(OutputStream *os, AVFormatContext *s,
     snprintf(temp_filename_hls, sizeof(temp_filename_hls), use_rename ? "%s.tmp" : "%s", filename_hls);
 
     set_http_options(&http_opts, c);
-    ret = dashenc_io_open(s, &c->m3u8_out, temp_filename_hls, &http_opts);
+    ret = dashenc_io_open(s, &c->m3u8_out, temp_filename_hls, &http_opts, FF_UPLOAD_ORDERED);
     av_dict_free(&http_opts);
     if (ret < 0) {
         handle_io_open_error(s, ret, temp_filename_hls);
@@ -473,6 +482,8 @@ static void dash_free(AVFormatContext *s)
     DASHContext *c = s->priv_data;
     int i, j;
 
+    ff_uploadqueue_freep(&c->upload);
+
     if (c->as) {
         for (i = 0; i < c->nb_as; i++) {
             av_dict_free(&c->as[i].metadata);
@@ -1016,7 +1027,7 @@ static int write_manifest(AVFormatContext *s, int final)
 
     snprintf(temp_filename, sizeof(temp_filename), use_rename ? "%s.tmp" : "%s", s->url);
     set_http_options(&opts, c);
-    ret = dashenc_io_open(s, &c->mpd_out, temp_filename, &opts);
+    ret = dashenc_io_open(s, &c->mpd_out, temp_filename, &opts, FF_UPLOAD_ORDERED);
     av_dict_free(&opts);
     if (ret < 0) {
         return handle_io_open_error(s, ret, temp_filename);
@@ -1131,7 +1142,7 @@ static int write_manifest(AVFormatContext *s, int final)
         snprintf(temp_filename, sizeof(temp_filename), use_rename ? "%s.tmp" : "%s", filename_hls);
 
         set_http_options(&opts, c);
-        ret = dashenc_io_open(s, &c->m3u8_out, temp_filename, &opts);
+        ret = dashenc_io_open(s, &c->m3u8_out, temp_filename, &opts, FF_UPLOAD_ORDERED);
         av_dict_free(&opts);
         if (ret < 0) {
             return handle_io_open_error(s, ret, temp_filename);
@@ -1596,6 +1607,17 @@ static int dash_init(AVFormatContext *s)
     c->nr_of_streams_flushed = 0;
     c->target_latency_refid = -1;
 
+    if (c->upload_workers && c->streaming) {
+        av_log(s, AV_LOG_WARNING, "Asynchronous uploads are not supported in streaming mode\n");
+    } else if (c->upload_workers && ff_is_http_proto(s->url)) {
+        ret = ff_uploadqueue_alloc(&c->upload, s, c->upload_workers, c->upload_retries,
+                                   c->upload_buffer_size, c->http_persistent);
+        if (ret == AVERROR(ENOSYS))
+            av_log(s, AV_LOG_WARNING, "Asynchronous uploads require threads, disabled\n");
+        else if (ret < 0)
+            return ret;
+    }
+
     return 0;
 }
 
@@ -1729,7 +1751,7 @@ static void dashenc_delete_file(AVFormatContext *s, char *filename) {
         set_http_options(&http_opts, c);
         av_dict_set(&http_opts, "method", "DELETE", 0);
 
-        if (dashenc_io_open(s, &c->http_delete, filename, &http_opts) < 0) {
+        if (dashenc_io_open(s, &c->http_delete, filename, &http_opts, FF_UPLOAD_ORDERED) < 0) {
             av_log(s, AV_LOG_ERROR, "failed to delete %s\n", filename);
         }
         av_dict_free(&http_opts);
@@ -2129,7 +2151,7 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
         snprintf(os->temp_path, sizeof(os->temp_path),
                  use_rename ? "%s.tmp" : "%s", os->full_path);
         set_http_options(&opts, c);
-        ret = dashenc_io_open(s, &os->out, os->temp_path, &opts);
+        ret = dashenc_io_open(s, &os->out, os->temp_path, &opts, 0);
         av_dict_free(&opts);
         if (ret < 0) {
             return handle_io_open_error(s, ret, os->temp_path);
@@ -2203,6 +2225,12 @@ static int dash_write_trailer(AVFormatContext *s)
         }
     }
 
+    if (c->upload) {
+        int ret = ff_uploadqueue_flush(c->upload);
+        if (ret < 0 && !c->ignore_io_errors)
+            return ret;
+    }
+
     return 0;
 }
 
@@ -2270,6 +2298,9 @@ static const AVOption options[] = {
     { "target_latency", "Set desired target latency for Low-latency dash", OFFSET(target_latency), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT_MAX, E },
     { "timeout", "set timeout for socket I/O operations", OFFSET(timeout), AV_OPT_TYPE_DURATION, { .i64 = -1 }, -1, INT_MAX, .flags = E },
     { "update_period", "Set the mpd update interval", OFFSET(update_period), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E},
+    { "upload_buffer_size", "maximum size of files queued for upload", OFFSET(upload_buffer_size), AV_OPT_TYPE_INT64, { .i64 = 64 << 20 }, 0, INT64_MAX, E },
+    { "upload_retries", "number of times a failed upload is retried", OFFSET(upload_retries), AV_OPT_TYPE_INT, { .i64 = 2 }, 0, INT_MAX, E },
+    { "upload_workers", "number of concurrent asynchronous HTTP uploads, 0 to upload synchronously", OFFSET(upload_workers), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 64, E },
     { "use_template", "Use SegmentTemplate instead of SegmentList", OFFSET(use_template), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, E },
     { "use_timeline", "Use SegmentTimeline in SegmentTemplate", OFFSET(use_timeline), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, E },
     { "utc_timing_url", "URL of the page that will return the UTC timestamp in ISO format", OFFSET(utc_timing_url), AV_OPT_TYPE_STRING, { 0 }, 0, 0, E },
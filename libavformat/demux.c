@@ -354,6 +354,8 @@ int avformat_open_input(AVFormatContext **ps, const char *filename,
 
     update_stream_avctx(s);
 
+    ff_index_cache_open(s);
+
     if (options) {
         av_dict_free(options);
         *options = tmp;
@@ -389,6 +391,8 @@ void avformat_close_input(AVFormatContext **ps)
         (s->flags & AVFMT_FLAG_CUSTOM_IO))
         pb = NULL;
 
+    ff_index_cache_close(s);
+
     if (s->iformat)
         if (ffifmt(s->iformat)->read_close)
             ffifmt(s->iformat)->read_close(s);
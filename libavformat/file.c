@@ -26,6 +26,7 @@
 #include "libavutil/internal.h"
 #include "libavutil/mem.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
 #include "avio.h"
 #if HAVE_DIRENT_H
 #include <dirent.h>
@@ -39,6 +40,9 @@
 #endif
 #include <sys/stat.h>
 #include <stdlib.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "os_support.h"
 #include "url.h"
 
@@ -87,8 +91,27 @@
 #  endif
 #endif
 
+#define READAHEAD (CONFIG_FILE_PROTOCOL && HAVE_THREADS && HAVE_PREAD)
+#define MMAP      (CONFIG_FILE_PROTOCOL && HAVE_MMAP)
+
 /* standard file protocol */
 
+#if READAHEAD
+enum ReadAheadState {
+    BLOCK_FREE,
+    BLOCK_PENDING,
+    BLOCK_READING,
+    BLOCK_DONE,
+};
+
+typedef struct ReadAheadBlock {
+    uint8_t *data;
+    int64_t  pos;               ///< file offset of data
+    int      size;              ///< bytes read or a negative AVERROR code
+    enum ReadAheadState state;
+} ReadAheadBlock;
+#endif
+
 typedef struct FileContext {
     const AVClass *class;
     int fd;
@@ -97,9 +120,37 @@ typedef struct FileContext {
     int pkt_size;
     int follow;
     int seekable;
+    int readahead;
+    int readahead_size;
+    int mmap;
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
+#if READAHEAD
+    /**
+     * Blocks of readahead_size bytes read by worker threads with pread().
+     * Block n of the file can only be cached in blocks[n % nb_blocks], so
+     * data read before a short seek stays available until it is evicted.
+     */
+    ReadAheadBlock *blocks;
+    int nb_blocks;
+    pthread_t *threads;
+    int nb_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_reader;
+    pthread_cond_t cond_worker;
+    int abort_request;
+    int64_t pos;                ///< logical read position
+    int64_t file_size;
+#endif
+#if MMAP
+    /**
+     * The whole file mapped read-only, referenced by the packets returned by
+     * file_get_buffer() so that it stays valid after the file is closed.
+     */
+    AVBufferRef *mapping;
+    int64_t map_pos;
+#endif
 } FileContext;
 
 static const AVOption file_options[] = {
@@ -108,6 +159,13 @@ static const AVOption file_options[] = {
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { "seekable", "Sets if the file is seekable", offsetof(FileContext, seekable), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 0, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
     { "pkt_size", "Maximum packet size", offsetof(FileContext, pkt_size), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
+#if READAHEAD
+    { "readahead", "Number of reads to keep in flight ahead of the read position", offsetof(FileContext, readahead), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 64, AV_OPT_FLAG_DECODING_PARAM },
+    { "readahead_size", "Size of each read-ahead request", offsetof(FileContext, readahead_size), AV_OPT_TYPE_INT, { .i64 = 1 << 20 }, 4096, 1 << 28, AV_OPT_FLAG_DECODING_PARAM },
+#endif
+#if MMAP
+    { "mmap", "Map the file into memory and let packets reference it", offsetof(FileContext, mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+#endif
     { NULL }
 };
 
@@ -138,10 +196,361 @@ static const AVClass fd_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+#if READAHEAD
+static void *readahead_worker(void *arg)
+{
+    FileContext *c = arg;
+
+    pthread_mutex_lock(&c->mutex);
+    while (!c->abort_request) {
+        ReadAheadBlock *b = NULL;
+        uint8_t *data;
+        int64_t pos;
+        ssize_t ret;
+
+        /* blocks outside the window are never pending, so the one with the
+         * lowest offset is the one the reader will need first */
+        for (int i = 0; i < c->nb_blocks; i++) {
+            ReadAheadBlock *cur = &c->blocks[i];
+            if (cur->state == BLOCK_PENDING && (!b || cur->pos < b->pos))
+                b = cur;
+        }
+        if (!b) {
+            pthread_cond_wait(&c->cond_worker, &c->mutex);
+            continue;
+        }
+
+        b->state = BLOCK_READING;
+        data     = b->data;
+        pos      = b->pos;
+        pthread_mutex_unlock(&c->mutex);
+
+        do {
+            ret = pread(c->fd, data, c->readahead_size, pos);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0)
+            ret = AVERROR(errno);
+
+        pthread_mutex_lock(&c->mutex);
+        b->size  = ret;
+        b->state = BLOCK_DONE;
+        pthread_cond_signal(&c->cond_reader);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return NULL;
+}
+
+/* Request the blocks from the read position onwards. Must be called with
+ * the mutex locked. */
+static void readahead_schedule(FileContext *c)
+{
+    const int64_t first = c->pos / c->readahead_size;
+    const int64_t last  = FFMIN(first + c->readahead,
+                                (c->file_size + c->readahead_size - 1) / c->readahead_size);
+    int wake = 0;
+
+    /* drop requests left behind by a seek */
+    for (int i = 0; i < c->nb_blocks; i++) {
+        ReadAheadBlock *b = &c->blocks[i];
+        const int64_t n   = b->pos / c->readahead_size;
+        if (b->state == BLOCK_PENDING && (n < first || n >= last))
+            b->state = BLOCK_FREE;
+    }
+
+    for (int64_t n = first; n < last; n++) {
+        ReadAheadBlock *b = &c->blocks[n % c->nb_blocks];
+
+        if (b->state == BLOCK_READING ||
+            (b->state != BLOCK_FREE && b->pos == n * c->readahead_size))
+            continue;
+
+        b->pos   = n * c->readahead_size;
+        b->state = BLOCK_PENDING;
+        wake     = 1;
+    }
+
+    if (wake)
+        pthread_cond_broadcast(&c->cond_worker);
+}
+
+static int readahead_read(URLContext *h, unsigned char *buf, int size)
+{
+    FileContext *c    = h->priv_data;
+    const int64_t n   = c->pos / c->readahead_size;
+    ReadAheadBlock *b = &c->blocks[n % c->nb_blocks];
+    int offset, ret;
+
+    if (c->pos >= c->file_size) {
+        struct stat st;
+
+        /* the file may have grown since it was opened */
+        if (fstat(c->fd, &st) < 0)
+            return AVERROR(errno);
+        if (c->pos >= st.st_size)
+            return AVERROR_EOF;
+        c->file_size = st.st_size;
+    }
+
+    pthread_mutex_lock(&c->mutex);
+    while (1) {
+        readahead_schedule(c);
+        if (b->state == BLOCK_DONE && b->pos == n * c->readahead_size)
+            break;
+        pthread_cond_wait(&c->cond_reader, &c->mutex);
+    }
+
+    offset = c->pos - b->pos;
+    if (b->size < 0) {
+        /* the block is requested again on the next call */
+        ret      = b->size;
+        b->state = BLOCK_FREE;
+        pthread_mutex_unlock(&c->mutex);
+        return ret;
+    }
+    if (b->size <= offset) {
+        /* The block ended before the read position although the file is
+         * larger, e.g. because it was still being written. Read directly
+         * and let the block be requested again on the next call. */
+        b->state = BLOCK_FREE;
+        pthread_mutex_unlock(&c->mutex);
+
+        do {
+            ret = pread(c->fd, buf, size, c->pos);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0)
+            return AVERROR(errno);
+        if (!ret)
+            return AVERROR_EOF;
+        c->pos += ret;
+        return ret;
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    /* done blocks are only modified by the reader */
+    ret = FFMIN(size, b->size - offset);
+    memcpy(buf, b->data + offset, ret);
+    c->pos += ret;
+
+    return ret;
+}
+
+static int64_t readahead_seek(URLContext *h, int64_t pos, int whence)
+{
+    FileContext *c = h->priv_data;
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        pos += c->pos;
+        break;
+    case SEEK_END: {
+        struct stat st;
+        if (fstat(c->fd, &st) < 0)
+            return AVERROR(errno);
+        c->file_size = st.st_size;
+        pos += c->file_size;
+        break;
+    }
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    /* requests for the old position are dropped on the next read */
+    c->pos = pos;
+    return pos;
+}
+
+static void readahead_close(FileContext *c)
+{
+    pthread_mutex_lock(&c->mutex);
+    c->abort_request = 1;
+    pthread_cond_broadcast(&c->cond_worker);
+    pthread_mutex_unlock(&c->mutex);
+
+    for (int i = 0; i < c->nb_threads; i++)
+        pthread_join(c->threads[i], NULL);
+    av_freep(&c->threads);
+
+    pthread_cond_destroy(&c->cond_worker);
+    pthread_cond_destroy(&c->cond_reader);
+    pthread_mutex_destroy(&c->mutex);
+
+    for (int i = 0; i < c->nb_blocks; i++)
+        av_freep(&c->blocks[i].data);
+    av_freep(&c->blocks);
+}
+
+static int readahead_init(URLContext *h, const struct stat *st)
+{
+    FileContext *c = h->priv_data;
+    int ret;
+
+    c->file_size = st->st_size;
+    c->pos       = lseek(c->fd, 0, SEEK_CUR);
+    if (c->pos < 0)
+        return AVERROR(errno);
+
+    /* keep as many already read blocks as there are requests in flight,
+     * which covers the short backward seeks of interleaved demuxing */
+    c->nb_blocks = 2 * c->readahead;
+    c->blocks    = av_calloc(c->nb_blocks, sizeof(*c->blocks));
+    c->threads   = av_calloc(c->readahead, sizeof(*c->threads));
+    if (!c->blocks || !c->threads) {
+        av_freep(&c->blocks);
+        av_freep(&c->threads);
+        return AVERROR(ENOMEM);
+    }
+
+    for (int i = 0; i < c->nb_blocks; i++) {
+        c->blocks[i].data = av_malloc(c->readahead_size);
+        if (!c->blocks[i].data) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+    }
+
+    if ((ret = pthread_mutex_init(&c->mutex, NULL))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_cond_init(&c->cond_reader, NULL))) {
+        pthread_mutex_destroy(&c->mutex);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_cond_init(&c->cond_worker, NULL))) {
+        pthread_cond_destroy(&c->cond_reader);
+        pthread_mutex_destroy(&c->mutex);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    for (; c->nb_threads < c->readahead; c->nb_threads++) {
+        ret = pthread_create(&c->threads[c->nb_threads], NULL, readahead_worker, c);
+        if (ret) {
+            readahead_close(c);
+            return AVERROR(ret);
+        }
+    }
+
+    return 0;
+fail:
+    for (int i = 0; i < c->nb_blocks; i++)
+        av_freep(&c->blocks[i].data);
+    av_freep(&c->blocks);
+    av_freep(&c->threads);
+    return ret;
+}
+#endif
+
+#if MMAP
+static void unmap_file(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static int mmap_init(URLContext *h, const struct stat *st)
+{
+    FileContext *c = h->priv_data;
+    void *ptr;
+
+    if (st->st_size <= 0 || st->st_size > SIZE_MAX)
+        return AVERROR(EINVAL);
+
+    ptr = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, c->fd, 0);
+    if (ptr == MAP_FAILED)
+        return AVERROR(errno);
+
+    c->mapping = av_buffer_create(ptr, st->st_size, unmap_file,
+                                  (void *)(uintptr_t)st->st_size,
+                                  AV_BUFFER_FLAG_READONLY);
+    if (!c->mapping) {
+        munmap(ptr, st->st_size);
+        return AVERROR(ENOMEM);
+    }
+
+    c->map_pos = lseek(c->fd, 0, SEEK_CUR);
+    if (c->map_pos < 0)
+        c->map_pos = 0;
+
+    return 0;
+}
+
+static int mmap_read(URLContext *h, unsigned char *buf, int size)
+{
+    FileContext *c = h->priv_data;
+    const size_t map_size = c->mapping->size;
+
+    if (c->map_pos >= map_size)
+        return AVERROR_EOF;
+
+    size = FFMIN(size, map_size - c->map_pos);
+    memcpy(buf, c->mapping->data + c->map_pos, size);
+    c->map_pos += size;
+
+    return size;
+}
+
+static int64_t mmap_seek(URLContext *h, int64_t pos, int whence)
+{
+    FileContext *c = h->priv_data;
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        pos += c->map_pos;
+        break;
+    case SEEK_END:
+        pos += c->mapping->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    c->map_pos = pos;
+    return pos;
+}
+
+static int file_get_buffer(URLContext *h, int64_t pos, int size, AVBufferRef **buf)
+{
+    FileContext *c = h->priv_data;
+
+    if (!c->mapping || pos < 0 || pos > c->mapping->size ||
+        size > c->mapping->size - pos)
+        return AVERROR(ENOSYS);
+
+    *buf = av_buffer_ref(c->mapping);
+    if (!*buf)
+        return AVERROR(ENOMEM);
+
+    (*buf)->data += pos;
+    (*buf)->size  = size;
+
+    return size;
+}
+#endif
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
+#if MMAP
+    if (c->mapping)
+        return mmap_read(h, buf, size);
+#endif
+#if READAHEAD
+    if (c->blocks)
+        return readahead_read(h, buf, size);
+#endif
     size = FFMIN(size, c->blocksize);
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
@@ -223,7 +632,15 @@ static int fd_dup(URLContext *h, int oldfd)
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
-    int ret = close(c->fd);
+    int ret;
+#if READAHEAD
+    if (c->blocks)
+        readahead_close(c);
+#endif
+#if MMAP
+    av_buffer_unref(&c->mapping);
+#endif
+    ret = close(c->fd);
     return (ret == -1) ? AVERROR(errno) : 0;
 }
 
@@ -239,6 +656,15 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
         return ret < 0 ? AVERROR(errno) : (S_ISFIFO(st.st_mode) ? 0 : st.st_size);
     }
 
+#if MMAP
+    if (c->mapping)
+        return mmap_seek(h, pos, whence);
+#endif
+#if READAHEAD
+    if (c->blocks)
+        return readahead_seek(h, pos, whence);
+#endif
+
     ret = lseek(c->fd, pos, whence);
 
     return ret < 0 ? AVERROR(errno) : ret;
@@ -328,6 +754,28 @@ static int file_open(URLContext *h, const char *filename, int flags)
     if (c->seekable >= 0)
         h->is_streamed = !c->seekable;
 
+#if MMAP
+    if (c->mmap && !(flags & AVIO_FLAG_WRITE) && !c->follow &&
+        !fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        int ret = mmap_init(h, &st);
+        if (ret < 0)
+            av_log(h, AV_LOG_WARNING, "Could not map the file, reading it normally: %s\n",
+                   av_err2str(ret));
+        else
+            return 0;
+    }
+#endif
+#if READAHEAD
+    if (c->readahead && !(flags & AVIO_FLAG_WRITE) && !c->follow &&
+        !fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        int ret = readahead_init(h, &st);
+        if (ret < 0) {
+            close(fd);
+            return ret;
+        }
+    }
+#endif
+
     return 0;
 }
 
@@ -423,6 +871,9 @@ const URLProtocol ff_file_protocol = {
     .url_seek            = file_seek,
     .url_close           = file_close,
     .url_get_file_handle = file_get_handle,
+#if MMAP
+    .url_get_buffer      = file_get_buffer,
+#endif
     .url_check           = file_check,
     .url_delete          = file_delete,
     .url_move            = file_move,
@@ -44,6 +44,7 @@
 #include "internal.h"
 #include "avio_internal.h"
 #include "id3v2.h"
+#include "segprefetch.h"
 #include "url.h"
 
 #include "hls_sample_encryption.h"
@@ -107,6 +108,7 @@ struct playlist {
     int input_read_done;
     AVIOContext *input_next;
     int input_next_requested;
+    SegPrefetchJob *prefetch_job; /* current segment, if prefetched */
     AVFormatContext *parent;
     int index;
     AVFormatContext *ctx;
@@ -230,7 +232,11 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     int http_seekable;
+    int http_pipeline;
     int seg_max_retry;
+    int prefetch_segments;
+    int64_t prefetch_buffer_size;
+    SegPrefetch *prefetch;
     AVIOContext *playlist_pb;
     HLSCryptoContext  crypto_ctx;
 } HLSContext;
@@ -283,6 +289,8 @@ static void free_playlist_list(HLSContext *c)
         pls->input_read_done = 0;
         ff_format_io_close(c->ctx, &pls->input_next);
         pls->input_next_requested = 0;
+        if (c->prefetch)
+            ff_segprefetch_release(c->prefetch, &pls->prefetch_job);
         if (pls->ctx) {
             pls->ctx->pb = NULL;
             avformat_close_input(&pls->ctx);
@@ -1139,7 +1147,12 @@ static int read_from_url(struct playlist *pls, struct segment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, seg->size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->prefetch_job) {
+        HLSContext *c = pls->parent->priv_data;
+        ret = ff_segprefetch_read(c->prefetch, pls->prefetch_job, buf, buf_size);
+    } else {
+        ret = avio_read(pls->input, buf, buf_size);
+    }
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1451,6 +1464,101 @@ cleanup:
     return ret;
 }
 
+/* Request seg on the connection of the segment being read. */
+static void pipeline_segment(struct playlist *pls, struct segment *seg)
+{
+#if CONFIG_HTTP_PROTOCOL
+    URLContext *uc = ffio_geturlcontext(pls->input);
+    int ret;
+
+    if (!uc)
+        return;
+    ret = ff_http_pipeline_request(uc, seg->url,
+                                   seg->size >= 0 ? seg->url_offset : 0,
+                                   seg->size >= 0 ? seg->url_offset + seg->size : 0);
+    if (ret < 0)
+        av_log(pls->parent, AV_LOG_DEBUG, "Cannot pipeline request for '%s': %s\n",
+               seg->url, av_err2str(ret));
+#endif
+}
+
+/* Called from the prefetch worker threads. */
+static int prefetch_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+                         int64_t offset, int64_t size, AVDictionary **opts)
+{
+    HLSContext *c = s->priv_data;
+    AVDictionary *tmp = NULL;
+    int is_http = 0;
+    int ret;
+
+    /* open_url() reuses the previous connection of the worker for HTTP */
+    if (*pb && (!c->http_persistent || !av_strstart(url, "http", NULL)))
+        ff_format_io_close(s, pb);
+
+    if (c->http_persistent)
+        av_dict_set(&tmp, "multiple_requests", "1", 0);
+    if (size >= 0) {
+        av_dict_set_int(&tmp, "offset", offset, 0);
+        av_dict_set_int(&tmp, "end_offset", offset + size, 0);
+    }
+    ret = open_url(s, pb, url, opts, tmp, &is_http);
+    av_dict_free(&tmp);
+
+    /* see open_input() */
+    if (ret >= 0 && !is_http && offset) {
+        int64_t seekret = avio_seek(*pb, offset, SEEK_SET);
+        if (seekret < 0) {
+            ff_format_io_close(s, pb);
+            ret = seekret;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Queue the segments following the current one of every playlist being
+ * read. Segments are queued by their distance from the current segment,
+ * alternating between the playlists, so that the variant and renditions
+ * being played progress evenly.
+ */
+static void prefetch_segments(HLSContext *c)
+{
+    for (int i = 0; i < c->n_playlists; i++) {
+        struct playlist *pls = c->playlists[i];
+        if (pls->needed && !pls->is_subtitle)
+            ff_segprefetch_reprioritize(c->prefetch, pls, pls->cur_seq_no);
+    }
+
+    for (int dist = 1; dist <= c->prefetch_segments; dist++) {
+        for (int i = 0; i < c->n_playlists; i++) {
+            struct playlist *pls = c->playlists[i];
+            int64_t seq_no = pls->cur_seq_no + dist;
+            int64_t n = seq_no - pls->start_seq_no;
+            struct segment *seg;
+
+            if (!pls->needed || pls->is_subtitle || pls->broken ||
+                n < 0 || n >= pls->n_segments)
+                continue;
+            seg = pls->segments[n];
+            /* Keys are loaded by the demuxer when the segment is opened. */
+            if (seg->key_type != KEY_NONE ||
+                ff_segprefetch_has(c->prefetch, pls, seq_no))
+                continue;
+            if (ff_segprefetch_add(c->prefetch, pls, seq_no, dist, seg->url,
+                                   seg->url_offset, seg->size, c->avio_opts) < 0)
+                return;
+        }
+    }
+}
+
+static void prefetch_reset(HLSContext *c, struct playlist *pls)
+{
+    if (!c->prefetch)
+        return;
+    ff_segprefetch_release(c->prefetch, &pls->prefetch_job);
+    ff_segprefetch_flush(c->prefetch, pls);
+}
+
 static int update_init_section(struct playlist *pls, struct segment *seg)
 {
     static const int max_init_section_size = 1024*1024;
@@ -1571,7 +1679,7 @@ static int reload_playlist(struct playlist *v, HLSContext *c)
     if (!v->needed)
         return AVERROR_EOF;
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input && !v->prefetch_job) || (c->http_persistent && v->input_read_done)) {
         int64_t reload_interval;
 
         /* Check that the playlist is still needed before opening a new
@@ -1662,13 +1770,20 @@ restart:
 
     seg = current_segment(v);
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input && !v->prefetch_job) || (c->http_persistent && v->input_read_done)) {
         /* load/update Media Initialization Section, if any */
         ret = update_init_section(v, seg);
         if (ret)
             return ret;
 
-        if (c->http_multiple == 1 && v->input_next_requested) {
+        if (c->prefetch &&
+            (v->prefetch_job = ff_segprefetch_take(c->prefetch, v, v->cur_seq_no))) {
+            /* drop a kept-alive connection, it would be read from otherwise */
+            ff_format_io_close(v->parent, &v->input);
+            v->input_read_done = 0;
+            v->cur_seg_offset = 0;
+            ret = 0;
+        } else if (c->http_multiple == 1 && v->input_next_requested) {
             FFSWAP(AVIOContext *, v->input, v->input_next);
             v->cur_seg_offset = 0;
             v->input_next_requested = 0;
@@ -1695,9 +1810,12 @@ restart:
         }
         segment_retries = 0;
         just_opened = 1;
+
+        if (c->prefetch)
+            prefetch_segments(c);
     }
 
-    if (c->http_multiple == -1) {
+    if (c->http_multiple == -1 && v->input) {
         uint8_t *http_version_opt = NULL;
         int r = av_opt_get(v->input, "http_version", AV_OPT_SEARCH_CHILDREN, &http_version_opt);
         if (r >= 0) {
@@ -1707,7 +1825,11 @@ restart:
     }
 
     seg = next_segment(v);
-    if (c->http_multiple == 1 && !v->input_next_requested &&
+    if (just_opened && c->http_pipeline && c->http_persistent && v->input &&
+        seg && seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL))
+        pipeline_segment(v, seg);
+
+    if (c->http_multiple == 1 && !c->prefetch && !c->http_pipeline && !v->input_next_requested &&
         seg && seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         ret = open_input(c, v, seg, &v->input_next);
         if (ret < 0) {
@@ -1740,7 +1862,9 @@ restart:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (v->prefetch_job) {
+        ff_segprefetch_release(c->prefetch, &v->prefetch_job);
+    } else if (c->http_persistent &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
@@ -2121,6 +2245,7 @@ static int hls_close(AVFormatContext *s)
     free_playlist_list(c);
     free_variant_list(c);
     free_rendition_list(c);
+    ff_segprefetch_freep(&c->prefetch);
 
     if (c->crypto_ctx.aes_ctx)
         av_free(c->crypto_ctx.aes_ctx);
@@ -2155,6 +2280,15 @@ static int hls_read_header(AVFormatContext *s)
     if ((ret = parse_playlist(c, s->url, NULL, s->pb)) < 0)
         return ret;
 
+    if (c->prefetch_segments) {
+        ret = ff_segprefetch_alloc(&c->prefetch, s, prefetch_open,
+                                   c->prefetch_segments, c->prefetch_buffer_size);
+        if (ret == AVERROR(ENOSYS))
+            av_log(s, AV_LOG_WARNING, "Segment prefetching requires threads, disabled\n");
+        else if (ret < 0)
+            return ret;
+    }
+
     if (c->n_variants == 0) {
         av_log(s, AV_LOG_WARNING, "Empty playlist\n");
         return AVERROR_EOF;
@@ -2464,6 +2598,7 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             pls->input_read_done = 0;
             ff_format_io_close(pls->parent, &pls->input_next);
             pls->input_next_requested = 0;
+            prefetch_reset(c, pls);
             if (pls->is_subtitle)
                 avformat_close_input(&pls->ctx);
             pls->needed = 0;
@@ -2725,6 +2860,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
         pls->input_read_done = 0;
         ff_format_io_close(pls->parent, &pls->input_next);
         pls->input_next_requested = 0;
+        prefetch_reset(c, pls);
         av_packet_unref(pls->pkt);
         pb->eof_reached = 0;
         /* Clear any buffered data */
@@ -2831,10 +2967,16 @@ static const AVOption hls_options[] = {
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
     {"http_seekable", "Use HTTP partial requests, 0 = disable, 1 = enable, -1 = auto",
         OFFSET(http_seekable), AV_OPT_TYPE_BOOL, { .i64 = -1}, -1, 1, FLAGS},
+    {"http_pipeline", "Request the next segment on the persistent HTTP connection ahead of time",
+        OFFSET(http_pipeline), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
     {"seg_format_options", "Set options for segment demuxer",
         OFFSET(seg_format_opts), AV_OPT_TYPE_DICT, {.str = NULL}, 0, 0, FLAGS},
     {"seg_max_retry", "Maximum number of times to reload a segment on error.",
      OFFSET(seg_max_retry), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
+    {"prefetch_segments", "Number of segments to download ahead per playlist, in parallel",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_buffer_size", "Maximum size of prefetched segment data held in memory",
+        OFFSET(prefetch_buffer_size), AV_OPT_TYPE_INT64, {.i64 = 64 << 20}, 0, INT64_MAX, FLAGS},
     {NULL}
 };
 
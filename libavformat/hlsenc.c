@@ -51,6 +51,7 @@
 #include "internal.h"
 #include "mux.h"
 #include "os_support.h"
+#include "uploadqueue.h"
 #include "url.h"
 
 typedef enum {
@@ -261,6 +262,10 @@ typedef struct HLSContext {
     char *headers;
     int has_default_key; /* has DEFAULT field of var_stream_map */
     int has_video_m3u8; /* has video stream m3u8 list */
+    int upload_workers;
+    int upload_retries;
+    int64_t upload_buffer_size;
+    UploadQueue *upload;
 } HLSContext;
 
 static int strftime_expand(const char *fmt, char **dest)
@@ -287,12 +292,14 @@ static int strftime_expand(const char *fmt, char **dest)
 }
 
 static int hlsenc_io_open(AVFormatContext *s, AVIOContext **pb, const char *filename,
-                          AVDictionary **options)
+                          AVDictionary **options, int upload_flags)
 {
     HLSContext *hls = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
     int err = AVERROR_MUXER_NOT_FOUND;
-    if (!*pb || !http_base_proto || !hls->http_persistent) {
+    if (hls->upload && http_base_proto) {
+        err = ff_uploadqueue_open(hls->upload, pb, filename, options, upload_flags);
+    } else if (!*pb || !http_base_proto || !hls->http_persistent) {
         err = s->io_open(s, pb, filename, AVIO_FLAG_WRITE, options);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -314,7 +321,9 @@ static int hlsenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filename)
     int ret = 0;
     if (!*pb)
         return ret;
-    if (!http_base_proto || !hls->http_persistent || hls->key_info_file || hls->encrypt) {
+    if (hls->upload && ff_uploadqueue_is_open(hls->upload, *pb)) {
+        ret = ff_uploadqueue_close(hls->upload, pb);
+    } else if (!http_base_proto || !hls->http_persistent || hls->key_info_file || hls->encrypt) {
         ff_format_io_close(s, pb);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -511,7 +520,7 @@ static int hls_delete_file(HLSContext *hls, AVFormatContext *avf,
         set_http_options(avf, &opt, hls);
         av_dict_set(&opt, "method", "DELETE", 0);
 
-        ret = hlsenc_io_open(avf, &hls->http_delete, path, &opt);
+        ret = hlsenc_io_open(avf, &hls->http_delete, path, &opt, FF_UPLOAD_ORDERED);
         av_dict_free(&opt);
         if (ret < 0)
             return hls->ignore_io_errors ? 1 : ret;
@@ -849,9 +858,9 @@ static int hls_mux_init(AVFormatContext *s, VariantStream *vs)
     if (hls->segment_type == SEGMENT_TYPE_FMP4) {
         set_http_options(s, &options, hls);
         if (byterange_mode) {
-            ret = hlsenc_io_open(s, &vs->out, vs->basename, &options);
+            ret = hlsenc_io_open(s, &vs->out, vs->basename, &options, 0);
         } else {
-            ret = hlsenc_io_open(s, &vs->out, vs->base_output_dirname, &options);
+            ret = hlsenc_io_open(s, &vs->out, vs->base_output_dirname, &options, 0);
         }
         av_dict_free(&options);
     }
@@ -1371,7 +1380,7 @@ static int create_master_playlist(AVFormatContext *s,
 
     set_http_options(s, &options, hls);
     snprintf(temp_filename, sizeof(temp_filename), use_temp_file ? "%s.tmp" : "%s", hls->master_m3u8_url);
-    ret = hlsenc_io_open(s, &hls->m3u8_out, temp_filename, &options);
+    ret = hlsenc_io_open(s, &hls->m3u8_out, temp_filename, &options, FF_UPLOAD_ORDERED);
     av_dict_free(&options);
     if (ret < 0) {
         av_log(s, AV_LOG_ERROR, "Failed to open master play list file '%s'\n",
@@ -1561,7 +1570,7 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
 
     set_http_options(s, &options, hls);
     snprintf(temp_filename, sizeof(temp_filename), use_temp_file ? "%s.tmp" : "%s", vs->m3u8_name);
-    ret = hlsenc_io_open(s, byterange_mode ? &hls->m3u8_out : &vs->out, temp_filename, &options);
+    ret = hlsenc_io_open(s, byterange_mode ? &hls->m3u8_out : &vs->out, temp_filename, &options, FF_UPLOAD_ORDERED);
     av_dict_free(&options);
     if (ret < 0) {
         goto fail;
@@ -1618,7 +1627,7 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     if (vs->vtt_m3u8_name) {
         set_http_options(vs->vtt_avf, &options, hls);
         snprintf(temp_vtt_filename, sizeof(temp_vtt_filename), use_temp_file ? "%s.tmp" : "%s", vs->vtt_m3u8_name);
-        ret = hlsenc_io_open(s, &hls->sub_m3u8_out, temp_vtt_filename, &options);
+        ret = hlsenc_io_open(s, &hls->sub_m3u8_out, temp_vtt_filename, &options, FF_UPLOAD_ORDERED);
         av_dict_free(&options);
         if (ret < 0) {
             goto fail;
@@ -1806,13 +1815,13 @@ static int hls_start(AVFormatContext *s, VariantStream *vs)
             }
             set_http_options(s, &options, c);
             if (!vs->out_single_file)
-                if ((err = hlsenc_io_open(s, &vs->out_single_file, vs->basename, &options)) < 0) {
+                if ((err = hlsenc_io_open(s, &vs->out_single_file, vs->basename, &options, 0)) < 0) {
                     if (c->ignore_io_errors)
                         err = 0;
                     goto fail;
                 }
 
-            if ((err = hlsenc_io_open(s, &vs->out, vs->basename_tmp, &options)) < 0) {
+            if ((err = hlsenc_io_open(s, &vs->out, vs->basename_tmp, &options, 0)) < 0) {
                 if (c->ignore_io_errors)
                     err = 0;
                 goto fail;
@@ -1822,7 +1831,7 @@ static int hls_start(AVFormatContext *s, VariantStream *vs)
     }
     if (vs->vtt_basename) {
         set_http_options(s, &options, c);
-        if ((err = hlsenc_io_open(s, &vtt_oc->pb, vtt_oc->url, &options)) < 0) {
+        if ((err = hlsenc_io_open(s, &vtt_oc->pb, vtt_oc->url, &options, 0)) < 0) {
             if (c->ignore_io_errors)
                 err = 0;
             goto fail;
@@ -2352,7 +2361,7 @@ static int hls_init_file_resend(AVFormatContext *s, VariantStream *vs)
     int ret = 0;
 
     set_http_options(s, &options, hls);
-    ret = hlsenc_io_open(s, &vs->out, vs->base_output_dirname, &options);
+    ret = hlsenc_io_open(s, &vs->out, vs->base_output_dirname, &options, 0);
     av_dict_free(&options);
     if (ret < 0)
         return ret;
@@ -2554,7 +2563,7 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
 
                 set_http_options(s, &options, hls);
 
-                ret = hlsenc_io_open(s, &vs->out, filename, &options);
+                ret = hlsenc_io_open(s, &vs->out, filename, &options, 0);
                 if (ret < 0) {
                     av_log(s, hls->ignore_io_errors ? AV_LOG_WARNING : AV_LOG_ERROR,
                            "Failed to open file '%s'\n", filename);
@@ -2577,7 +2586,7 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
                     av_log(s, AV_LOG_WARNING, "upload segment failed,"
                            " will retry with a new http session.\n");
                     ff_format_io_close(s, &vs->out);
-                    ret = hlsenc_io_open(s, &vs->out, filename, &options);
+                    ret = hlsenc_io_open(s, &vs->out, filename, &options, 0);
                     if (ret >= 0) {
                         reflush_dynbuf(vs, &range_length);
                         ret = hlsenc_io_close(s, &vs->out, filename);
@@ -2682,6 +2691,8 @@ static void hls_deinit(AVFormatContext *s)
     int i = 0;
     VariantStream *vs = NULL;
 
+    ff_uploadqueue_freep(&hls->upload);
+
     for (i = 0; i < hls->nb_varstreams; i++) {
         vs = &hls->var_streams[i];
 
@@ -2763,14 +2774,14 @@ static int hls_write_trailer(struct AVFormatContext *s)
                 vs->start_pos = range_length;
                 byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
                 if (!byterange_mode) {
-                    ff_format_io_close(s, &vs->out);
                     hlsenc_io_close(s, &vs->out, vs->base_output_dirname);
+                    ff_format_io_close(s, &vs->out);
                 }
             }
         }
         if (!(hls->flags & HLS_SINGLE_FILE)) {
             set_http_options(s, &options, hls);
-            ret = hlsenc_io_open(s, &vs->out, filename, &options);
+            ret = hlsenc_io_open(s, &vs->out, filename, &options, 0);
             if (ret < 0) {
                 av_log(s, AV_LOG_ERROR, "Failed to open file '%s'\n", oc->url);
                 goto failed;
@@ -2787,7 +2798,7 @@ static int hls_write_trailer(struct AVFormatContext *s)
         if (ret < 0) {
             av_log(s, AV_LOG_WARNING, "upload segment failed, will retry with a new http session.\n");
             ff_format_io_close(s, &vs->out);
-            ret = hlsenc_io_open(s, &vs->out, filename, &options);
+            ret = hlsenc_io_open(s, &vs->out, filename, &options, 0);
             if (ret < 0) {
                 av_log(s, AV_LOG_ERROR, "Failed to open file '%s'\n", oc->url);
                 goto failed;
@@ -2833,6 +2844,7 @@ failed:
             if (vtt_oc->pb)
                 av_write_trailer(vtt_oc);
             vs->size = avio_tell(vs->vtt_avf->pb) - vs->start_pos;
+            hlsenc_io_close(s, &vtt_oc->pb, vtt_oc->url);
             ff_format_io_close(s, &vtt_oc->pb);
         }
         ret = hls_window(s, 1, vs);
@@ -2846,6 +2858,12 @@ failed:
         av_free(old_filename);
     }
 
+    if (hls->upload) {
+        ret = ff_uploadqueue_flush(hls->upload);
+        if (ret < 0 && !hls->ignore_io_errors)
+            return ret;
+    }
+
     return 0;
 }
 
@@ -2885,6 +2903,17 @@ static int hls_init(AVFormatContext *s)
         av_log(hls, AV_LOG_WARNING, "No HTTP method set, hls muxer defaulting to method PUT.\n");
     }
 
+    if (hls->upload_workers && (hls->flags & HLS_SINGLE_FILE)) {
+        av_log(s, AV_LOG_WARNING, "Asynchronous uploads are not supported with single_file\n");
+    } else if (hls->upload_workers && http_base_proto) {
+        ret = ff_uploadqueue_alloc(&hls->upload, s, hls->upload_workers, hls->upload_retries,
+                                   hls->upload_buffer_size, hls->http_persistent);
+        if (ret == AVERROR(ENOSYS))
+            av_log(s, AV_LOG_WARNING, "Asynchronous uploads require threads, disabled\n");
+        else if (ret < 0)
+            return ret;
+    }
+
     ret = validate_name(hls->nb_varstreams, s->url);
     if (ret < 0)
         return ret;
@@ -3162,6 +3191,9 @@ static const AVOption options[] = {
     {"timeout", "set timeout for socket I/O operations", OFFSET(timeout), AV_OPT_TYPE_DURATION, { .i64 = -1 }, -1, INT_MAX, .flags = E },
     {"ignore_io_errors", "Ignore IO errors for stable long-duration runs with network output", OFFSET(ignore_io_errors), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     {"headers", "set custom HTTP headers, can override built in default headers", OFFSET(headers), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
+    {"upload_workers", "number of concurrent asynchronous HTTP uploads, 0 to upload synchronously", OFFSET(upload_workers), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 64, E },
+    {"upload_retries", "number of times a failed upload is retried", OFFSET(upload_retries), AV_OPT_TYPE_INT, { .i64 = 2 }, 0, INT_MAX, E },
+    {"upload_buffer_size", "maximum size of files queued for upload", OFFSET(upload_buffer_size), AV_OPT_TYPE_INT64, { .i64 = 64 << 20 }, 0, INT64_MAX, E },
     { NULL },
 };
 
@@ -37,6 +37,7 @@
 #include "libavutil/macros.h"
 #include "libavutil/mem.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "libavutil/parseutils.h"
 
@@ -46,6 +47,7 @@
 #include "internal.h"
 #include "network.h"
 #include "os_support.h"
+#include "tls.h"
 #include "url.h"
 #include "version.h"
 
@@ -61,6 +63,8 @@
 #define HTTP_SINGLE   1
 #define HTTP_MUTLI    2
 #define MAX_DATE_LEN  19
+#define MAX_PIPELINED_REQUESTS 4
+#define HTTP_POOL_MAX_SIZE     64
 #define WHITESPACES " \n\t\r"
 typedef enum {
     LOWER_PROTO,
@@ -69,6 +73,11 @@ typedef enum {
     FINISH
 }HandshakeState;
 
+typedef struct HTTPPipelinedRequest {
+    char *uri;
+    uint64_t off, end_off;
+} HTTPPipelinedRequest;
+
 typedef struct HTTPContext {
     const AVClass *class;
     URLContext *hd;
@@ -101,6 +110,19 @@ typedef struct HTTPContext {
     int end_header;
     /* A flag which indicates if we use persistent connections. */
     int multiple_requests;
+    int pool_size;
+    int64_t pool_idle_timeout;
+    /* Server and lower protocol options of hd, set if hd may be pooled. */
+    char *pool_key;
+    /* A flag which indicates if hd was taken from the connection pool. */
+    int pooled_hd;
+    /* Requests sent on hd whose responses follow the current one. */
+    HTTPPipelinedRequest pipeline[MAX_PIPELINED_REQUESTS];
+    int nb_pipelined;
+    /* Only send the request in http_connect(). */
+    int pipelining;
+    /* Only read the response in http_connect(), the request was pipelined. */
+    int pipelined_response;
     uint8_t *post_data;
     int post_datalen;
     int is_akamai;
@@ -154,6 +176,8 @@ typedef struct HTTPContext {
     int nb_retries;
     int nb_reconnects;
     int nb_redirects;
+    int nb_pool_reuses;
+    int nb_pipelined_requests;
     int sum_latency; /* divide by nb_requests */
     int max_latency;
 } HTTPContext;
@@ -202,6 +226,8 @@ static const AVOption options[] = {
     { "resource", "The resource requested by a client", OFFSET(resource), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
     { "reply_code", "The http status code to return to a client", OFFSET(reply_code), AV_OPT_TYPE_INT, { .i64 = 200}, INT_MIN, 599, E},
     { "short_seek_size", "Threshold to favor readahead over seek.", OFFSET(short_seek_size), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, D },
+    { "pool_size", "number of idle connections per server kept for reuse by later requests, 0 to disable", OFFSET(pool_size), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, HTTP_POOL_MAX_SIZE, D },
+    { "pool_idle_timeout", "time after which an idle pooled connection is closed", OFFSET(pool_idle_timeout), AV_OPT_TYPE_DURATION, { .i64 = 30000000 }, 0, INT64_MAX, D },
     { NULL }
 };
 
@@ -209,6 +235,7 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
                         const char *hoststr, const char *auth,
                         const char *proxyauth);
 static int http_read_header(URLContext *h);
+static int http_buf_read(URLContext *h, uint8_t *buf, int size);
 static int http_shutdown(URLContext *h, int flags);
 
 void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
@@ -221,6 +248,150 @@ void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
            sizeof(HTTPAuthState));
 }
 
+typedef struct HTTPPoolEntry {
+    char *key;
+    URLContext *hd;
+    int64_t expiry;
+} HTTPPoolEntry;
+
+/* Idle keep-alive connections, shared by all the HTTP contexts. */
+static AVMutex pool_mutex = AV_MUTEX_INITIALIZER;
+static HTTPPoolEntry pool[HTTP_POOL_MAX_SIZE];
+static int pool_nb_entries;
+
+static int pool_set_interrupt_callback(URLContext *hd, const AVIOInterruptCB *int_cb)
+{
+#if CONFIG_TLS_PROTOCOL
+    if (!strcmp(hd->prot->name, "tls"))
+        return ff_tls_set_interrupt_callback(hd, int_cb);
+#endif
+    if (strcmp(hd->prot->name, "tcp"))
+        return AVERROR(ENOSYS);
+    hd->interrupt_callback = *int_cb;
+    return 0;
+}
+
+/* Must be called with pool_mutex locked. */
+static URLContext *pool_remove(int i)
+{
+    URLContext *hd = pool[i].hd;
+
+    av_free(pool[i].key);
+    pool[i] = pool[--pool_nb_entries];
+    return hd;
+}
+
+static int pool_set_key(HTTPContext *s, const char *lower_url, AVDictionary *options)
+{
+    char *opts = NULL;
+    int ret;
+
+    /* connections are only shared between requests using the same
+     * lower protocol options, e.g. TLS certificate verification */
+    ret = av_dict_get_string(options, &opts, '=', '&');
+    if (ret < 0)
+        return ret;
+    av_freep(&s->pool_key);
+    s->pool_key = av_asprintf("%s?%s", lower_url, opts);
+    av_free(opts);
+    return s->pool_key ? 0 : AVERROR(ENOMEM);
+}
+
+static URLContext *pool_get(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+
+    for (;;) {
+        URLContext *hd = NULL;
+        int64_t expiry = 0;
+        uint8_t c;
+        int ret;
+
+        ff_mutex_lock(&pool_mutex);
+        for (int i = pool_nb_entries - 1; i >= 0; i--) {
+            if (!strcmp(pool[i].key, s->pool_key)) {
+                expiry = pool[i].expiry;
+                hd     = pool_remove(i);
+                break;
+            }
+        }
+        ff_mutex_unlock(&pool_mutex);
+        if (!hd)
+            return NULL;
+
+        if (expiry > av_gettime_relative() &&
+            pool_set_interrupt_callback(hd, &h->interrupt_callback) >= 0) {
+            /* a connection closed by the server while idle is readable */
+            hd->flags |= AVIO_FLAG_NONBLOCK;
+            ret = ffurl_read(hd, &c, 1);
+            hd->flags &= ~AVIO_FLAG_NONBLOCK;
+            if (ret == AVERROR(EAGAIN))
+                return hd;
+        }
+        ffurl_close(hd);
+    }
+}
+
+/* Hand over a connection whose last response has been completely read. */
+static int pool_put(URLContext *h)
+{
+    static const AVIOInterruptCB no_interrupt_cb = { 0 };
+    HTTPContext *s = h->priv_data;
+    URLContext *evicted[HTTP_POOL_MAX_SIZE + 1];
+    int nb_evicted = 0, nb_same = 0, oldest = -1, oldest_same = -1;
+    int64_t now = av_gettime_relative();
+
+    if (pool_set_interrupt_callback(s->hd, &no_interrupt_cb) < 0)
+        return AVERROR(ENOSYS);
+
+    ff_mutex_lock(&pool_mutex);
+    for (int i = pool_nb_entries - 1; i >= 0; i--)
+        if (pool[i].expiry <= now)
+            evicted[nb_evicted++] = pool_remove(i);
+    for (int i = 0; i < pool_nb_entries; i++) {
+        if (oldest < 0 || pool[i].expiry < pool[oldest].expiry)
+            oldest = i;
+        if (!strcmp(pool[i].key, s->pool_key)) {
+            nb_same++;
+            if (oldest_same < 0 || pool[i].expiry < pool[oldest_same].expiry)
+                oldest_same = i;
+        }
+    }
+    if (nb_same >= s->pool_size)
+        evicted[nb_evicted++] = pool_remove(oldest_same);
+    else if (pool_nb_entries == HTTP_POOL_MAX_SIZE)
+        evicted[nb_evicted++] = pool_remove(oldest);
+
+    pool[pool_nb_entries++] = (HTTPPoolEntry) {
+        .key    = s->pool_key,
+        .hd     = s->hd,
+        .expiry = now + s->pool_idle_timeout,
+    };
+    ff_mutex_unlock(&pool_mutex);
+
+    s->pool_key = NULL;
+    s->hd       = NULL;
+    for (int i = 0; i < nb_evicted; i++)
+        ffurl_close(evicted[i]);
+    return 0;
+}
+
+static void http_pipeline_reset(HTTPContext *s)
+{
+    for (int i = 0; i < s->nb_pipelined; i++)
+        av_freep(&s->pipeline[i].uri);
+    s->nb_pipelined = 0;
+}
+
+static int http_response_complete(HTTPContext *s)
+{
+    uint64_t end = s->range_end ? s->range_end : s->filesize;
+
+    if (s->chunksize != UINT64_MAX)
+        return s->chunkend;
+    return end != UINT64_MAX && s->off >= end;
+}
+
 static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 {
     const char *path, *proxy_path, *lower_proto = "tcp", *local_path;
@@ -308,10 +479,22 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     ff_url_join(buf, sizeof(buf), lower_proto, NULL, hostname, port, NULL);
 
     if (!s->hd) {
-        s->nb_connections++;
-        err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
-                                   &h->interrupt_callback, options,
-                                   h->protocol_whitelist, h->protocol_blacklist, h);
+        http_pipeline_reset(s);
+        if (s->pool_size > 0 && !(h->flags & AVIO_FLAG_WRITE) &&
+            !s->post_data && !s->listen) {
+            if ((err = pool_set_key(s, buf, *options)) < 0)
+                goto end;
+            s->hd = pool_get(h);
+        }
+        s->pooled_hd = !!s->hd;
+        if (s->pooled_hd) {
+            s->nb_pool_reuses++;
+        } else {
+            s->nb_connections++;
+            err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
+                                       &h->interrupt_callback, options,
+                                       h->protocol_whitelist, h->protocol_blacklist, h);
+        }
     }
 
 end:
@@ -427,6 +610,14 @@ redo:
     off = s->off;
     ret = http_open_cnx_internal(h, options);
     if (ret < 0) {
+        if (s->pooled_hd && (ret == AVERROR_EOF || ret == AVERROR(EPIPE) ||
+                             ret == AVERROR(ECONNRESET))) {
+            /* the server closed the pooled connection, try another one */
+            av_log(h, AV_LOG_DEBUG, "Pooled connection lost: %s\n", av_err2str(ret));
+            ffurl_closep(&s->hd);
+            s->off = off;
+            goto redo;
+        }
         if (!http_should_reconnect(s, ret) ||
             reconnect_delay > s->reconnect_delay_max ||
             (s->reconnect_max_retries >= 0 && conn_attempts > s->reconnect_max_retries) ||
@@ -516,11 +707,9 @@ int ff_http_do_new_request(URLContext *h, const char *uri) {
     return ff_http_do_new_request2(h, uri, NULL);
 }
 
-int ff_http_do_new_request2(URLContext *h, const char *uri, AVDictionary **opts)
+static int http_check_reusable(URLContext *h, const char *uri)
 {
     HTTPContext *s = h->priv_data;
-    AVDictionary *options = NULL;
-    int ret;
     char hostname1[1024], hostname2[1024], proto1[10], proto2[10];
     int port1, port2;
 
@@ -547,6 +736,30 @@ int ff_http_do_new_request2(URLContext *h, const char *uri, AVDictionary **opts)
         );
         return AVERROR(EINVAL);
     }
+    return 0;
+}
+
+static int http_drain_response(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    uint8_t discard[4096];
+    int ret;
+
+    while ((ret = http_buf_read(h, discard, sizeof(discard))) > 0)
+        ;
+    if (http_response_complete(s))
+        return 0;
+    return ret < 0 ? ret : AVERROR(EIO);
+}
+
+int ff_http_do_new_request2(URLContext *h, const char *uri, AVDictionary **opts)
+{
+    HTTPContext *s = h->priv_data;
+    AVDictionary *options = NULL;
+    int ret;
+
+    if ((ret = http_check_reusable(h, uri)) < 0)
+        return ret;
 
     if (!s->end_chunked_post) {
         ret = http_shutdown(h, h->flags);
@@ -557,6 +770,12 @@ int ff_http_do_new_request2(URLContext *h, const char *uri, AVDictionary **opts)
     if (s->willclose)
         return AVERROR_EOF;
 
+    /* the responses to the pipelined requests follow the current one */
+    if (s->nb_pipelined && http_drain_response(h) < 0) {
+        http_pipeline_reset(s);
+        ffurl_closep(&s->hd);
+    }
+
     s->end_chunked_post = 0;
     s->chunkend      = 0;
     s->off           = 0;
@@ -575,12 +794,77 @@ int ff_http_do_new_request2(URLContext *h, const char *uri, AVDictionary **opts)
     if ((ret = av_opt_set_dict(s, opts)) < 0)
         return ret;
 
+    if (s->nb_pipelined) {
+        HTTPPipelinedRequest *req = &s->pipeline[0];
+
+        if (!strcmp(req->uri, uri) && req->off == s->off && req->end_off == s->end_off) {
+            s->pipelined_response = 1;
+            av_free(req->uri);
+            s->nb_pipelined--;
+            memmove(s->pipeline, s->pipeline + 1, s->nb_pipelined * sizeof(*s->pipeline));
+        } else {
+            /* the next response is not the one requested */
+            http_pipeline_reset(s);
+            ffurl_closep(&s->hd);
+        }
+    }
+
     av_log(s, AV_LOG_INFO, "Opening \'%s\' for %s\n", uri, h->flags & AVIO_FLAG_WRITE ? "writing" : "reading");
     ret = http_open_cnx(h, &options);
+    s->pipelined_response = 0;
     av_dict_free(&options);
     return ret;
 }
 
+int ff_http_pipeline_request(URLContext *h, const char *uri,
+                             uint64_t off, uint64_t end_off)
+{
+    HTTPContext *s = h->priv_data;
+    HTTPPipelinedRequest *req;
+    AVDictionary *options = NULL;
+    char *location = s->location;
+    uint64_t cur_off = s->off, cur_end_off = s->end_off;
+    int ret;
+
+    if ((ret = http_check_reusable(h, uri)) < 0)
+        return ret;
+    if (!s->hd || !s->multiple_requests || s->willclose || s->post_data ||
+        s->listen || (h->flags & AVIO_FLAG_WRITE))
+        return AVERROR(EINVAL);
+    if (s->nb_pipelined == MAX_PIPELINED_REQUESTS)
+        return AVERROR(EAGAIN);
+
+    req = &s->pipeline[s->nb_pipelined];
+    req->uri = av_strdup(uri);
+    if (!req->uri)
+        return AVERROR(ENOMEM);
+    req->off     = off;
+    req->end_off = end_off;
+
+    /* send the request as if opening uri, without touching the state of
+     * the response being read */
+    s->location   = req->uri;
+    s->off        = off;
+    s->end_off    = end_off;
+    s->pipelining = 1;
+    av_dict_copy(&options, s->chained_options, 0);
+    ret = http_open_cnx_internal(h, &options);
+    av_dict_free(&options);
+    s->pipelining = 0;
+    s->location   = location;
+    s->off        = cur_off;
+    s->end_off    = cur_end_off;
+
+    if (ret < 0) {
+        /* the request may have been partially sent */
+        av_freep(&req->uri);
+        s->willclose = 1;
+        return ret;
+    }
+    s->nb_pipelined++;
+    return 0;
+}
+
 int ff_http_averror(int status_code, int default_averror)
 {
     switch (status_code) {
@@ -772,6 +1056,10 @@ static int http_open(URLContext *h, const char *uri, int flags,
     s->partial_requests = s->seekable != 0 && s->initial_request_size > 0;
     s->filesize = UINT64_MAX;
 
+    /* pooled connections must be kept alive by the server */
+    if (s->pool_size > 0 && !(flags & AVIO_FLAG_WRITE))
+        s->multiple_requests = 1;
+
     s->location = av_strdup(uri);
     if (!s->location)
         return AVERROR(ENOMEM);
@@ -1433,6 +1721,7 @@ static int http_read_header(URLContext *h)
     s->expires = 0;
     s->chunksize = UINT64_MAX;
     s->filesize_from_content_range = UINT64_MAX;
+    s->range_end = 0;
 
     for (;;) {
         int parsed_http_code = 0;
@@ -1523,12 +1812,23 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
     uint64_t off = s->off;
     const char *method;
     int send_expect_100 = 0;
-
-    av_bprint_init_for_buffer(&request, s->buffer, sizeof(s->buffer));
+    int pipelined = s->pipelined_response;
 
     /* send http header */
     post = h->flags & AVIO_FLAG_WRITE;
 
+    /* the request was already sent by ff_http_pipeline_request() */
+    if (pipelined) {
+        s->nb_pipelined_requests++;
+        goto read_response;
+    }
+
+    /* the input buffer may hold the response being read when pipelining */
+    if (s->pipelining)
+        av_bprint_init(&request, 0, sizeof(s->buffer));
+    else
+        av_bprint_init_for_buffer(&request, s->buffer, sizeof(s->buffer));
+
     if (s->post_data) {
         /* force POST method and disable chunked encoding when
          * custom HTTP post data is set */
@@ -1639,13 +1939,26 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
     if ((err = ffurl_write(s->hd, request.str, request.len)) < 0)
         goto done;
 
+    if (s->pipelining) {
+        err = 0;
+        goto done;
+    }
+
     if (s->post_data)
         if ((err = ffurl_write(s->hd, s->post_data, s->post_datalen)) < 0)
             goto done;
 
-    /* init input buffer */
+read_response:
+    /* init input buffer, keeping the data following a pipelined request's
+     * response */
+    if (pipelined) {
+        int len = s->buf_end - s->buf_ptr;
+        memmove(s->buffer, s->buf_ptr, len);
+        s->buf_end = s->buffer + len;
+    } else {
+        s->buf_end = s->buffer;
+    }
     s->buf_ptr          = s->buffer;
-    s->buf_end          = s->buffer;
     s->line_count       = 0;
     s->off              = 0;
     s->icy_data_read    = 0;
@@ -1681,6 +1994,8 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
 
     err = (off == s->off) ? 0 : -1;
 done:
+    if (s->pipelining)
+        av_bprint_finalize(&request, NULL);
     av_freep(&authstr);
     av_freep(&proxyauthstr);
     return err;
@@ -2043,8 +2358,15 @@ static int http_close(URLContext *h)
         /* Close the write direction by sending the end of chunked encoding. */
         ret = http_shutdown(h, h->flags);
 
+    /* keep the connection for another request if its response is done */
+    if (s->hd && s->pool_key && !s->nb_pipelined && !s->willclose &&
+        s->buf_ptr == s->buf_end && http_response_complete(s))
+        pool_put(h);
+
     if (s->hd)
         ffurl_closep(&s->hd);
+    http_pipeline_reset(s);
+    av_freep(&s->pool_key);
     av_dict_free(&s->chained_options);
     av_dict_free(&s->cookie_dict);
     av_dict_free(&s->redirect_cache);
@@ -2058,6 +2380,11 @@ static int http_close(URLContext *h)
            s->nb_reconnects,  s->nb_reconnects  == 1 ? ""  : "s",
            s->nb_redirects,   s->nb_redirects   == 1 ? ""  : "s");
 
+    if (s->nb_pool_reuses || s->nb_pipelined_requests)
+        av_log(h, AV_LOG_DEBUG, "%d pooled connection%s reused, %d pipelined request%s\n",
+               s->nb_pool_reuses,        s->nb_pool_reuses        == 1 ? "" : "s",
+               s->nb_pipelined_requests, s->nb_pipelined_requests == 1 ? "" : "s");
+
     if (s->nb_requests > 0) {
         av_log(h, AV_LOG_DEBUG, "Latency: %.2f ms avg, %.2f ms max\n",
                1e-3 * s->sum_latency / s->nb_requests,
@@ -60,6 +60,22 @@ int ff_http_do_new_request(URLContext *h, const char *uri);
  */
 int ff_http_do_new_request2(URLContext *h, const char *uri, AVDictionary **options);
 
+/**
+ * Send a request for uri on the connection of h before the response being
+ * read is complete. The response is read by a later call to
+ * ff_http_do_new_request2() with the same uri and offsets.
+ *
+ * @param h       pointer to the resource, opened for reading with the
+ *                multiple_requests option
+ * @param uri     uri of the request, on the same server as h
+ * @param off     offset option of the request
+ * @param end_off end_offset option of the request
+ * @return 0 on success, AVERROR(EAGAIN) if too many requests are pending,
+ *         another negative value if the request could not be sent
+ */
+int ff_http_pipeline_request(URLContext *h, const char *uri,
+                             uint64_t off, uint64_t end_off);
+
 int ff_http_averror(int status_code, int default_averror);
 
 const char* ff_http_get_new_location(URLContext *h);
@@ -0,0 +1,373 @@
+/*
+ * Persistent seek index cache
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <sys/stat.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+#include "libavutil/random_seed.h"
+#include "libavutil/sha.h"
+
+#include "avformat.h"
+#include "avformat_internal.h"
+#include "avio_internal.h"
+#include "demux.h"
+#include "internal.h"
+#include "os_support.h"
+#include "url.h"
+
+#define INDEX_CACHE_TAG     MKBETAG('F','F','I','X')
+#define INDEX_CACHE_VERSION 1
+/* Number of bytes hashed at the start and at the end of the input. */
+#define INDEX_CACHE_HASH_BYTES (64 * 1024)
+
+/**
+ * Compute the key an index is valid for: the size and modification time
+ * of the input, and a SHA-256 of its first and last bytes.
+ */
+static int input_key(AVFormatContext *s, uint8_t key[FF_INDEX_CACHE_KEY_SIZE])
+{
+    AVIOContext *pb = s->pb;
+    const char *proto, *path = s->url;
+    int64_t size, mtime = 0, pos, ret = 0;
+    struct AVSHA *sha;
+    uint8_t *buf;
+
+    if (!pb || !(pb->seekable & AVIO_SEEKABLE_NORMAL))
+        return AVERROR(ENOSYS);
+    size = avio_size(pb);
+    if (size < 0)
+        return size;
+
+    proto = avio_find_protocol_name(s->url);
+    if (proto && !strcmp(proto, "file")) {
+        struct stat st;
+        av_strstart(path, "file:", &path);
+        if (!stat(path, &st))
+            mtime = st.st_mtime;
+    }
+
+    sha = av_sha_alloc();
+    buf = av_malloc(INDEX_CACHE_HASH_BYTES);
+    if (!sha || !buf) {
+        av_free(sha);
+        av_free(buf);
+        return AVERROR(ENOMEM);
+    }
+    av_sha_init(sha, 256);
+
+    pos = avio_tell(pb);
+    for (int i = 0; i < 2; i++) {
+        int64_t start = i ? FFMAX(size - INDEX_CACHE_HASH_BYTES, INDEX_CACHE_HASH_BYTES) : 0;
+        int len = FFMIN(size - start, INDEX_CACHE_HASH_BYTES);
+
+        if (len <= 0)
+            break;
+        if ((ret = avio_seek(pb, start, SEEK_SET)) < 0 ||
+            (ret = ffio_read_size(pb, buf, len)) < 0)
+            break;
+        av_sha_update(sha, buf, len);
+    }
+    av_sha_final(sha, key + 16);
+    AV_WB64(key,     size);
+    AV_WB64(key + 8, mtime);
+    av_free(sha);
+    av_free(buf);
+
+    if (ret >= 0 && (ret = avio_seek(pb, pos, SEEK_SET)) >= 0)
+        ret = 0;
+    return ret;
+}
+
+static int index_write(AVFormatContext *s, const char *url,
+                       const uint8_t key[FF_INDEX_CACHE_KEY_SIZE])
+{
+    AVIOContext *pb;
+    char *tmp;
+    int ret;
+
+    /* Write to a unique temporary file, so that concurrent writers and
+     * readers never see a partial index. */
+    tmp = av_asprintf("%s.%08x.tmp", url, av_get_random_seed());
+    if (!tmp)
+        return AVERROR(ENOMEM);
+
+    ret = s->io_open(s, &pb, tmp, AVIO_FLAG_WRITE, NULL);
+    if (ret < 0)
+        goto end;
+
+    avio_wb32(pb, INDEX_CACHE_TAG);
+    avio_wb32(pb, INDEX_CACHE_VERSION);
+    avio_write(pb, key, FF_INDEX_CACHE_KEY_SIZE);
+    avio_wb32(pb, s->nb_streams);
+    for (unsigned i = 0; i < s->nb_streams; i++) {
+        const AVStream  *st  = s->streams[i];
+        const FFStream  *sti = cffstream(st);
+
+        avio_wb32(pb, st->id);
+        avio_wb32(pb, st->codecpar->codec_id);
+        avio_wb32(pb, st->time_base.num);
+        avio_wb32(pb, st->time_base.den);
+        avio_wb32(pb, sti->nb_index_entries);
+        for (int j = 0; j < sti->nb_index_entries; j++) {
+            const AVIndexEntry *e = &sti->index_entries[j];
+
+            avio_wb64(pb, e->pos);
+            avio_wb64(pb, e->timestamp);
+            avio_wb32(pb, e->size);
+            avio_wb32(pb, e->min_distance);
+            avio_wb32(pb, e->flags);
+        }
+    }
+    avio_flush(pb);
+    ret = pb->error;
+    if (ff_format_io_close(s, &pb) < 0 && ret >= 0)
+        ret = AVERROR(EIO);
+
+    if (ret >= 0)
+        ret = ff_rename(tmp, url, s);
+    else
+        ffurl_delete(tmp);
+end:
+    av_free(tmp);
+    return ret;
+}
+
+typedef struct IndexCacheEntry {
+    unsigned stream_index;
+    int64_t  pos;
+    int64_t  timestamp;
+    int      size;
+    int      distance;
+    int      flags;
+} IndexCacheEntry;
+
+/**
+ * Read the entries stored in url for the matching streams into *entries.
+ * All the entries are validated, including the ones that are not used.
+ *
+ * @return number of entries read on success, a negative AVERROR code on failure
+ */
+static int64_t index_read_entries(AVFormatContext *s, AVIOContext *pb,
+                                  IndexCacheEntry **entries)
+{
+    unsigned entries_size = 0, nb_streams = avio_rb32(pb);
+    int64_t nb_entries = 0;
+
+    for (unsigned i = 0; i < nb_streams; i++) {
+        AVStream *st = i < s->nb_streams ? s->streams[i] : NULL;
+        int id                  = avio_rb32(pb);
+        enum AVCodecID codec_id = avio_rb32(pb);
+        AVRational time_base;
+        unsigned nb_stream_entries;
+        int use;
+
+        time_base.num     = avio_rb32(pb);
+        time_base.den     = avio_rb32(pb);
+        nb_stream_entries = avio_rb32(pb);
+        if (avio_feof(pb))
+            return AVERROR_INVALIDDATA;
+
+        use = st && st->id == id && st->codecpar->codec_id == codec_id &&
+              !av_cmp_q(st->time_base, time_base);
+        for (unsigned j = 0; j < nb_stream_entries; j++) {
+            IndexCacheEntry e, *tmp;
+
+            e.stream_index = i;
+            e.pos          = avio_rb64(pb);
+            e.timestamp    = avio_rb64(pb);
+            e.size         = avio_rb32(pb);
+            e.distance     = avio_rb32(pb);
+            e.flags        = avio_rb32(pb);
+            /* the same checks as ff_add_index_entry() */
+            if (avio_feof(pb) || e.timestamp == AV_NOPTS_VALUE ||
+                e.size < 0 || e.size > 0x3FFFFFFF)
+                return AVERROR_INVALIDDATA;
+            if (!use)
+                continue;
+
+            if (nb_entries >= INT_MAX / sizeof(e))
+                return AVERROR(ENOMEM);
+            tmp = av_fast_realloc(*entries, &entries_size,
+                                  (nb_entries + 1) * sizeof(e));
+            if (!tmp)
+                return AVERROR(ENOMEM);
+            *entries = tmp;
+            tmp[nb_entries++] = e;
+        }
+    }
+    return nb_entries;
+}
+
+/**
+ * Merge the index stored in url into the index of the matching streams.
+ * Nothing is merged unless the whole file is valid.
+ *
+ * @return number of entries used on success, a negative AVERROR code on failure
+ */
+static int64_t index_read(AVFormatContext *s, const char *url,
+                          const uint8_t key[FF_INDEX_CACHE_KEY_SIZE])
+{
+    uint8_t file_key[FF_INDEX_CACHE_KEY_SIZE];
+    IndexCacheEntry *entries = NULL;
+    AVIOContext *pb;
+    int64_t ret;
+
+    ret = s->io_open(s, &pb, url, AVIO_FLAG_READ, NULL);
+    if (ret < 0)
+        return ret;
+
+    if (avio_rb32(pb) != INDEX_CACHE_TAG ||
+        avio_rb32(pb) != INDEX_CACHE_VERSION ||
+        avio_read(pb, file_key, sizeof(file_key)) != sizeof(file_key)) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+    if (memcmp(key, file_key, sizeof(file_key))) {
+        av_log(s, AV_LOG_VERBOSE, "Index in %s is for different input data\n", url);
+        ret = AVERROR(ESTALE);
+        goto end;
+    }
+
+    ret = index_read_entries(s, pb, &entries);
+    for (int64_t i = 0; i < ret; i++) {
+        const IndexCacheEntry *e = &entries[i];
+        FFStream *sti = ffstream(s->streams[e->stream_index]);
+
+        if (ff_add_index_entry(&sti->index_entries, &sti->nb_index_entries,
+                               &sti->index_entries_allocated_size,
+                               e->pos, e->timestamp, e->size, e->distance,
+                               e->flags) < 0) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+    }
+
+end:
+    av_free(entries);
+    ff_format_io_close(s, &pb);
+    return ret;
+}
+
+static int64_t count_index_entries(const AVFormatContext *s)
+{
+    int64_t nb_entries = 0;
+
+    for (unsigned i = 0; i < s->nb_streams; i++)
+        nb_entries += cffstream(s->streams[i])->nb_index_entries;
+    return nb_entries;
+}
+
+int avformat_index_save(AVFormatContext *s, const char *url)
+{
+    uint8_t key[FF_INDEX_CACHE_KEY_SIZE];
+    int ret = input_key(s, key);
+
+    if (ret < 0)
+        return ret;
+    return index_write(s, url, key);
+}
+
+int avformat_index_load(AVFormatContext *s, const char *url)
+{
+    uint8_t key[FF_INDEX_CACHE_KEY_SIZE];
+    int64_t ret = input_key(s, key);
+
+    if (ret < 0)
+        return ret;
+    ret = index_read(s, url, key);
+    return ret < 0 ? ret : 0;
+}
+
+void ff_index_cache_open(AVFormatContext *s)
+{
+    FormatContextInternal *const fci = ff_fc_internal(s);
+    uint8_t url_hash[20];
+    char name[2 * sizeof(url_hash) + 1];
+    struct AVSHA *sha;
+
+    if (!s->index_cache || !*s->index_cache || !s->url)
+        return;
+
+    /* An index read from the container is better than one built while
+     * demuxing, and some demuxers rely on theirs being complete. */
+    if (count_index_entries(s)) {
+        av_log(s, AV_LOG_VERBOSE, "Input has an index, not using the index cache\n");
+        return;
+    }
+
+    if (input_key(s, fci->index_cache_key) < 0)
+        return;
+
+    sha = av_sha_alloc();
+    if (!sha)
+        return;
+    av_sha_init(sha, 160);
+    av_sha_update(sha, s->url, strlen(s->url));
+    av_sha_final(sha, url_hash);
+    av_free(sha);
+    ff_data_to_hex(name, url_hash, sizeof(url_hash), 1);
+    name[2 * sizeof(url_hash)] = 0;
+
+    fci->index_cache_url = av_asprintf("%s/%s.idx", s->index_cache, name);
+}
+
+void ff_index_cache_load(AVFormatContext *s)
+{
+    FormatContextInternal *const fci = ff_fc_internal(s);
+    int64_t ret;
+
+    /* Loading is deferred until the index is needed, as some demuxers
+     * only create their streams after avformat_open_input(). */
+    if (!fci->index_cache_url || fci->index_cache_loaded)
+        return;
+    fci->index_cache_loaded = 1;
+
+    ret = index_read(s, fci->index_cache_url, fci->index_cache_key);
+    if (ret < 0) {
+        if (ret != AVERROR(ENOENT) && ret != AVERROR(ESTALE))
+            av_log(s, AV_LOG_WARNING, "Could not read index from %s: %s\n",
+                   fci->index_cache_url, av_err2str(ret));
+        return;
+    }
+    fci->index_cache_nb_entries = ret;
+    av_log(s, AV_LOG_VERBOSE, "Loaded %"PRId64" index entries from %s\n",
+           ret, fci->index_cache_url);
+}
+
+void ff_index_cache_close(AVFormatContext *s)
+{
+    FormatContextInternal *const fci = ff_fc_internal(s);
+
+    if (!fci->index_cache_url)
+        return;
+
+    ff_index_cache_load(s);
+
+    /* Only write the index back if demuxing extended it. */
+    if (count_index_entries(s) > fci->index_cache_nb_entries) {
+        int ret = index_write(s, fci->index_cache_url, fci->index_cache_key);
+        if (ret < 0)
+            av_log(s, AV_LOG_WARNING, "Could not write index to %s: %s\n",
+                   fci->index_cache_url, av_err2str(ret));
+    }
+    av_freep(&fci->index_cache_url);
+}
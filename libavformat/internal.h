@@ -483,6 +483,20 @@ int ff_get_line(AVIOContext *s, char *buf, int maxlen);
  */
 int ff_get_chomp_line(AVIOContext *s, char *buf, int maxlen);
 
+/**
+ * Same as av_get_packet(), but the packet may reference the data kept in
+ * memory by the protocol (e.g. the file protocol mmap option) instead of a
+ * copy. Such a packet is read-only and the padding following it holds the
+ * next bytes of the input instead of zeros, so a reference is only returned
+ * for codecs whose decoders neither write to the packet nor read its
+ * padding (raw video and linear PCM). Only use this for packets that are
+ * not modified by the demuxer.
+ *
+ * @param par parameters of the stream the packet belongs to
+ */
+int ff_get_packet_ref(AVIOContext *s, AVPacket *pkt, int size,
+                      const AVCodecParameters *par);
+
 #define SPACE_CHARS " \t\r\n"
 
 /**
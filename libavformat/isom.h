@@ -170,6 +170,28 @@ typedef struct MOVIndexRange {
     int64_t end;
 } MOVIndexRange;
 
+/**
+ * State of the walk over the sample tables that fills the index,
+ * kept so that a lazily built index can be extended later.
+ */
+typedef struct MOVIndexCursor {
+    int64_t offset;             ///< file offset of the next sample
+    int64_t dts;                ///< dts of the next sample
+    unsigned int chunk;         ///< current chunk
+    unsigned int chunk_sample;  ///< next sample within the current chunk
+    unsigned int sample;        ///< next sample of the track
+    unsigned int stts_index;
+    unsigned int stts_sample;
+    unsigned int stsc_index;
+    unsigned int stss_index;
+    unsigned int stps_index;
+    unsigned int rap_group_index;
+    unsigned int rap_group_sample;
+    unsigned int distance;      ///< samples since the last keyframe
+    int key_off;
+    uint64_t stream_size;       ///< sum of the sizes of the samples walked so far
+} MOVIndexCursor;
+
 typedef struct MOVStreamContext {
     AVIOContext *pb;
     int refcount;
@@ -214,6 +236,8 @@ typedef struct MOVStreamContext {
     int64_t current_index;
     MOVIndexRange* index_ranges;
     MOVIndexRange* current_index_range;
+    MOVIndexCursor index_cursor;
+    int lazy_index;       ///< index_cursor has samples left to add to the index
     unsigned int bytes_per_frame;
     unsigned int samples_per_frame;
     int dv_audio_container;
@@ -385,6 +409,7 @@ typedef struct MOVContext {
     int nb_heif_grid;
     int64_t idat_offset;
     int interleaved_read;
+    int lazy_index;
 } MOVContext;
 
 int ff_mp4_read_descr_len(AVIOContext *pb);
@@ -32,6 +32,7 @@
 #include "config_components.h"
 
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
 
 #include "libavutil/avstring.h"
@@ -50,6 +51,7 @@
 #include "libavutil/pixdesc.h"
 #include "libavutil/time_internal.h"
 #include "libavutil/spherical.h"
+#include "libavutil/thread.h"
 
 #include "libavcodec/bytestream.h"
 #include "libavcodec/defs.h"
@@ -383,6 +385,36 @@ typedef struct MatroskaLevel1Element {
     int parsed;
 } MatroskaLevel1Element;
 
+typedef struct MatroskaScanTrack {
+    uint64_t num;
+    int      stream_index;
+    double   time_scale;
+    uint64_t codec_delay_in_track_tb;
+} MatroskaScanTrack;
+
+typedef struct MatroskaScanEntry {
+    int64_t  pos;
+    int64_t  timestamp;
+    int      stream_index;
+} MatroskaScanEntry;
+
+/* Scans the clusters starting in [start, end) for keyframes. */
+typedef struct MatroskaIndexScanner {
+    struct MatroskaDemuxContext *matroska;
+    AVIOContext *pb;
+    int64_t start, end;
+    /* first cluster not scanned, i.e. the one at or after end */
+    int64_t next_cluster;
+    int     nb_clusters;
+    MatroskaScanEntry *entries;
+    int     nb_entries;
+    unsigned int entries_size;
+#if HAVE_THREADS
+    pthread_t thread;
+    int thread_started;
+#endif
+} MatroskaIndexScanner;
+
 typedef struct MatroskaDemuxContext {
     const AVClass *class;
     AVFormatContext *ctx;
@@ -438,6 +470,14 @@ typedef struct MatroskaDemuxContext {
 
     /* Bandwidth value for WebM DASH Manifest */
     int bandwidth;
+
+    /* Keyframe index built by scanning the clusters of files without Cues */
+    int index_threads;
+    MatroskaIndexScanner *scanners;
+    int nb_scanners;
+    MatroskaScanTrack *scan_tracks;
+    int nb_scan_tracks;
+    atomic_int scan_abort;
 } MatroskaDemuxContext;
 
 #define CHILD_OF(parent) { .def = { .n = parent } }
@@ -2038,6 +2078,421 @@ static void matroska_parse_cues(MatroskaDemuxContext *matroska) {
     matroska_add_index_entries(matroska);
 }
 
+#define MIN_SCAN_RANGE (1 << 20)
+
+static const MatroskaScanTrack *index_scan_find_track(const MatroskaDemuxContext *matroska,
+                                                      uint64_t num)
+{
+    for (int i = 0; i < matroska->nb_scan_tracks; i++)
+        if (matroska->scan_tracks[i].num == num)
+            return &matroska->scan_tracks[i];
+    return NULL;
+}
+
+static int index_scan_add(MatroskaIndexScanner *sc, const MatroskaScanTrack *track,
+                          int64_t cluster_pos, uint64_t cluster_time, int16_t block_time)
+{
+    MatroskaScanEntry *entry;
+
+    /* the same entries as added by matroska_parse_block() */
+    if (!track || cluster_time == (uint64_t)-1 ||
+        (block_time < 0 && cluster_time < -block_time))
+        return 0;
+
+    if (sc->nb_entries >= INT_MAX / sizeof(*entry))
+        return AVERROR(ENOMEM);
+    entry = av_fast_realloc(sc->entries, &sc->entries_size,
+                            (sc->nb_entries + 1) * sizeof(*entry));
+    if (!entry)
+        return AVERROR(ENOMEM);
+    sc->entries = entry;
+    entry += sc->nb_entries++;
+
+    entry->pos          = cluster_pos;
+    entry->timestamp    = (uint64_t)((double)cluster_time / track->time_scale) +
+                          block_time - track->codec_delay_in_track_tb;
+    entry->stream_index = track->stream_index;
+    return 0;
+}
+
+/*
+ * Same as ebml_read_num() and ebml_read_length(), without logging: the
+ * scanners run in the background and resync on invalid data.
+ */
+static int index_scan_read_num(AVIOContext *pb, int max_size, uint64_t *number)
+{
+    uint64_t total = avio_r8(pb);
+    int read, n = 1;
+
+    if (avio_feof(pb))
+        return AVERROR_EOF;
+    read = 8 - ff_log2_tab[total];
+    if (!total || read > max_size)
+        return AVERROR_INVALIDDATA;
+
+    total ^= 1 << ff_log2_tab[total];
+    while (n++ < read)
+        total = (total << 8) | avio_r8(pb);
+    if (avio_feof(pb))
+        return AVERROR_EOF;
+
+    *number = total;
+    return read;
+}
+
+static int index_scan_read_length(AVIOContext *pb, uint64_t *number)
+{
+    int res = index_scan_read_num(pb, 8, number);
+    if (res > 0 && *number + 1 == 1ULL << (7 * res))
+        *number = EBML_UNKNOWN_LENGTH;
+    return res;
+}
+
+/* Read the header of a (Simple)Block and skip its payload. */
+static int index_scan_block(MatroskaIndexScanner *sc, uint64_t size,
+                            const MatroskaScanTrack **track,
+                            int16_t *block_time, int *flags)
+{
+    AVIOContext *pb = sc->pb;
+    uint64_t num;
+    int n;
+
+    if ((n = index_scan_read_num(pb, 8, &num)) < 0)
+        return n;
+    if (size < n + 3)
+        return AVERROR_INVALIDDATA;
+    *block_time = avio_rb16(pb);
+    *flags      = avio_r8(pb);
+    *track      = index_scan_find_track(sc->matroska, num);
+    return avio_skip(pb, size - n - 3) < 0 ? AVERROR(EIO) : 0;
+}
+
+static int index_scan_block_group(MatroskaIndexScanner *sc, uint64_t length,
+                                  int64_t cluster_pos, uint64_t cluster_time)
+{
+    AVIOContext *pb = sc->pb;
+    const MatroskaScanTrack *track = NULL;
+    int64_t end = avio_tell(pb) + length;
+    int16_t block_time = 0;
+    int has_block = 0, is_keyframe = 1;
+    int n, flags;
+
+    while (avio_tell(pb) < end) {
+        uint64_t id, size;
+
+        if ((n = index_scan_read_num(pb, 4, &id)) < 0)
+            return n;
+        id |= 1 << 7 * n;
+        if ((n = index_scan_read_length(pb, &size)) < 0)
+            return n;
+        if (size == EBML_UNKNOWN_LENGTH)
+            return AVERROR_INVALIDDATA;
+
+        if (id == MATROSKA_ID_BLOCK && !has_block) {
+            if ((n = index_scan_block(sc, size, &track, &block_time, &flags)) < 0)
+                return n;
+            has_block = 1;
+        } else {
+            if (id == MATROSKA_ID_BLOCKREFERENCE)
+                is_keyframe = 0;
+            if (avio_skip(pb, size) < 0)
+                return AVERROR(EIO);
+        }
+    }
+
+    if (!has_block || !is_keyframe)
+        return 0;
+    return index_scan_add(sc, track, cluster_pos, cluster_time, block_time);
+}
+
+/*
+ * Scan the cluster at cluster_pos without reading the block payloads.
+ * *next is set to the position of the element following the cluster.
+ */
+static int index_scan_cluster(MatroskaIndexScanner *sc, int64_t cluster_pos,
+                              int64_t *next)
+{
+    AVIOContext *pb = sc->pb;
+    uint64_t length, cluster_time = -1;
+    int64_t pos, end;
+    int n;
+
+    if (avio_seek(pb, cluster_pos, SEEK_SET) < 0)
+        return AVERROR(EIO);
+    if (avio_rb32(pb) != MATROSKA_ID_CLUSTER)
+        return avio_feof(pb) ? AVERROR_EOF : AVERROR_INVALIDDATA;
+    if ((n = index_scan_read_length(pb, &length)) < 0)
+        return n;
+    end = length == EBML_UNKNOWN_LENGTH ? INT64_MAX : avio_tell(pb) + length;
+
+    sc->nb_clusters++;
+
+    while ((pos = avio_tell(pb)) < end) {
+        const MatroskaScanTrack *track;
+        uint64_t id, size;
+        int16_t block_time;
+        int flags;
+
+        n = index_scan_read_num(pb, 4, &id);
+        /* the last cluster of unknown length ends with the file */
+        if (n == AVERROR_EOF && length == EBML_UNKNOWN_LENGTH)
+            break;
+        if (n < 0)
+            return n;
+        id |= 1 << 7 * n;
+        /* Clusters of unknown length end at the next level 1 element. */
+        if (length == EBML_UNKNOWN_LENGTH &&
+            (id == MATROSKA_ID_CLUSTER  || id == MATROSKA_ID_CUES     ||
+             id == MATROSKA_ID_TAGS     || id == MATROSKA_ID_CHAPTERS ||
+             id == MATROSKA_ID_SEEKHEAD || id == MATROSKA_ID_ATTACHMENTS ||
+             id == MATROSKA_ID_INFO     || id == MATROSKA_ID_TRACKS))
+            break;
+        if ((n = index_scan_read_length(pb, &size)) < 0)
+            return n;
+        if (size == EBML_UNKNOWN_LENGTH)
+            return AVERROR_INVALIDDATA;
+
+        switch (id) {
+        case MATROSKA_ID_CLUSTERTIMECODE:
+            if (size > 8)
+                return AVERROR_INVALIDDATA;
+            ebml_read_uint(pb, size, 0, &cluster_time);
+            break;
+        case MATROSKA_ID_SIMPLEBLOCK:
+            n = index_scan_block(sc, size, &track, &block_time, &flags);
+            if (n >= 0 && flags & 0x80)
+                n = index_scan_add(sc, track, cluster_pos, cluster_time, block_time);
+            break;
+        case MATROSKA_ID_BLOCKGROUP:
+            n = index_scan_block_group(sc, size, cluster_pos, cluster_time);
+            break;
+        default:
+            n = avio_skip(pb, size) < 0 ? AVERROR(EIO) : 0;
+        }
+        if (n < 0)
+            return n;
+    }
+
+    *next = length == EBML_UNKNOWN_LENGTH ? pos : end;
+    return 0;
+}
+
+/*
+ * Check whether the Cluster ID just read starts a cluster: its timestamp
+ * must come first, possibly after a CRC-32 element.
+ */
+static int index_scan_is_cluster(AVIOContext *pb)
+{
+    int b = avio_r8(pb);
+
+    if (!b)
+        return 0;
+    avio_skip(pb, 7 - ff_log2_tab[b]);
+    b = avio_r8(pb);
+    if (b == EBML_ID_CRC32) {
+        if (avio_r8(pb) != 0x84)
+            return 0;
+        avio_skip(pb, 4);
+        b = avio_r8(pb);
+    }
+    if (b != MATROSKA_ID_CLUSTERTIMECODE)
+        return 0;
+    b = avio_r8(pb);
+    return b >= 0x81 && b <= 0x88 && !avio_feof(pb);
+}
+
+/* Find the first cluster starting in [pos, sc->end). */
+static int64_t index_scan_find_cluster(MatroskaIndexScanner *sc, int64_t pos)
+{
+    AVIOContext *pb = sc->pb;
+    uint32_t id;
+
+    if (avio_seek(pb, pos, SEEK_SET) < 0)
+        return -1;
+    id = avio_rb32(pb);
+    while (!avio_feof(pb) && pos < sc->end) {
+        /* a range without any cluster is read up to its end */
+        if (!(pos & 0xffff) && atomic_load(&sc->matroska->scan_abort))
+            break;
+        if (id == MATROSKA_ID_CLUSTER) {
+            if (index_scan_is_cluster(pb))
+                return pos;
+            if (avio_seek(pb, pos + 4, SEEK_SET) < 0)
+                break;
+        }
+        id = (id << 8) | avio_r8(pb);
+        pos++;
+    }
+    return -1;
+}
+
+static void index_scan(MatroskaIndexScanner *sc)
+{
+    MatroskaDemuxContext *matroska = sc->matroska;
+    int64_t pos = sc->start, size = avio_size(sc->pb), next;
+    int ret;
+
+    /* Only the first range is known to start with a cluster. */
+    if (sc != matroska->scanners)
+        pos = index_scan_find_cluster(sc, pos);
+
+    while (pos >= 0 && pos < sc->end && !atomic_load(&matroska->scan_abort)) {
+        ret = index_scan_cluster(sc, pos, &next);
+        /* A damaged cluster, e.g. with a length making it end past the end
+         * of the file, is skipped by looking for the next one. */
+        if (ret == AVERROR(ENOMEM) || (ret < 0 && pos >= size))
+            break;
+        if (ret < 0)
+            next = index_scan_find_cluster(sc, pos + 1);
+        pos = next;
+    }
+    sc->next_cluster = pos >= 0 ? pos : sc->end;
+}
+
+#if HAVE_THREADS
+static void *index_scan_thread(void *arg)
+{
+    index_scan(arg);
+    return NULL;
+}
+#endif
+
+static void matroska_free_index_scan(MatroskaDemuxContext *matroska)
+{
+    for (int i = 0; i < matroska->nb_scanners; i++) {
+        MatroskaIndexScanner *sc = &matroska->scanners[i];
+
+        ff_format_io_close(matroska->ctx, &sc->pb);
+        av_freep(&sc->entries);
+    }
+    av_freep(&matroska->scanners);
+    av_freep(&matroska->scan_tracks);
+    matroska->nb_scanners = 0;
+}
+
+/*
+ * Build a keyframe index of a file without Cues by scanning its clusters
+ * in byte ranges, each one on its own thread and with its own IO context.
+ * The scan runs in the background until the index is needed.
+ */
+static void matroska_start_index_scan(MatroskaDemuxContext *matroska)
+{
+    AVFormatContext *s = matroska->ctx;
+    MatroskaTrack *tracks = matroska->tracks.elem;
+    int64_t start = ffformatcontext(s)->data_offset;
+    int64_t size = avio_size(s->pb), range;
+    int i, ret, nb_scanners;
+
+    if (!matroska->index_threads ||
+        s->flags & (AVFMT_FLAG_IGNIDX | AVFMT_FLAG_CUSTOM_IO) ||
+        !(s->pb->seekable & AVIO_SEEKABLE_NORMAL) || matroska->index.nb_elem ||
+        !matroska->tracks.nb_elem || start <= 0 || size <= start)
+        return;
+    for (i = 0; i < matroska->num_level1_elems; i++)
+        if (matroska->level1_elems[i].id == MATROSKA_ID_CUES)
+            return;
+
+    matroska->scan_tracks = av_calloc(matroska->tracks.nb_elem,
+                                      sizeof(*matroska->scan_tracks));
+    if (!matroska->scan_tracks)
+        return;
+    for (i = 0; i < matroska->tracks.nb_elem; i++) {
+        MatroskaScanTrack *track = &matroska->scan_tracks[matroska->nb_scan_tracks];
+
+        if (!tracks[i].stream || tracks[i].type == MATROSKA_TRACK_TYPE_SUBTITLE)
+            continue;
+        track->num                     = tracks[i].num;
+        track->stream_index            = tracks[i].stream->index;
+        track->time_scale              = tracks[i].time_scale;
+        track->codec_delay_in_track_tb = tracks[i].codec_delay_in_track_tb;
+        matroska->nb_scan_tracks++;
+    }
+
+    nb_scanners = FFMIN(matroska->index_threads, (size - start) / MIN_SCAN_RANGE + 1);
+    range       = (size - start) / nb_scanners;
+    matroska->scanners = av_calloc(nb_scanners, sizeof(*matroska->scanners));
+    if (!matroska->scanners)
+        goto fail;
+    matroska->nb_scanners = nb_scanners;
+
+    for (i = 0; i < nb_scanners; i++) {
+        MatroskaIndexScanner *sc = &matroska->scanners[i];
+
+        sc->matroska = matroska;
+        sc->start    = start + i * range;
+        sc->end      = i == nb_scanners - 1 ? INT64_MAX : sc->start + range;
+        ret = s->io_open(s, &sc->pb, s->url, AVIO_FLAG_READ, NULL);
+        if (ret < 0) {
+            av_log(s, AV_LOG_WARNING, "Could not open '%s' to build the index: %s\n",
+                   s->url, av_err2str(ret));
+            goto fail;
+        }
+    }
+
+#if HAVE_THREADS
+    /* Scanners whose thread cannot be started run when the index is needed. */
+    for (i = 0; i < nb_scanners; i++) {
+        MatroskaIndexScanner *sc = &matroska->scanners[i];
+        sc->thread_started = !pthread_create(&sc->thread, NULL, index_scan_thread, sc);
+    }
+#endif
+    return;
+fail:
+    matroska_free_index_scan(matroska);
+}
+
+static void matroska_stop_index_scan(MatroskaDemuxContext *matroska)
+{
+    for (int i = 0; i < matroska->nb_scanners; i++) {
+        MatroskaIndexScanner *sc = &matroska->scanners[i];
+#if HAVE_THREADS
+        if (sc->thread_started) {
+            pthread_join(sc->thread, NULL);
+            sc->thread_started = 0;
+            continue;
+        }
+#endif
+        if (!atomic_load(&matroska->scan_abort))
+            index_scan(sc);
+    }
+}
+
+/* Wait for the scan of the clusters and add its result to the index. */
+static void matroska_finish_index_scan(MatroskaDemuxContext *matroska)
+{
+    AVFormatContext *s = matroska->ctx;
+    int64_t scanned = 0;
+    int nb_entries = 0, nb_clusters = 0;
+
+    if (!matroska->nb_scanners)
+        return;
+    matroska_stop_index_scan(matroska);
+
+    for (int i = 0; i < matroska->nb_scanners; i++) {
+        const MatroskaIndexScanner *sc = &matroska->scanners[i];
+
+        for (int j = 0; j < sc->nb_entries; j++) {
+            const MatroskaScanEntry *entry = &sc->entries[j];
+            AVStream *st = s->streams[entry->stream_index];
+
+            /* Drop what a range found before the end of the previous ones,
+             * e.g. after syncing on a false Cluster ID. */
+            if (entry->pos < scanned || st->discard >= AVDISCARD_ALL)
+                continue;
+            ff_reduce_index(s, st->index);
+            av_add_index_entry(st, entry->pos, entry->timestamp, 0, 0,
+                               AVINDEX_KEYFRAME);
+            nb_entries++;
+        }
+        scanned      = FFMAX(scanned, sc->next_cluster);
+        nb_clusters += sc->nb_clusters;
+    }
+    av_log(s, AV_LOG_VERBOSE, "Indexed %d keyframes in %d clusters using %d threads\n",
+           nb_entries, nb_clusters, matroska->nb_scanners);
+
+    matroska_free_index_scan(matroska);
+}
+
 static int matroska_parse_content_encodings(MatroskaTrackEncoding *encodings,
                                             unsigned nb_encodings,
                                             MatroskaTrack *track,
@@ -3456,6 +3911,7 @@ static int matroska_read_header(AVFormatContext *s)
         }
 
     matroska_add_index_entries(matroska);
+    matroska_start_index_scan(matroska);
 
     matroska_convert_tags(s);
 
@@ -4340,6 +4796,7 @@ static int matroska_read_seek(AVFormatContext *s, int stream_index,
         matroska->cues_parsing_deferred = 0;
         matroska_parse_cues(matroska);
     }
+    matroska_finish_index_scan(matroska);
 
     if (!sti->nb_index_entries)
         goto err;
@@ -4400,6 +4857,10 @@ static int matroska_read_close(AVFormatContext *s)
     MatroskaTrack *tracks = matroska->tracks.elem;
     int n;
 
+    atomic_store(&matroska->scan_abort, 1);
+    matroska_stop_index_scan(matroska);
+    matroska_free_index_scan(matroska);
+
     matroska_clear_queue(matroska);
 
     for (n = 0; n < matroska->tracks.nb_elem; n++)
@@ -4410,6 +4871,8 @@ static int matroska_read_close(AVFormatContext *s)
     return 0;
 }
 
+#define OFFSET(x) offsetof(MatroskaDemuxContext, x)
+
 #if CONFIG_WEBM_DASH_MANIFEST_DEMUXER
 typedef struct {
     int64_t start_time_ns;
@@ -4829,7 +5292,6 @@ static int webm_dash_manifest_read_packet(AVFormatContext *s, AVPacket *pkt)
     return AVERROR_EOF;
 }
 
-#define OFFSET(x) offsetof(MatroskaDemuxContext, x)
 static const AVOption options[] = {
     { "live", "flag indicating that the input is a live file that only has the headers.", OFFSET(is_live), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { "bandwidth", "bandwidth of this stream to be specified in the DASH manifest.", OFFSET(bandwidth), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_DECODING_PARAM },
@@ -4855,11 +5317,24 @@ const FFInputFormat ff_webm_dash_manifest_demuxer = {
 };
 #endif
 
+static const AVOption matroska_options[] = {
+    { "index_threads", "Number of threads building a keyframe index of files without Cues", OFFSET(index_threads), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_DECODING_PARAM },
+    { NULL },
+};
+
+static const AVClass matroska_class = {
+    .class_name = "matroska,webm demuxer",
+    .item_name  = av_default_item_name,
+    .option     = matroska_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 const FFInputFormat ff_matroska_demuxer = {
     .p.name         = "matroska,webm",
     .p.long_name    = NULL_IF_CONFIG_SMALL("Matroska / WebM"),
     .p.extensions   = "mkv,mk3d,mka,mks,webm",
     .p.mime_type    = "audio/webm,audio/x-matroska,video/webm,video/x-matroska",
+    .p.priv_class   = &matroska_class,
     .priv_data_size = sizeof(MatroskaDemuxContext),
     .flags_internal = FF_INFMT_FLAG_INIT_CLEANUP,
     .read_probe     = matroska_probe,
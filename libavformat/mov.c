@@ -4694,17 +4694,190 @@ static int mov_merge_tts_data(MOVContext *mov, AVStream *st, int flags)
     return 0;
 }
 
+#define MOV_LAZY_INDEX_BATCH 1024
+
+/**
+ * Walk the sample tables from sc->index_cursor, appending index entries
+ * until the index holds nb_entries entries or all samples have been added.
+ * The index must have room for the entries.
+ *
+ * @return 1 if stopped early, 0 once all samples have been added,
+ *         a negative error code on invalid sample tables
+ */
+static int mov_add_index_entries(MOVContext *mov, AVStream *st, unsigned int nb_entries)
+{
+    MOVStreamContext *sc = st->priv_data;
+    FFStream *const sti = ffstream(st);
+    MOVIndexCursor *c = &sc->index_cursor;
+    int rap_group_present = sc->rap_group_count && sc->rap_group;
+
+    for (; c->chunk < sc->chunk_count; c->chunk++, c->chunk_sample = 0) {
+        if (!c->chunk_sample) {
+            int64_t next_offset = c->chunk + 1 < sc->chunk_count ? sc->chunk_offsets[c->chunk + 1] : INT64_MAX;
+            c->offset = sc->chunk_offsets[c->chunk];
+            while (mov_stsc_index_valid(c->stsc_index, sc->stsc_count) &&
+                c->chunk + 1 == sc->stsc_data[c->stsc_index + 1].first)
+                c->stsc_index++;
+
+            if (next_offset > c->offset && sc->sample_size>0 && sc->sample_size < sc->stsz_sample_size &&
+                sc->stsc_data[c->stsc_index].count * (int64_t)sc->stsz_sample_size > next_offset - c->offset) {
+                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too large), ignoring\n", sc->stsz_sample_size);
+                sc->stsz_sample_size = sc->sample_size;
+            }
+            if (sc->stsz_sample_size>0 && sc->stsz_sample_size < sc->sample_size) {
+                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too small), ignoring\n", sc->stsz_sample_size);
+                sc->stsz_sample_size = sc->sample_size;
+            }
+        }
+
+        for (; c->chunk_sample < sc->stsc_data[c->stsc_index].count; c->chunk_sample++) {
+            unsigned int sample_size;
+            int keyframe = 0;
+
+            if (sti->nb_index_entries >= nb_entries)
+                return 1;
+            if (c->sample >= sc->sample_count) {
+                av_log(mov->fc, AV_LOG_ERROR, "wrong sample count\n");
+                return AVERROR_INVALIDDATA;
+            }
+
+            if (!sc->keyframe_absent && (!sc->keyframe_count || c->sample+c->key_off == sc->keyframes[c->stss_index])) {
+                keyframe = 1;
+                if (c->stss_index + 1 < sc->keyframe_count)
+                    c->stss_index++;
+            } else if (sc->stps_count && c->sample+c->key_off == sc->stps_data[c->stps_index]) {
+                keyframe = 1;
+                if (c->stps_index + 1 < sc->stps_count)
+                    c->stps_index++;
+            }
+            if (rap_group_present && c->rap_group_index < sc->rap_group_count) {
+                if (sc->rap_group[c->rap_group_index].index > 0)
+                    keyframe = 1;
+                if (++c->rap_group_sample == sc->rap_group[c->rap_group_index].count) {
+                    c->rap_group_sample = 0;
+                    c->rap_group_index++;
+                }
+            }
+            if (sc->keyframe_absent
+                && !sc->stps_count
+                && !rap_group_present
+                && (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || (c->chunk==0 && c->chunk_sample==0)))
+                 keyframe = 1;
+            if (keyframe)
+                c->distance = 0;
+            sample_size = sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[c->sample];
+            if (c->offset > INT64_MAX - sample_size) {
+                av_log(mov->fc, AV_LOG_ERROR, "Current offset %"PRId64" or sample size %u is too large\n",
+                       c->offset,
+                       sample_size);
+                return AVERROR_INVALIDDATA;
+            }
+
+            if (sc->pseudo_stream_id == -1 ||
+               sc->stsc_data[c->stsc_index].id - 1 == sc->pseudo_stream_id) {
+                AVIndexEntry *e;
+                if (sample_size > 0x3FFFFFFF) {
+                    av_log(mov->fc, AV_LOG_ERROR, "Sample size %u is too large\n", sample_size);
+                    return AVERROR_INVALIDDATA;
+                }
+                e = &sti->index_entries[sti->nb_index_entries++];
+                e->pos = c->offset;
+                e->timestamp = c->dts;
+                e->size = sample_size;
+                e->min_distance = c->distance;
+                e->flags = keyframe ? AVINDEX_KEYFRAME : 0;
+                av_log(mov->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %u, offset %"PRIx64", dts %"PRId64", "
+                        "size %u, distance %u, keyframe %d\n", st->index, c->sample,
+                        c->offset, c->dts, sample_size, c->distance, keyframe);
+                if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && sti->nb_index_entries < 100)
+                    ff_rfps_add_frame(mov->fc, st, c->dts);
+            }
+
+            c->offset += sample_size;
+            c->stream_size += sample_size;
+
+            c->dts += sc->tts_data[c->stts_index].duration;
+
+            c->distance++;
+            c->stts_sample++;
+            c->sample++;
+            if (c->stts_index + 1 < sc->tts_count && c->stts_sample == sc->tts_data[c->stts_index].count) {
+                c->stts_sample = 0;
+                c->stts_index++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Check whether the index of a track can be built on demand. Edit lists
+ * applied by mov_fix_index() and the other users of the complete index
+ * need it at open time.
+ */
+static int mov_can_index_lazily(const MOVContext *mov, const AVStream *st)
+{
+    const MOVStreamContext *sc = st->priv_data;
+
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+        st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+        return 0;
+    if (sc->elst_count && !mov->ignore_editlist && mov->advanced_editlist)
+        return 0;
+    return !sc->iamf && !sc->dv_audio_container;
+}
+
+/**
+ * Extend a lazily built index to at least nb_entries entries, or to all
+ * of the samples of the track.
+ */
+static void mov_extend_index(MOVContext *mov, AVStream *st, unsigned int nb_entries)
+{
+    MOVStreamContext *sc = st->priv_data;
+    FFStream *const sti = ffstream(st);
+    unsigned int allocated = sti->index_entries_allocated_size / sizeof(*sti->index_entries);
+
+    if (!sc->lazy_index || sti->nb_index_entries >= nb_entries)
+        return;
+
+    /* Add entries in batches, and grow the array geometrically so that
+     * seeking far into a long track does not copy the index repeatedly. */
+    nb_entries = FFMIN(FFMAX(nb_entries, sti->nb_index_entries + MOV_LAZY_INDEX_BATCH),
+                       sc->sample_count);
+    if (nb_entries > allocated) {
+        unsigned int size = FFMIN(FFMAX(nb_entries, 2 * allocated), sc->sample_count);
+        if (av_reallocp_array(&sti->index_entries, size, sizeof(*sti->index_entries)) < 0) {
+            sti->nb_index_entries = 0;
+            sti->index_entries_allocated_size = 0;
+            sc->lazy_index = 0;
+            return;
+        }
+        sti->index_entries_allocated_size = size * sizeof(*sti->index_entries);
+    }
+
+    if (mov_add_index_entries(mov, st, nb_entries) <= 0)
+        sc->lazy_index = 0;
+}
+
+static void mov_extend_index_to_timestamp(MOVContext *mov, AVStream *st, int64_t timestamp)
+{
+    MOVStreamContext *sc = st->priv_data;
+    FFStream *const sti = ffstream(st);
+
+    while (sc->lazy_index && (!sti->nb_index_entries ||
+           sti->index_entries[sti->nb_index_entries - 1].timestamp <= timestamp))
+        mov_extend_index(mov, st, sti->nb_index_entries + 1);
+}
+
 static void mov_build_index(MOVContext *mov, AVStream *st)
 {
     MOVStreamContext *sc = st->priv_data;
     FFStream *const sti = ffstream(st);
     int64_t current_offset;
     int64_t current_dts = 0;
-    unsigned int stts_index = 0;
     unsigned int stsc_index = 0;
-    unsigned int stss_index = 0;
-    unsigned int stps_index = 0;
-    unsigned int i, j;
+    unsigned int i;
     uint64_t stream_size = 0;
 
     int ret = build_open_gop_key_points(st);
@@ -4762,122 +4935,43 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     /* only use old uncompressed audio chunk demuxing when stts specifies it */
     if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
           sc->stts_count == 1 && sc->stts_data && sc->stts_data[0].duration == 1)) {
-        unsigned int current_sample = 0;
-        unsigned int stts_sample = 0;
-        unsigned int sample_size;
-        unsigned int distance = 0;
-        unsigned int rap_group_index = 0;
-        unsigned int rap_group_sample = 0;
-        int rap_group_present = sc->rap_group_count && sc->rap_group;
-        int key_off = (sc->keyframe_count && sc->keyframes[0] > 0) || (sc->stps_count && sc->stps_data[0] > 0);
-
         current_dts -= sc->dts_shift;
 
         if (!sc->sample_count || sti->nb_index_entries || sc->tts_count)
             return;
         if (sc->sample_count >= UINT_MAX / sizeof(*sti->index_entries) - sti->nb_index_entries)
             return;
-        if (av_reallocp_array(&sti->index_entries,
-                              sti->nb_index_entries + sc->sample_count,
-                              sizeof(*sti->index_entries)) < 0) {
-            sti->nb_index_entries = 0;
-            return;
-        }
-        sti->index_entries_allocated_size = (sti->nb_index_entries + sc->sample_count) * sizeof(*sti->index_entries);
 
         ret = mov_merge_tts_data(mov, st, MOV_MERGE_CTTS | MOV_MERGE_STTS);
         if (ret < 0)
             return;
 
-        for (i = 0; i < sc->chunk_count; i++) {
-            int64_t next_offset = i+1 < sc->chunk_count ? sc->chunk_offsets[i+1] : INT64_MAX;
-            current_offset = sc->chunk_offsets[i];
-            while (mov_stsc_index_valid(stsc_index, sc->stsc_count) &&
-                i + 1 == sc->stsc_data[stsc_index + 1].first)
-                stsc_index++;
-
-            if (next_offset > current_offset && sc->sample_size>0 && sc->sample_size < sc->stsz_sample_size &&
-                sc->stsc_data[stsc_index].count * (int64_t)sc->stsz_sample_size > next_offset - current_offset) {
-                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too large), ignoring\n", sc->stsz_sample_size);
-                sc->stsz_sample_size = sc->sample_size;
-            }
-            if (sc->stsz_sample_size>0 && sc->stsz_sample_size < sc->sample_size) {
-                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too small), ignoring\n", sc->stsz_sample_size);
-                sc->stsz_sample_size = sc->sample_size;
+        sc->index_cursor = (MOVIndexCursor) {
+            .dts     = current_dts,
+            .key_off = (sc->keyframe_count && sc->keyframes[0] > 0) ||
+                       (sc->stps_count && sc->stps_data[0] > 0),
+        };
+
+        if (mov->lazy_index && mov_can_index_lazily(mov, st)) {
+            sc->lazy_index = 1;
+            mov_extend_index(mov, st, MOV_LAZY_INDEX_BATCH);
+            if (sc->stsz_sample_size > 0)
+                stream_size = (uint64_t)sc->stsz_sample_size * sc->sample_count;
+            else if (sc->sample_sizes)
+                for (i = 0; i < sc->sample_count; i++)
+                    stream_size += sc->sample_sizes[i];
+        } else {
+            if (av_reallocp_array(&sti->index_entries,
+                                  sti->nb_index_entries + sc->sample_count,
+                                  sizeof(*sti->index_entries)) < 0) {
+                sti->nb_index_entries = 0;
+                return;
             }
+            sti->index_entries_allocated_size = (sti->nb_index_entries + sc->sample_count) * sizeof(*sti->index_entries);
 
-            for (j = 0; j < sc->stsc_data[stsc_index].count; j++) {
-                int keyframe = 0;
-                if (current_sample >= sc->sample_count) {
-                    av_log(mov->fc, AV_LOG_ERROR, "wrong sample count\n");
-                    return;
-                }
-
-                if (!sc->keyframe_absent && (!sc->keyframe_count || current_sample+key_off == sc->keyframes[stss_index])) {
-                    keyframe = 1;
-                    if (stss_index + 1 < sc->keyframe_count)
-                        stss_index++;
-                } else if (sc->stps_count && current_sample+key_off == sc->stps_data[stps_index]) {
-                    keyframe = 1;
-                    if (stps_index + 1 < sc->stps_count)
-                        stps_index++;
-                }
-                if (rap_group_present && rap_group_index < sc->rap_group_count) {
-                    if (sc->rap_group[rap_group_index].index > 0)
-                        keyframe = 1;
-                    if (++rap_group_sample == sc->rap_group[rap_group_index].count) {
-                        rap_group_sample = 0;
-                        rap_group_index++;
-                    }
-                }
-                if (sc->keyframe_absent
-                    && !sc->stps_count
-                    && !rap_group_present
-                    && (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || (i==0 && j==0)))
-                     keyframe = 1;
-                if (keyframe)
-                    distance = 0;
-                sample_size = sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[current_sample];
-                if (current_offset > INT64_MAX - sample_size) {
-                    av_log(mov->fc, AV_LOG_ERROR, "Current offset %"PRId64" or sample size %u is too large\n",
-                           current_offset,
-                           sample_size);
-                    return;
-                }
-
-                if (sc->pseudo_stream_id == -1 ||
-                   sc->stsc_data[stsc_index].id - 1 == sc->pseudo_stream_id) {
-                    AVIndexEntry *e;
-                    if (sample_size > 0x3FFFFFFF) {
-                        av_log(mov->fc, AV_LOG_ERROR, "Sample size %u is too large\n", sample_size);
-                        return;
-                    }
-                    e = &sti->index_entries[sti->nb_index_entries++];
-                    e->pos = current_offset;
-                    e->timestamp = current_dts;
-                    e->size = sample_size;
-                    e->min_distance = distance;
-                    e->flags = keyframe ? AVINDEX_KEYFRAME : 0;
-                    av_log(mov->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %u, offset %"PRIx64", dts %"PRId64", "
-                            "size %u, distance %u, keyframe %d\n", st->index, current_sample,
-                            current_offset, current_dts, sample_size, distance, keyframe);
-                    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && sti->nb_index_entries < 100)
-                        ff_rfps_add_frame(mov->fc, st, current_dts);
-                }
-
-                current_offset += sample_size;
-                stream_size += sample_size;
-
-                current_dts += sc->tts_data[stts_index].duration;
-
-                distance++;
-                stts_sample++;
-                current_sample++;
-                if (stts_index + 1 < sc->tts_count && stts_sample == sc->tts_data[stts_index].count) {
-                    stts_sample = 0;
-                    stts_index++;
-                }
-            }
+            if (mov_add_index_entries(mov, st, UINT_MAX) < 0)
+                return;
+            stream_size = sc->index_cursor.stream_size;
         }
         if (st->duration > 0)
             st->codecpar->bit_rate = stream_size*8*sc->time_scale/st->duration;
@@ -5319,13 +5413,15 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         if (!stts_constant)
             ffstream(st)->need_parsing = AVSTREAM_PARSE_FULL;
     }
-    /* Do not need those anymore. */
-    av_freep(&sc->chunk_offsets);
-    av_freep(&sc->sample_sizes);
-    av_freep(&sc->keyframes);
-    av_freep(&sc->stps_data);
+    /* Do not need those anymore, unless the index is built lazily. */
+    if (!sc->lazy_index) {
+        av_freep(&sc->chunk_offsets);
+        av_freep(&sc->sample_sizes);
+        av_freep(&sc->keyframes);
+        av_freep(&sc->stps_data);
+        av_freep(&sc->rap_group);
+    }
     av_freep(&sc->elst_data);
-    av_freep(&sc->rap_group);
     av_freep(&sc->sync_group);
     av_freep(&sc->sgpd_sync);
 
@@ -5831,6 +5927,9 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     if (sc->pseudo_stream_id+1 != frag->stsd_id && sc->pseudo_stream_id != -1)
         return 0;
 
+    // Fragment samples go after the ones from the sample tables.
+    mov_extend_index(c, st, UINT_MAX);
+
     // Find the next frag_index index that has a valid index_entry for
     // the current track_id.
     //
@@ -11024,6 +11123,8 @@ static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
         AVStream *avst = s->streams[i];
         FFStream *const avsti = ffstream(avst);
         MOVStreamContext *msc = avst->priv_data;
+        /* the entry after the current one is needed for its duration */
+        mov_extend_index(mov, avst, msc->current_sample + 2);
         if (msc->pb && msc->current_sample < avsti->nb_index_entries) {
             AVIndexEntry *current_sample = &avsti->index_entries[msc->current_sample];
             int64_t dts = av_rescale(current_sample->timestamp, AV_TIME_BASE, msc->time_scale);
@@ -11278,6 +11379,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             msc->tts_index = 0;
 
             // Discard current index entries
+            msc->lazy_index = 0;
             avsti = ffstream(avst);
             if (avsti->index_entries_allocated_size > 0) {
                 av_freep(&avsti->index_entries);
@@ -11355,7 +11457,9 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
         else if (st->codecpar->codec_id == AV_CODEC_ID_APV && sample->size > 4) {
             const uint32_t au_size = avio_rb32(sc->pb);
             ret = av_get_packet(sc->pb, pkt, au_size);
-        } else
+        } else if (!mov->aax_mode && !mov->decryption_key)
+            ret = ff_get_packet_ref(sc->pb, pkt, sample->size, st->codecpar);
+        else
             ret = av_get_packet(sc->pb, pkt, sample->size);
         if (ret < 0) {
             if (should_retry(sc->pb, ret)) {
@@ -11483,6 +11587,8 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     // can search over the DTS timeline.
     timestamp -= (sc->min_corrected_pts + sc->dts_shift);
 
+    mov_extend_index_to_timestamp(s->priv_data, st, timestamp);
+
     ret = mov_seek_fragment(s, st, timestamp);
     if (ret < 0)
         return ret;
@@ -11668,6 +11774,7 @@ static const AVOption mov_options[] = {
         {.i64 = 0}, 0, 1, FLAGS },
     { "max_stts_delta", "treat offsets above this value as invalid", OFFSET(max_stts_delta), AV_OPT_TYPE_INT, {.i64 = UINT_MAX-48000*10 }, 0, UINT_MAX, .flags = AV_OPT_FLAG_DECODING_PARAM },
     { "interleaved_read", "Interleave packets from multiple tracks at demuxer level", OFFSET(interleaved_read), AV_OPT_TYPE_BOOL, {.i64 = 1 }, 0, 1, .flags = AV_OPT_FLAG_DECODING_PARAM },
+    { "lazy_index", "Build the index of audio and video tracks while reading instead of at open", OFFSET(lazy_index), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, .flags = AV_OPT_FLAG_DECODING_PARAM },
 
     { NULL },
 };
@@ -39,6 +39,7 @@
 #include "evc.h"
 #include "apv.h"
 #include "libavcodec/ac3_parser_internal.h"
+#include "libavcodec/codec_desc.h"
 #include "libavcodec/dnxhddata.h"
 #include "libavcodec/flac.h"
 #include "libavcodec/get_bits.h"
@@ -58,6 +59,7 @@
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/slicethread.h"
 #include "libavutil/stereo3d.h"
 #include "libavutil/timecode.h"
 #include "libavutil/dovi_meta.h"
@@ -81,6 +83,7 @@ static const AVOption options[] = {
     { "encryption_kid", "The media encryption key identifier (hex)", offsetof(MOVMuxContext, encryption_kid), AV_OPT_TYPE_BINARY, .flags = AV_OPT_FLAG_ENCODING_PARAM },
     { "encryption_scheme",    "Configures the encryption scheme, allowed values are none, cenc-aes-ctr", offsetof(MOVMuxContext, encryption_scheme_str),   AV_OPT_TYPE_STRING, {.str = NULL}, .flags = AV_OPT_FLAG_ENCODING_PARAM },
     { "frag_duration", "Maximum fragment duration", offsetof(MOVMuxContext, max_fragment_duration), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
+    { "frag_threads", "Number of threads encrypting the fragments", offsetof(MOVMuxContext, frag_threads), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "frag_interleave", "Interleave samples within fragments (max number of consecutive samples, lower is tighter interleaving, but with more overhead)", offsetof(MOVMuxContext, frag_interleave), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "frag_size", "Maximum fragment size", offsetof(MOVMuxContext, max_fragment_size), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
     { "fragment_index", "Fragment number of the next fragment", offsetof(MOVMuxContext, fragments), AV_OPT_TYPE_INT, {.i64 = 1}, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
@@ -105,6 +108,7 @@ static const AVOption options[] = {
       { "negative_cts_offsets", "Use negative CTS offsets (reducing the need for edit lists)", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_NEGATIVE_CTS_OFFSETS}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
       { "omit_tfhd_offset", "Omit the base data offset in tfhd atoms", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_OMIT_TFHD_OFFSET}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
       { "prefer_icc", "If writing colr atom prioritise usage of ICC profile if it exists in stream packet side data", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_PREFER_ICC}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
+      { "reserve_moov", "Reserve space for the moov atom at the beginning of the file, predicting its size from the stream durations", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_RESERVE_MOOV}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
       { "rtphint", "Add RTP hint tracks", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_RTP_HINT}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
       { "separate_moof", "Write separate moof/mdat atoms for each track", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_SEPARATE_MOOF}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
       { "skip_sidx", "Skip writing of sidx atom", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_SKIP_SIDX}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, .unit = "movflags" },
@@ -6374,6 +6378,73 @@ static void mov_parse_truehd_frame(AVPacket *pkt, MOVTrack *trk)
     return;
 }
 
+static void encrypt_fragment_job(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    MOVMuxContext *mov = priv;
+    const MOVFragmentJob *job = &mov->frag_jobs[jobnr];
+
+    ff_mov_cenc_encrypt_ranges(&job->track->cenc, mov->frag_aes_ctr[threadnr],
+                               job->buf, job->first, job->last);
+}
+
+/*
+ * Encrypt the samples buffered for the fragment with the frag_threads pool.
+ * The samples of each track are split into jobs of whole samples, so that
+ * a single video track is also encrypted in parallel.
+ */
+static int encrypt_fragment(MOVMuxContext *mov)
+{
+    int64_t total = 0, target, size;
+    int i, j, first, nb_jobs = 0;
+
+    for (i = 0; i < mov->nb_tracks; i++)
+        for (j = 0; j < mov->tracks[i].cenc.nb_ranges; j++)
+            total += mov->tracks[i].cenc.ranges[j].size;
+    if (!total)
+        return 0;
+    target = total / (2 * mov->nb_frag_threads) + 1;
+
+    for (i = 0; i < mov->nb_tracks; i++) {
+        MOVTrack *track = &mov->tracks[i];
+        const MOVMuxCencRange *ranges = track->cenc.ranges;
+        uint8_t *buf;
+
+        if (!track->cenc.nb_ranges)
+            continue;
+        /* interleaved samples have been moved to the common buffer */
+        avio_get_dyn_buf(mov->frag_interleave ? mov->mdat_buf : track->mdat_buf, &buf);
+        first = 0;
+        size  = 0;
+        for (j = 0; j <= track->cenc.nb_ranges; j++) {
+            MOVFragmentJob *job;
+
+            if (j < track->cenc.nb_ranges &&
+                (size < target || !memcmp(ranges[j].iv, ranges[j - 1].iv, AES_CTR_IV_SIZE))) {
+                size += ranges[j].size;
+                continue;
+            }
+            job = av_fast_realloc(mov->frag_jobs, &mov->frag_jobs_size,
+                                  (nb_jobs + 1) * sizeof(*job));
+            if (!job)
+                return AVERROR(ENOMEM);
+            mov->frag_jobs = job;
+            job += nb_jobs++;
+            job->track = track;
+            job->buf   = buf;
+            job->first = first;
+            job->last  = j;
+            first = j;
+            size  = j < track->cenc.nb_ranges ? ranges[j].size : 0;
+        }
+    }
+
+    avpriv_slicethread_execute(mov->frag_thread, nb_jobs, 0);
+
+    for (i = 0; i < mov->nb_tracks; i++)
+        mov->tracks[i].cenc.nb_ranges = mov->tracks[i].cenc.nb_moved_ranges = 0;
+    return 0;
+}
+
 static int mov_flush_fragment_interleaving(AVFormatContext *s, MOVTrack *track)
 {
     MOVMuxContext *mov = s->priv_data;
@@ -6390,6 +6461,7 @@ static int mov_flush_fragment_interleaving(AVFormatContext *s, MOVTrack *track)
     buf_size = avio_get_dyn_buf(track->mdat_buf, &buf);
 
     offset = avio_tell(mov->mdat_buf);
+    ff_mov_cenc_move_ranges(&track->cenc, offset);
     avio_write(mov->mdat_buf, buf, buf_size);
     ffio_reset_dyn_buf(track->mdat_buf);
 
@@ -6647,6 +6719,9 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
     if (!mdat_size)
         return 0;
 
+    if (mov->frag_thread && (ret = encrypt_fragment(mov)) < 0)
+        return ret;
+
     avio_write_marker(s->pb,
                       av_rescale(mov->tracks[first_track].cluster[0].dts, AV_TIME_BASE, mov->tracks[first_track].timescale),
                       (has_video ? starts_with_key : mov->tracks[first_track].cluster[0].flags & MOV_SYNC_SAMPLE) ? AVIO_DATA_MARKER_SYNC_POINT : AVIO_DATA_MARKER_BOUNDARY_POINT);
@@ -6791,6 +6866,8 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
             if (!trk->mdat_buf) {
                 if ((ret = avio_open_dyn_buf(&trk->mdat_buf)) < 0)
                     return ret;
+                if (mov->frag_thread)
+                    trk->cenc.deferred_pb = trk->mdat_buf;
             }
             pb = trk->mdat_buf;
         } else {
@@ -7710,6 +7787,12 @@ static void mov_free(AVFormatContext *s)
     for (int i = 0; i < s->nb_streams; i++)
         s->streams[i]->priv_data = NULL;
 
+    avpriv_slicethread_free(&mov->frag_thread);
+    for (int i = 0; i < mov->nb_frag_threads; i++)
+        av_aes_ctr_free(mov->frag_aes_ctr[i]);
+    av_freep(&mov->frag_aes_ctr);
+    av_freep(&mov->frag_jobs);
+
     if (!mov->tracks)
         return;
 
@@ -7741,6 +7824,7 @@ static void mov_free(AVFormatContext *s)
 
         ff_mov_cenc_free(&track->cenc);
         ffio_free_dyn_buf(&track->mdat_buf);
+        track->cenc.deferred_pb = NULL;
 
 #if CONFIG_IAMFENC
         ffio_free_dyn_buf(&track->iamf_buf);
@@ -7970,7 +8054,17 @@ static int mov_init(AVFormatContext *s)
         mov->flags &= ~FF_MOV_FLAG_SKIP_SIDX;
     }
 
-    if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+    if (mov->flags & FF_MOV_FLAG_RESERVE_MOOV) {
+        if (mov->flags & FF_MOV_FLAG_FRAGMENT || mov->mode == MODE_AVIF) {
+            av_log(s, AV_LOG_WARNING, "reserve_moov is not supported with fragmented output, ignoring\n");
+            mov->flags &= ~FF_MOV_FLAG_RESERVE_MOOV;
+        } else {
+            mov->flags |= FF_MOV_FLAG_FASTSTART;
+        }
+    }
+
+    if (mov->flags & FF_MOV_FLAG_FASTSTART &&
+        !(mov->flags & FF_MOV_FLAG_RESERVE_MOOV)) {
         mov->reserved_moov_size = -1;
     }
 
@@ -8378,10 +8472,111 @@ static int mov_init(AVFormatContext *s)
         }
     }
 
+    if (mov->frag_threads && mov->encryption_scheme == MOV_ENC_CENC_AES_CTR &&
+        mov->flags & FF_MOV_FLAG_FRAGMENT) {
+        ret = avpriv_slicethread_create(&mov->frag_thread, mov, encrypt_fragment_job,
+                                        NULL, mov->frag_threads);
+        if (ret == AVERROR(ENOSYS)) {
+            av_log(s, AV_LOG_WARNING, "Threads not available, encrypting in the muxer thread\n");
+        } else if (ret < 0) {
+            return ret;
+        } else {
+            int nb_threads = ret;
+            mov->frag_aes_ctr = av_calloc(nb_threads, sizeof(*mov->frag_aes_ctr));
+            if (!mov->frag_aes_ctr)
+                return AVERROR(ENOMEM);
+            for (i = 0; i < nb_threads; i++) {
+                mov->frag_aes_ctr[i] = av_aes_ctr_alloc();
+                if (!mov->frag_aes_ctr[i])
+                    return AVERROR(ENOMEM);
+                mov->nb_frag_threads++;
+                if ((ret = av_aes_ctr_init(mov->frag_aes_ctr[i], mov->encryption_key)) < 0)
+                    return ret;
+            }
+        }
+    }
+
     enable_tracks(s);
     return 0;
 }
 
+static int64_t metadata_size(const AVDictionary *m)
+{
+    const AVDictionaryEntry *t = NULL;
+    int64_t size = 0;
+
+    while (t = av_dict_iterate(m, t))
+        size += strlen(t->key) + strlen(t->value) + 32;
+    return size;
+}
+
+/*
+ * Estimate the moov atom size, for the reserve_moov flag.
+ * The number of samples of each track is estimated from the duration hint
+ * of its stream; the sample tables are assumed to need one entry per sample
+ * (stsz, co64, stsc, and ctts for video with reordering). This is not a
+ * bound: the duration hints may be wrong and the entries larger, in which
+ * case write_reserved_moov() moves the mdat by the missing bytes.
+ * Returns -1 if the streams do not provide enough information.
+ */
+static int64_t estimate_moov_size(AVFormatContext *s)
+{
+    MOVMuxContext *mov = s->priv_data;
+    int64_t size = 1024 + metadata_size(s->metadata) + 64 * s->nb_chapters;
+
+    if (mov->flags & FF_MOV_FLAG_RTP_HINT)
+        return -1;
+
+    for (int i = 0; i < mov->nb_tracks; i++) {
+        MOVTrack *track = &mov->tracks[i];
+        const AVCodecParameters *par = track->par;
+        const AVStream *st = i < mov->nb_streams ? track->st : NULL;
+        const AVCodecDescriptor *desc;
+        int64_t nb_samples = 1, sample_size = 24;
+        double duration;
+
+        size += 1024 + par->extradata_size;
+        if (!st)
+            continue;
+        size += metadata_size(st->metadata);
+        if (st->disposition & AV_DISPOSITION_ATTACHED_PIC)
+            continue;
+        if (st->duration <= 0 || st->time_base.num <= 0 || st->time_base.den <= 0)
+            return -1;
+        duration = st->duration * av_q2d(st->time_base);
+
+        switch (par->codec_type) {
+        case AVMEDIA_TYPE_VIDEO: {
+            AVRational rate = st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0 ?
+                              st->avg_frame_rate : st->r_frame_rate;
+            if (rate.num <= 0 || rate.den <= 0)
+                return -1;
+            nb_samples = duration * av_q2d(rate) + 1;
+            desc = avcodec_descriptor_get(par->codec_id);
+            /* stss and stts entries, and ctts */
+            if (!desc || !(desc->props & AV_CODEC_PROP_INTRA_ONLY))
+                sample_size += 1 + 8;
+            break;
+        }
+        case AVMEDIA_TYPE_AUDIO:
+            if (par->sample_rate <= 0)
+                return -1;
+            nb_samples = duration * par->sample_rate /
+                         (par->frame_size > 0 ? par->frame_size : 1024) + 1;
+            break;
+        default:
+            /* subtitles and data: irregular durations, one stts entry per sample */
+            nb_samples   = 2 * duration + 1;
+            sample_size += 8;
+            break;
+        }
+        size += nb_samples * sample_size;
+        if (size > INT_MAX)
+            return -1;
+    }
+    return size;
+}
+
 static int mov_write_header(AVFormatContext *s)
 {
     AVIOContext *pb = s->pb;
@@ -8466,6 +8661,19 @@ static int mov_write_header(AVFormatContext *s)
             return ret;
     }
 
+    if (mov->flags & FF_MOV_FLAG_RESERVE_MOOV && !mov->reserved_moov_size) {
+        int64_t size = estimate_moov_size(s);
+        if (size < 0) {
+            av_log(s, AV_LOG_WARNING, "Cannot predict the moov atom size without stream durations, "
+                   "falling back to a second pass\n");
+            mov->flags &= ~FF_MOV_FLAG_RESERVE_MOOV;
+            mov->reserved_moov_size = -1;
+        } else {
+            av_log(s, AV_LOG_VERBOSE, "Reserving %"PRId64" bytes for the moov atom\n", size);
+            mov->reserved_moov_size = size;
+        }
+    }
+
     if (mov->reserved_moov_size){
         mov->reserved_header_pos = avio_tell(pb);
         if (mov->reserved_moov_size > 0)
@@ -8499,7 +8707,8 @@ static int mov_write_header(AVFormatContext *s)
             update_size(pb, mov->mdat_pos);
         }
     } else if (mov->mode != MODE_AVIF) {
-        if (mov->flags & FF_MOV_FLAG_FASTSTART)
+        if (mov->flags & FF_MOV_FLAG_FASTSTART &&
+            !(mov->flags & FF_MOV_FLAG_RESERVE_MOOV))
             mov->reserved_header_pos = avio_tell(pb);
         mov_write_mdat_tag(pb, mov);
     }
@@ -8648,6 +8857,61 @@ static int shift_data(AVFormatContext *s)
     return ff_format_shift_data(s, mov->reserved_header_pos, moov_size);
 }
 
+/*
+ * Write the moov atom to the space reserved for it with the reserve_moov
+ * flag. If the moov atom does not fit, the mdat is moved just enough to
+ * make room for it. The rest of the space is filled with a free atom.
+ */
+static int write_reserved_moov(AVFormatContext *s, int64_t moov_pos)
+{
+    MOVMuxContext *mov = s->priv_data;
+    AVIOContext *pb = s->pb;
+    int reserved = mov->reserved_moov_size;
+    int i, moov_size, moov_size2, shift = 0, res;
+
+    moov_size = get_moov_size(s);
+    if (moov_size < 0)
+        return moov_size;
+
+    av_log(s, AV_LOG_INFO, "moov atom size %d, reserved %d (%.1f%% of the actual size)\n",
+           moov_size, reserved, 100.0 * reserved / moov_size);
+
+    /* any space left must be large enough for a free atom */
+    if (moov_size != reserved && moov_size + 8 > reserved) {
+        shift = moov_size > reserved ? moov_size - reserved : moov_size + 8 - reserved;
+        for (i = 0; i < mov->nb_tracks; i++)
+            mov->tracks[i].data_offset += shift;
+
+        /* the chunk offset tables may have switched from stco to co64 */
+        moov_size2 = get_moov_size(s);
+        if (moov_size2 < 0)
+            return moov_size2;
+        if (moov_size2 != moov_size) {
+            for (i = 0; i < mov->nb_tracks; i++)
+                mov->tracks[i].data_offset += moov_size2 - moov_size;
+            shift    += moov_size2 - moov_size;
+            moov_size = moov_size2;
+        }
+
+        av_log(s, AV_LOG_INFO, "Reserved space too small: moving the media data by %d bytes\n", shift);
+        avio_seek(pb, moov_pos, SEEK_SET);
+        res = ff_format_shift_data(s, mov->reserved_header_pos + reserved, shift);
+        if (res < 0)
+            return res;
+    }
+
+    avio_seek(pb, mov->reserved_header_pos, SEEK_SET);
+    if ((res = mov_write_moov_tag(pb, mov, s)) < 0)
+        return res;
+    if (reserved + shift > moov_size) {
+        int size = reserved + shift - moov_size;
+        avio_wb32(pb, size);
+        ffio_wfourcc(pb, "free");
+        ffio_fill(pb, 0, size - 8);
+    }
+    return 0;
+}
+
 static void mov_write_mdat_size(AVFormatContext *s)
 {
     MOVMuxContext *mov = s->priv_data;
@@ -8734,7 +8998,10 @@ static int mov_write_trailer(AVFormatContext *s)
 
         avio_seek(pb, mov->reserved_moov_size > 0 ? mov->reserved_header_pos : moov_pos, SEEK_SET);
 
-        if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+        if (mov->flags & FF_MOV_FLAG_RESERVE_MOOV) {
+            if ((res = write_reserved_moov(s, moov_pos)) < 0)
+                return res;
+        } else if (mov->flags & FF_MOV_FLAG_FASTSTART) {
             av_log(s, AV_LOG_INFO, "Starting second pass: moving the moov atom to the beginning of the file\n");
             res = shift_data(s);
             if (res < 0)
@@ -199,6 +199,12 @@ typedef enum {
     MOV_PRFT_NB
 } MOVPrftBox;
 
+typedef struct MOVFragmentJob {
+    MOVTrack *track;
+    uint8_t *buf;
+    int first, last; ///< cenc ranges to encrypt
+} MOVFragmentJob;
+
 typedef struct MOVMuxContext {
     const AVClass *av_class;
     int     mode;
@@ -252,6 +258,14 @@ typedef struct MOVMuxContext {
     uint8_t *encryption_kid;
     int encryption_kid_len;
 
+    /* encryption of the fragments by a pool of threads */
+    int frag_threads;
+    struct AVSliceThread *frag_thread;
+    struct AVAESCTR **frag_aes_ctr; ///< one per thread
+    int nb_frag_threads;
+    struct MOVFragmentJob *frag_jobs;
+    unsigned int frag_jobs_size;
+
     int use_stream_ids_as_track_ids;
     int track_ids_ok;
     int write_btrt;
@@ -291,6 +305,7 @@ typedef struct MOVMuxContext {
 #define FF_MOV_FLAG_CMAF                  (1 << 22)
 #define FF_MOV_FLAG_PREFER_ICC            (1 << 23)
 #define FF_MOV_FLAG_HYBRID_FRAGMENTED     (1 << 24)
+#define FF_MOV_FLAG_RESERVE_MOOV          (1 << 25)
 
 int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt);
 
@@ -91,14 +91,32 @@ static int auxiliary_info_add_subsample(MOVMuxCencContext* ctx,
 /**
  * Encrypt the input buffer and write using avio_write
  */
-static void mov_cenc_write_encrypted(MOVMuxCencContext* ctx, AVIOContext *pb,
-                                     const uint8_t *buf_in, int size)
+static int mov_cenc_write_encrypted(MOVMuxCencContext* ctx, AVIOContext *pb,
+                                    const uint8_t *buf_in, int size)
 {
     uint8_t chunk[4096];
     const uint8_t* cur_pos = buf_in;
     int size_left = size;
     int cur_size;
 
+    if (pb == ctx->deferred_pb) {
+        MOVMuxCencRange *range;
+
+        if (size <= 0)
+            return 0;
+        range = av_fast_realloc(ctx->ranges, &ctx->ranges_alloc_size,
+                                (ctx->nb_ranges + 1) * sizeof(*ctx->ranges));
+        if (!range)
+            return AVERROR(ENOMEM);
+        ctx->ranges = range;
+        range += ctx->nb_ranges++;
+        range->pos  = avio_tell(pb);
+        range->size = size;
+        memcpy(range->iv, av_aes_ctr_get_iv(ctx->aes_ctr), AES_CTR_IV_SIZE);
+        avio_write(pb, buf_in, size);
+        return 0;
+    }
+
     while (size_left > 0) {
         cur_size = FFMIN(size_left, sizeof(chunk));
         av_aes_ctr_crypt(ctx->aes_ctr, chunk, cur_pos, cur_size);
@@ -106,6 +124,27 @@ static void mov_cenc_write_encrypted(MOVMuxCencContext* ctx, AVIOContext *pb,
         cur_pos += cur_size;
         size_left -= cur_size;
     }
+    return 0;
+}
+
+void ff_mov_cenc_move_ranges(MOVMuxCencContext *ctx, int64_t offset)
+{
+    for (int i = ctx->nb_moved_ranges; i < ctx->nb_ranges; i++)
+        ctx->ranges[i].pos += offset;
+    ctx->nb_moved_ranges = ctx->nb_ranges;
+}
+
+void ff_mov_cenc_encrypt_ranges(const MOVMuxCencContext *ctx, struct AVAESCTR *aes_ctr,
+                                uint8_t *buf, int first, int last)
+{
+    for (int i = first; i < last; i++) {
+        const MOVMuxCencRange *range = &ctx->ranges[i];
+
+        /* the counter runs on across the subsamples of a packet */
+        if (i == first || memcmp(range->iv, range[-1].iv, AES_CTR_IV_SIZE))
+            av_aes_ctr_set_iv(aes_ctr, range->iv);
+        av_aes_ctr_crypt(aes_ctr, buf + range->pos, buf + range->pos, range->size);
+    }
 }
 
 /**
@@ -184,7 +223,10 @@ int ff_mov_cenc_write_packet(MOVMuxCencContext* ctx, AVIOContext *pb,
         return ret;
     }
 
-    mov_cenc_write_encrypted(ctx, pb, buf_in, size);
+    ret = mov_cenc_write_encrypted(ctx, pb, buf_in, size);
+    if (ret) {
+        return ret;
+    }
 
     ret = mov_cenc_end_packet(ctx);
     if (ret) {
@@ -218,7 +260,10 @@ int ff_mov_cenc_avc_parse_nal_units(MOVMuxCencContext* ctx, AVIOContext *pb,
 
         avio_wb32(pb, nal_end - nal_start);
         avio_w8(pb, *nal_start);
-        mov_cenc_write_encrypted(ctx, pb, nal_start + 1, nal_end - nal_start - 1);
+        ret = mov_cenc_write_encrypted(ctx, pb, nal_start + 1, nal_end - nal_start - 1);
+        if (ret) {
+            return ret;
+        }
 
         auxiliary_info_add_subsample(ctx, 5, nal_end - nal_start - 1);
 
@@ -268,7 +313,10 @@ int ff_mov_cenc_avc_write_nal_units(AVFormatContext *s, MOVMuxCencContext* ctx,
             return -1;
         }
 
-        mov_cenc_write_encrypted(ctx, pb, buf_in + 1, nalsize - 1);
+        ret = mov_cenc_write_encrypted(ctx, pb, buf_in + 1, nalsize - 1);
+        if (ret) {
+            return ret;
+        }
         buf_in += nalsize;
         size -= nalsize;
 
@@ -365,10 +413,13 @@ static int write_tiles(AVFormatContext *s, MOVMuxCencContext *ctx, AVIOContext *
 
     for (unsigned tile_num = tile_group->tg_start; tile_num <= tile_group->tg_end; tile_num++) {
         const struct MOVMuxCencAV1TGInfo *sizes = &ctx->tile_group_sizes[tile_num];
+        int ret;
 
         avio_write(pb, gb.buffer, sizes->write_clear_bytes);
         bytestream2_skipu(&gb, sizes->write_clear_bytes);
-        mov_cenc_write_encrypted(ctx, pb, gb.buffer, sizes->encrypted_bytes);
+        ret = mov_cenc_write_encrypted(ctx, pb, gb.buffer, sizes->encrypted_bytes);
+        if (ret < 0)
+            return ret;
         bytestream2_skipu(&gb, sizes->encrypted_bytes);
         if (sizes->encrypted_bytes) {
             unsigned clear_bytes = sizes->aux_clear_bytes;
@@ -640,6 +691,7 @@ void ff_mov_cenc_free(MOVMuxCencContext* ctx)
     av_aes_ctr_free(ctx->aes_ctr);
     av_freep(&ctx->auxiliary_info);
     av_freep(&ctx->auxiliary_info_sizes);
+    av_freep(&ctx->ranges);
 
     av_freep(&ctx->tile_group_sizes);
     ff_lavf_cbs_fragment_free(&ctx->temporal_unit);
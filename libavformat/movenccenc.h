@@ -31,6 +31,15 @@
 
 struct MOVTrack;
 
+/**
+ * A range of bytes written in the clear to deferred_pb, to be encrypted.
+ */
+typedef struct MOVMuxCencRange {
+    int64_t pos;
+    int size;
+    uint8_t iv[AES_CTR_IV_SIZE];
+} MOVMuxCencRange;
+
 struct MOVMuxCencAV1TGInfo {
     uint32_t encrypted_bytes;
     uint32_t write_clear_bytes;
@@ -58,6 +67,14 @@ typedef struct {
     /* CBS */
     CodedBitstreamContext *cbc;
     CodedBitstreamFragment temporal_unit;
+
+    /* deferred encryption: the data written to deferred_pb is left in the
+     * clear, and encrypted later with ff_mov_cenc_encrypt_ranges() */
+    AVIOContext *deferred_pb;
+    MOVMuxCencRange *ranges;
+    int nb_ranges;
+    int nb_moved_ranges;
+    unsigned int ranges_alloc_size;
 } MOVMuxCencContext;
 
 /**
@@ -92,6 +109,23 @@ int ff_mov_cenc_avc_write_nal_units(AVFormatContext *s, MOVMuxCencContext* ctx,
 int ff_mov_cenc_av1_write_obus(AVFormatContext *s, MOVMuxCencContext* ctx,
                                AVIOContext *pb, const AVPacket *pkt);
 
+/**
+ * Offset the ranges recorded since the last call, when the data written to
+ * deferred_pb is moved to another buffer at offset and deferred_pb reset.
+ */
+void ff_mov_cenc_move_ranges(MOVMuxCencContext *ctx, int64_t offset);
+
+/**
+ * Encrypt the ranges first to last - 1 recorded for deferred_pb.
+ * This only reads the ranges, and may be called from another thread.
+ *
+ * @param aes_ctr context initialized with the encryption key
+ * @param buf     the data written to deferred_pb
+ * @param first   index of a range starting a packet
+ */
+void ff_mov_cenc_encrypt_ranges(const MOVMuxCencContext *ctx, struct AVAESCTR *aes_ctr,
+                                uint8_t *buf, int first, int last);
+
 /**
  * Clear subsample data. To be called for fragmented output.
  */
@@ -32,10 +32,13 @@
 #include "libavutil/opt.h"
 #include "libavutil/avassert.h"
 #include "libavutil/dovi_meta.h"
+#include "libavutil/slicethread.h"
+#include "libavutil/thread.h"
 #include "libavcodec/bytestream.h"
 #include "libavcodec/defs.h"
 #include "libavcodec/get_bits.h"
 #include "libavcodec/opus/opus.h"
+#include "libavcodec/packet_internal.h"
 #include "avformat.h"
 #include "mpegts.h"
 #include "internal.h"
@@ -63,6 +66,12 @@
 #define PROBE_PACKET_MAX_BUF 8192
 #define PROBE_PACKET_MARGIN 5
 
+/* number of TS packets demuxed at once with demux_threads */
+#define MAX_BATCH_PACKETS 4096
+/* below this number of buffered packets, demux in the calling thread */
+#define MIN_BATCH_PACKETS 256
+#define MAX_DEMUX_THREADS 64
+
 enum MpegTSFilterType {
     MPEGTS_PES,
     MPEGTS_SECTION,
@@ -102,6 +111,11 @@ struct MpegTSFilter {
     int last_cc; /* last cc code (-1 if first packet) */
     int64_t last_pcr;
     int discard;
+    int nb_cc_errors;
+    int nb_tei_errors;
+    /** packets of this PID in the current batch, and shard demuxing them */
+    int nb_batch_packets;
+    int shard;
     enum MpegTSFilterType type;
     union {
         MpegTSPESFilter pes_filter;
@@ -127,6 +141,24 @@ struct Program {
     int pmt_found;
 };
 
+/**
+ * Output of a demuxing thread, and of the calling thread, for one batch.
+ */
+typedef struct MpegTSShard {
+    AVPacket *pkt;
+    int stop_parse;
+    int error;
+    /** number of packets assigned to the shard in the current batch */
+    int load;
+    /** index in the batch of the last packet with payload */
+    int last_payload;
+    /** completed packets, and the batch index of the TS packet completing each */
+    PacketList out;
+    int *out_index;
+    unsigned int out_index_size;
+    int nb_out;
+} MpegTSShard;
+
 struct MpegTSContext {
     const AVClass *class;
     /* user data */
@@ -165,6 +197,7 @@ struct MpegTSContext {
     int resync_size;
     int merge_pmt_versions;
     int max_packet_size;
+    int demux_threads;
 
     int id;
 
@@ -175,6 +208,9 @@ struct MpegTSContext {
     unsigned int nb_prg;
     struct Program *prg;
 
+    /** number of packets passed over by skip_packets() */
+    int64_t nb_skipped_packets;
+
     int8_t crc_validity[NB_PID_MAX];
     /** filters for various streams specified by PMT + for the PAT and PMT */
     MpegTSFilter *pids[NB_PID_MAX];
@@ -182,6 +218,23 @@ struct MpegTSContext {
 
     AVStream *epg_stream;
     AVBufferPool* pools[32];
+    AVMutex pools_lock;
+
+    /* parallel demuxing of the PES streams */
+    AVSliceThread *slicethread;
+    /** nb_shards demuxing threads, followed by the calling thread */
+    MpegTSShard *shards;
+    int nb_shards;
+    /** packets of the current batch, in the IO buffer */
+    const uint8_t *batch;
+    int64_t batch_pos;
+    int nb_batch_packets;
+    /** shard handling each packet of the batch */
+    int8_t *batch_shard;
+    MpegTSFilter **batch_filters;
+    int batch_error;
+    /** demuxed packets, in stream order */
+    PacketList queue;
 };
 
 #define MPEGTS_OPTIONS \
@@ -211,6 +264,8 @@ static const AVOption options[] = {
      {.i64 = 0}, 0, 1, 0 },
     {"max_packet_size", "maximum size of emitted packet", offsetof(MpegTSContext, max_packet_size), AV_OPT_TYPE_INT,
      {.i64 = 204800}, 1, INT_MAX/2, AV_OPT_FLAG_DECODING_PARAM },
+    {"demux_threads", "number of threads demuxing PES streams", offsetof(MpegTSContext, demux_threads), AV_OPT_TYPE_INT,
+     {.i64 = 0}, 0, MAX_DEMUX_THREADS, AV_OPT_FLAG_DECODING_PARAM },
     { NULL },
 };
 
@@ -564,6 +619,10 @@ static void mpegts_close_filter(MpegTSContext *ts, MpegTSFilter *filter)
     int pid;
 
     pid = filter->pid;
+    if (filter->nb_cc_errors || filter->nb_tei_errors)
+        av_log(ts->stream, AV_LOG_VERBOSE,
+               "pid=0x%x: %d continuity errors, %d packets with TEI flag\n",
+               pid, filter->nb_cc_errors, filter->nb_tei_errors);
     if (filter->type == MPEGTS_SECTION)
         av_freep(&filter->u.section_filter.section_buf);
     else if (filter->type == MPEGTS_PES) {
@@ -1151,34 +1210,42 @@ static int read_sl_header(PESContext *pes, SLConfigDescr *sl,
 static AVBufferRef *buffer_pool_get(MpegTSContext *ts, int size)
 {
     int index = av_log2(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    AVBufferPool *pool;
+
+    /* the pools are shared by the demuxing threads */
+    if (ts->slicethread)
+        ff_mutex_lock(&ts->pools_lock);
     if (!ts->pools[index]) {
         int pool_size = FFMIN(ts->max_packet_size + AV_INPUT_BUFFER_PADDING_SIZE, 2 << index);
         ts->pools[index] = av_buffer_pool_init(pool_size, NULL);
-        if (!ts->pools[index])
-            return NULL;
     }
-    return av_buffer_pool_get(ts->pools[index]);
+    pool = ts->pools[index];
+    if (ts->slicethread)
+        ff_mutex_unlock(&ts->pools_lock);
+    return pool ? av_buffer_pool_get(pool) : NULL;
 }
 
-/* return non zero if a packet could be constructed */
-static int mpegts_push_data(MpegTSFilter *filter,
-                            const uint8_t *buf, int buf_size, int is_start,
-                            int64_t pos)
+/**
+ * Feed the payload of a TS packet to a PES context. A completed PES packet
+ * is returned in pkt, and *stop_parse set to 1.
+ */
+static int push_pes_data(PESContext *pes, AVPacket *pkt, int *stop_parse,
+                         const uint8_t *buf, int buf_size, int is_start,
+                         int64_t pos)
 {
-    PESContext *pes   = filter->u.pes_filter.opaque;
     MpegTSContext *ts = pes->ts;
     const uint8_t *p;
     int ret, len;
 
-    if (!ts->pkt)
+    if (!pkt)
         return 0;
 
     if (is_start) {
         if (pes->state == MPEGTS_PAYLOAD && pes->data_index > 0) {
-            ret = new_pes_packet(pes, ts->pkt);
+            ret = new_pes_packet(pes, pkt);
             if (ret < 0)
                 return ret;
-            ts->stop_parse = 1;
+            *stop_parse = 1;
         } else {
             reset_pes_packet_state(pes);
         }
@@ -1408,12 +1475,12 @@ skip:
 
                 if (pes->data_index > 0 &&
                     pes->data_index + buf_size > max_packet_size) {
-                    ret = new_pes_packet(pes, ts->pkt);
+                    ret = new_pes_packet(pes, pkt);
                     if (ret < 0)
                         return ret;
                     pes->PES_packet_length = 0;
                     max_packet_size = ts->max_packet_size;
-                    ts->stop_parse = 1;
+                    *stop_parse = 1;
                 } else if (pes->data_index == 0 &&
                            buf_size > max_packet_size) {
                     // pes packet size is < ts size packet and pes data is padded with STUFFING_BYTE
@@ -1432,10 +1499,10 @@ skip:
                 /* emit complete packets with known packet size
                  * decreases demuxer delay for infrequent packets like subtitles from
                  * a couple of seconds to milliseconds for properly muxed files. */
-                if (!ts->stop_parse && pes->PES_packet_length &&
+                if (!*stop_parse && pes->PES_packet_length &&
                     pes->pes_header_size + pes->data_index == pes->PES_packet_length + PES_START_SIZE) {
-                    ts->stop_parse = 1;
-                    ret = new_pes_packet(pes, ts->pkt);
+                    *stop_parse = 1;
+                    ret = new_pes_packet(pes, pkt);
                     pes->state = MPEGTS_SKIP;
                     if (ret < 0)
                         return ret;
@@ -1452,6 +1519,18 @@ skip:
     return 0;
 }
 
+/* return non zero if a packet could be constructed */
+static int mpegts_push_data(MpegTSFilter *filter,
+                            const uint8_t *buf, int buf_size, int is_start,
+                            int64_t pos)
+{
+    PESContext *pes   = filter->u.pes_filter.opaque;
+    MpegTSContext *ts = pes->ts;
+
+    return push_pes_data(pes, ts->pkt, &ts->stop_parse,
+                         buf, buf_size, is_start, pos);
+}
+
 static PESContext *add_pes_stream(MpegTSContext *ts, int pid, int pcr_pid)
 {
     MpegTSFilter *tss;
@@ -2897,37 +2976,24 @@ static void sdt_cb(MpegTSFilter *filter, const uint8_t *section, int section_len
 static int parse_pcr(int64_t *ppcr_high, int *ppcr_low,
                      const uint8_t *packet);
 
-/* handle one TS packet */
-static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
+/**
+ * Check the continuity counter and the transport error indicator of a
+ * packet with a valid adaptation_field_control, and mark the PES packet
+ * being assembled as corrupt on error.
+ *
+ * @return 1 if the packet continues the previous one of its PID
+ */
+static av_always_inline int check_continuity(MpegTSContext *ts, MpegTSFilter *tss,
+                                             const uint8_t *packet)
 {
-    MpegTSFilter *tss;
-    int len, pid, cc, expected_cc, cc_ok, afc, is_start, is_discontinuity,
-        has_adaptation, has_payload;
-    const uint8_t *p, *p_end;
-
-    pid = AV_RB16(packet + 1) & 0x1fff;
-    is_start = packet[1] & 0x40;
-    tss = ts->pids[pid];
-    if (ts->auto_guess && !tss && is_start) {
-        add_pes_stream(ts, pid, -1);
-        tss = ts->pids[pid];
-    }
-    if (!tss)
-        return 0;
-    if (is_start)
-        tss->discard = discard_pid(ts, pid);
-    if (tss->discard)
-        return 0;
-    ts->current_pid = pid;
-
-    afc = (packet[3] >> 4) & 3;
-    if (afc == 0) /* reserved value */
-        return 0;
-    has_adaptation   = afc & 2;
-    has_payload      = afc & 1;
-    is_discontinuity = has_adaptation &&
-                       packet[4] != 0 && /* with length > 0 */
-                       (packet[5] & 0x80); /* and discontinuity indicated */
+    int pid              = tss->pid;
+    int afc              = (packet[3] >> 4) & 3;
+    int has_adaptation   = afc & 2;
+    int has_payload      = afc & 1;
+    int is_discontinuity = has_adaptation &&
+                           packet[4] != 0 && /* with length > 0 */
+                           (packet[5] & 0x80); /* and discontinuity indicated */
+    int cc, expected_cc, cc_ok;
 
     /* continuity check (currently not used) */
     cc = (packet[3] & 0xf);
@@ -2942,6 +3008,7 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
         av_log(ts->stream, AV_LOG_DEBUG,
                "Continuity check failed for pid %d expected %d got %d\n",
                pid, expected_cc, cc);
+        tss->nb_cc_errors++;
         if (tss->type == MPEGTS_PES) {
             PESContext *pc = tss->u.pes_filter.opaque;
             pc->flags |= AV_PKT_FLAG_CORRUPT;
@@ -2950,18 +3017,57 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
 
     if (packet[1] & 0x80) {
         av_log(ts->stream, AV_LOG_DEBUG, "Packet had TEI flag set; marking as corrupt\n");
+        tss->nb_tei_errors++;
         if (tss->type == MPEGTS_PES) {
             PESContext *pc = tss->u.pes_filter.opaque;
             pc->flags |= AV_PKT_FLAG_CORRUPT;
         }
     }
 
+    return cc_ok;
+}
+
+static av_always_inline void update_pcr(MpegTSFilter *tss, const uint8_t *packet)
+{
+    int64_t pcr_h;
+    int pcr_l;
+    if (parse_pcr(&pcr_h, &pcr_l, packet) == 0)
+        tss->last_pcr = pcr_h * SYSTEM_CLOCK_FREQUENCY_DIVISOR + pcr_l;
+}
+
+/* handle one TS packet */
+static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
+{
+    MpegTSFilter *tss;
+    int len, pid, cc_ok, afc, is_start, has_adaptation, has_payload;
+    const uint8_t *p, *p_end;
+
+    pid = AV_RB16(packet + 1) & 0x1fff;
+    is_start = packet[1] & 0x40;
+    tss = ts->pids[pid];
+    if (ts->auto_guess && !tss && is_start) {
+        add_pes_stream(ts, pid, -1);
+        tss = ts->pids[pid];
+    }
+    if (!tss)
+        return 0;
+    if (is_start)
+        tss->discard = discard_pid(ts, pid);
+    if (tss->discard)
+        return 0;
+    ts->current_pid = pid;
+
+    afc = (packet[3] >> 4) & 3;
+    if (afc == 0) /* reserved value */
+        return 0;
+    has_adaptation = afc & 2;
+    has_payload    = afc & 1;
+
+    cc_ok = check_continuity(ts, tss, packet);
+
     p = packet + 4;
     if (has_adaptation) {
-        int64_t pcr_h;
-        int pcr_l;
-        if (parse_pcr(&pcr_h, &pcr_l, packet) == 0)
-            tss->last_pcr = pcr_h * SYSTEM_CLOCK_FREQUENCY_DIVISOR + pcr_l;
+        update_pcr(tss, packet);
         /* skip adaptation field */
         p += p[0] + 1;
     }
@@ -3114,33 +3220,99 @@ static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
         avio_skip(pb, skip);
 }
 
+/**
+ * Pass over the packets buffered in the IO context that handle_packet()
+ * would not hand to any filter: packets of PIDs without filter or
+ * discarded, and payload of PES streams being skipped, e.g. because their
+ * AVStream is discarded. This avoids the per packet reads for the PIDs not
+ * demuxed from multi program streams. The continuity and PCR state of the
+ * PES filters is kept up to date.
+ *
+ * Stops at the first packet needing handle_packet(), i.e. one starting a
+ * payload unit, one of a PID being demuxed, or one without sync byte.
+ *
+ * @return the number of packets skipped
+ */
+static int skip_packets(MpegTSContext *ts, int64_t max_packets)
+{
+    AVIOContext *pb = ts->stream->pb;
+    const int raw_packet_size = ts->raw_packet_size;
+    /* offset of the TS packet in the raw packet */
+    const int offset = raw_packet_size == TS_DVHS_PACKET_SIZE ? 4 : 0;
+    const uint8_t *packet = pb->buf_ptr + offset;
+    int64_t nb_packets = FFMIN((pb->buf_end - pb->buf_ptr) / raw_packet_size,
+                               max_packets);
+    int i, last_payload = -1;
+
+    for (i = 0; i < nb_packets; i++, packet += raw_packet_size) {
+        uint32_t header = AV_RB32(packet);
+        MpegTSFilter *tss = ts->pids[(header >> 8) & 0x1fff];
+        int afc;
+
+        /* no sync byte or payload_unit_start_indicator set */
+        if ((header & 0xff400000) != SYNC_BYTE << 24)
+            break;
+        if (!tss || tss->discard)
+            continue;
+        if (tss->type != MPEGTS_PES ||
+            ((PESContext *)tss->u.pes_filter.opaque)->state != MPEGTS_SKIP)
+            break;
+
+        afc = (header >> 4) & 3;
+        if (afc == 0) /* reserved value */
+            continue;
+        check_continuity(ts, tss, packet);
+        if (afc & 2) {
+            update_pcr(tss, packet);
+            if (afc & 1 && packet[4] < TS_PACKET_SIZE - 5)
+                last_payload = i;
+        } else {
+            last_payload = i;
+        }
+    }
+
+    if (last_payload >= 0)
+        ts->pos47_full = avio_tell(pb) + (int64_t)last_payload * raw_packet_size + offset;
+    if (i) {
+        ts->nb_skipped_packets += i;
+        avio_skip(pb, (int64_t)i * raw_packet_size);
+    }
+    return i;
+}
+
+static void flush_after_seek(MpegTSContext *ts)
+{
+    int i;
+    av_log(ts->stream, AV_LOG_TRACE, "Skipping after seek\n");
+    /* seek detected, flush pes buffer */
+    for (i = 0; i < NB_PID_MAX; i++) {
+        if (ts->pids[i]) {
+            if (ts->pids[i]->type == MPEGTS_PES) {
+                PESContext *pes = ts->pids[i]->u.pes_filter.opaque;
+                av_buffer_unref(&pes->buffer);
+                pes->data_index = 0;
+                pes->state = MPEGTS_SKIP; /* skip until pes header */
+            } else if (ts->pids[i]->type == MPEGTS_SECTION) {
+                ts->pids[i]->u.section_filter.last_ver = -1;
+            }
+            ts->pids[i]->last_cc = -1;
+            ts->pids[i]->last_pcr = -1;
+        }
+    }
+    avpriv_packet_list_free(&ts->queue);
+    ts->batch_error = 0;
+}
+
 static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
 {
     AVFormatContext *s = ts->stream;
     uint8_t packet[TS_PACKET_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
     const uint8_t *data;
     int64_t packet_num;
-    int ret = 0;
+    int skipped, ret = 0;
 
-    if (avio_tell(s->pb) != ts->last_pos) {
-        int i;
-        av_log(ts->stream, AV_LOG_TRACE, "Skipping after seek\n");
-        /* seek detected, flush pes buffer */
-        for (i = 0; i < NB_PID_MAX; i++) {
-            if (ts->pids[i]) {
-                if (ts->pids[i]->type == MPEGTS_PES) {
-                    PESContext *pes = ts->pids[i]->u.pes_filter.opaque;
-                    av_buffer_unref(&pes->buffer);
-                    pes->data_index = 0;
-                    pes->state = MPEGTS_SKIP; /* skip until pes header */
-                } else if (ts->pids[i]->type == MPEGTS_SECTION) {
-                    ts->pids[i]->u.section_filter.last_ver = -1;
-                }
-                ts->pids[i]->last_cc = -1;
-                ts->pids[i]->last_pcr = -1;
-            }
-        }
-    }
+    if (avio_tell(s->pb) != ts->last_pos)
+        flush_after_seek(ts);
 
     ts->stop_parse = 0;
     packet_num = 0;
@@ -3155,6 +3327,12 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        skipped = skip_packets(ts, nb_packets ? nb_packets - packet_num : INT64_MAX);
+        if (skipped) {
+            packet_num += skipped - 1;
+            continue;
+        }
+
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
@@ -3167,6 +3345,347 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
     return ret;
 }
 
+/**
+ * Check whether the packets of a PID can be demuxed by a demuxing thread:
+ * those of PES streams whose demuxing only touches their own state.
+ */
+static int can_demux_in_thread(const MpegTSFilter *tss)
+{
+    const PESContext *pes;
+
+    if (tss->type != MPEGTS_PES)
+        return 0;
+    pes = tss->u.pes_filter.opaque;
+    /* new streams are created, SL headers set the timebase, and teletext
+     * and subtitle timestamps are fixed up with the PCR of their program
+     * in the calling thread */
+    return pes->st && pes->stream_type != STREAM_TYPE_ISO_IEC_14496_PES &&
+           pes->st->codecpar->codec_id != AV_CODEC_ID_DVB_TELETEXT &&
+           pes->st->codecpar->codec_id != AV_CODEC_ID_DVB_SUBTITLE;
+}
+
+static int shard_output(MpegTSShard *shard, int index)
+{
+    int *out_index = av_fast_realloc(shard->out_index, &shard->out_index_size,
+                                     (shard->nb_out + 1) * sizeof(*out_index));
+    int ret;
+
+    if (!out_index)
+        return AVERROR(ENOMEM);
+    shard->out_index = out_index;
+    ret = avpriv_packet_list_put(&shard->out, shard->pkt, NULL, 0);
+    if (ret < 0)
+        return ret;
+    out_index[shard->nb_out++] = index;
+    return 0;
+}
+
+/* handle one TS packet of a PES stream in a demuxing thread, like
+ * handle_packet() does */
+static int handle_shard_packet(MpegTSContext *ts, MpegTSShard *shard, int index)
+{
+    const int raw_packet_size = ts->raw_packet_size;
+    const int offset = raw_packet_size == TS_DVHS_PACKET_SIZE ? 4 : 0;
+    const uint8_t *packet = ts->batch + index * raw_packet_size + offset;
+    const uint8_t *p, *p_end = packet + TS_PACKET_SIZE;
+    int64_t pos = ts->batch_pos + index * raw_packet_size + offset + TS_PACKET_SIZE;
+    int pid = AV_RB16(packet + 1) & 0x1fff;
+    int is_start = packet[1] & 0x40;
+    int afc = (packet[3] >> 4) & 3;
+    MpegTSFilter *tss = ts->pids[pid];
+
+    if (is_start)
+        tss->discard = discard_pid(ts, pid);
+    if (tss->discard)
+        return 0;
+    if (afc == 0) /* reserved value */
+        return 0;
+
+    check_continuity(ts, tss, packet);
+
+    /* the PCR is updated in the calling thread, see handle_batch() */
+    p = packet + 4;
+    if (afc & 2)
+        p += p[0] + 1;
+    if (p >= p_end || !(afc & 1))
+        return 0;
+    shard->last_payload = index;
+
+    return push_pes_data(tss->u.pes_filter.opaque, shard->pkt, &shard->stop_parse,
+                         p, p_end - p, is_start, pos - raw_packet_size);
+}
+
+static void demux_shard(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    MpegTSContext *ts   = priv;
+    MpegTSShard *shard  = &ts->shards[jobnr];
+    int i, ret;
+
+    for (i = 0; i < ts->nb_batch_packets; i++) {
+        if (ts->batch_shard[i] != jobnr)
+            continue;
+        ret = handle_shard_packet(ts, shard, i);
+        if (ret >= 0 && shard->stop_parse) {
+            shard->stop_parse = 0;
+            ret = shard_output(shard, i);
+        }
+        if (ret < 0 && !shard->error)
+            shard->error = ret;
+    }
+}
+
+static int cmp_batch_load(const void *a, const void *b)
+{
+    const MpegTSFilter *fa = *(const MpegTSFilter * const *)a;
+    const MpegTSFilter *fb = *(const MpegTSFilter * const *)b;
+    return fb->nb_batch_packets - fa->nb_batch_packets;
+}
+
+/* append the packets output by the shards to the queue, in the order of
+ * the TS packets completing them */
+static void merge_shard_output(MpegTSContext *ts)
+{
+    int i, pos[MAX_DEMUX_THREADS + 1] = { 0 };
+
+    for (;;) {
+        MpegTSShard *next = NULL;
+        PacketListEntry *entry;
+        int next_index = INT_MAX, n = 0;
+
+        for (i = 0; i <= ts->nb_shards; i++) {
+            MpegTSShard *shard = &ts->shards[i];
+            if (pos[i] < shard->nb_out && shard->out_index[pos[i]] < next_index) {
+                next       = shard;
+                next_index = shard->out_index[pos[i]];
+                n          = i;
+            }
+        }
+        if (!next)
+            break;
+        pos[n]++;
+
+        entry = next->out.head;
+        next->out.head = entry->next;
+        if (!next->out.head)
+            next->out.tail = NULL;
+        entry->next = NULL;
+        if (ts->queue.tail)
+            ts->queue.tail->next = entry;
+        else
+            ts->queue.head = entry;
+        ts->queue.tail = entry;
+    }
+    for (i = 0; i <= ts->nb_shards; i++)
+        ts->shards[i].nb_out = 0;
+}
+
+/**
+ * Demux the packets buffered in the IO context. The packets of the PES
+ * streams are split between the demuxing threads by PID, so that each PES
+ * stream is reassembled in order by a single thread, and the other packets
+ * (sections, PES streams without AVStream yet) are then handled in the
+ * calling thread.
+ *
+ * Packets handled in the calling thread thus see the state of the PES
+ * streams at the end of the batch, except for the PCR which is updated in
+ * packet order, and PMT updates take effect on the PES streams at the next
+ * batch.
+ *
+ * @return the number of packets demuxed, 0 if there is no packet to demux
+ *         at the current position
+ */
+static int handle_batch(MpegTSContext *ts, int nb_packets)
+{
+    AVIOContext *pb = ts->stream->pb;
+    const int raw_packet_size = ts->raw_packet_size;
+    const int offset = raw_packet_size == TS_DVHS_PACKET_SIZE ? 4 : 0;
+    const int serial = ts->nb_shards;
+    int64_t pos47_full = ts->pos47_full;
+    int i, j, ret, nb_filters = 0, last_payload = -1;
+
+    ts->batch     = pb->buf_ptr;
+    ts->batch_pos = avio_tell(pb);
+
+    for (i = 0; i < nb_packets; i++) {
+        const uint8_t *packet = ts->batch + i * raw_packet_size + offset;
+        MpegTSFilter *tss = ts->pids[AV_RB16(packet + 1) & 0x1fff];
+
+        /* lost sync, resync in the calling thread */
+        if (packet[0] != SYNC_BYTE)
+            break;
+        if (tss && can_demux_in_thread(tss)) {
+            if (!tss->nb_batch_packets++)
+                ts->batch_filters[nb_filters++] = tss;
+            ts->batch_shard[i] = -1;
+        } else {
+            ts->batch_shard[i] = serial;
+        }
+    }
+    ts->nb_batch_packets = nb_packets = i;
+    if (!nb_packets)
+        return 0;
+
+    if (nb_filters) {
+        /* give the PIDs with the most packets to the least loaded shards */
+        qsort(ts->batch_filters, nb_filters, sizeof(*ts->batch_filters), cmp_batch_load);
+        for (j = 0; j < ts->nb_shards; j++) {
+            ts->shards[j].load         = 0;
+            ts->shards[j].last_payload = -1;
+        }
+        for (i = 0; i < nb_filters; i++) {
+            MpegTSFilter *tss = ts->batch_filters[i];
+            int min = 0;
+            for (j = 1; j < ts->nb_shards; j++)
+                if (ts->shards[j].load < ts->shards[min].load)
+                    min = j;
+            tss->shard = min;
+            ts->shards[min].load += tss->nb_batch_packets;
+            tss->nb_batch_packets = 0;
+        }
+        for (i = 0; i < nb_packets; i++)
+            if (ts->batch_shard[i] < 0)
+                ts->batch_shard[i] = ts->pids[AV_RB16(ts->batch + i * raw_packet_size + offset + 1) & 0x1fff]->shard;
+
+        avpriv_slicethread_execute(ts->slicethread, ts->nb_shards, 0);
+
+        for (j = 0; j < ts->nb_shards; j++) {
+            MpegTSShard *shard = &ts->shards[j];
+            if (shard->error && !ts->batch_error)
+                ts->batch_error = shard->error;
+            shard->error = 0;
+            last_payload = FFMAX(last_payload, shard->last_payload);
+        }
+    }
+
+    ts->pkt = ts->shards[serial].pkt;
+    for (i = 0; i < nb_packets; i++) {
+        if (ts->batch_shard[i] != serial) {
+            /* keep the PCR of the threaded PIDs in step with the packets
+             * handled here, teletext, subtitles and data sections are
+             * timestamped with the PCR of their program */
+            const uint8_t *packet = ts->batch + i * raw_packet_size + offset;
+            MpegTSFilter *tss = ts->pids[AV_RB16(packet + 1) & 0x1fff];
+            if (tss && !tss->discard && packet[3] & 0x20)
+                update_pcr(tss, packet);
+            continue;
+        }
+        ts->stop_parse = 0;
+        ret = handle_packet(ts, ts->batch + i * raw_packet_size + offset,
+                            ts->batch_pos + i * raw_packet_size + offset + TS_PACKET_SIZE);
+        if (ret >= 0 && ts->stop_parse > 0)
+            ret = shard_output(&ts->shards[serial], i);
+        if (ret < 0 && !ts->batch_error)
+            ts->batch_error = ret;
+    }
+    ts->stop_parse = 0;
+
+    if (last_payload >= 0) {
+        int64_t pos = ts->batch_pos + last_payload * raw_packet_size + offset;
+        if (ts->pos47_full == pos47_full || pos > ts->pos47_full)
+            ts->pos47_full = pos;
+    }
+
+    avio_skip(pb, (int64_t)nb_packets * raw_packet_size);
+    ts->last_pos = avio_tell(pb);
+    merge_shard_output(ts);
+    return nb_packets;
+}
+
+/* handle_packets() with the PES streams demuxed by demux_threads threads */
+static int handle_packets_threaded(MpegTSContext *ts)
+{
+    AVIOContext *pb = ts->stream->pb;
+    AVPacket *pkt   = ts->pkt;
+    int ret, nb_packets;
+
+    if (avio_tell(pb) != ts->last_pos) {
+        flush_after_seek(ts);
+        ts->last_pos = avio_tell(pb);
+    }
+
+    while (!ts->queue.head) {
+        if (ts->batch_error) {
+            ret = ts->batch_error;
+            ts->batch_error = 0;
+            return ret;
+        }
+
+        /* buffer enough packets for the threads to share */
+        if (pb->buffer_size < MAX_BATCH_PACKETS * ts->raw_packet_size) {
+            ret = ffio_realloc_buf(pb, MAX_BATCH_PACKETS * ts->raw_packet_size);
+            if (ret < 0)
+                return ret;
+        }
+
+        nb_packets = FFMIN((pb->buf_end - pb->buf_ptr) / ts->raw_packet_size,
+                           MAX_BATCH_PACKETS);
+        if (nb_packets < MIN_BATCH_PACKETS ||
+            !handle_batch(ts, nb_packets)) {
+            /* read a single packet, refilling the buffer or resyncing */
+            ts->pkt = pkt;
+            ret = handle_packets(ts, 2);
+            if (ret < 0 && ret != AVERROR(EAGAIN))
+                return ret;
+            if (ts->stop_parse > 0)
+                return 0;
+        }
+    }
+
+    ts->pkt = pkt;
+    return avpriv_packet_list_get(&ts->queue, pkt);
+}
+
+static int init_demux_threads(MpegTSContext *ts)
+{
+    int i, ret;
+
+    ret = avpriv_slicethread_create(&ts->slicethread, ts, demux_shard, NULL,
+                                    ts->demux_threads);
+    if (ret < 0)
+        return ret;
+    ts->nb_shards = ret;
+
+    ret = ff_mutex_init(&ts->pools_lock, NULL);
+    if (ret) {
+        avpriv_slicethread_free(&ts->slicethread);
+        return AVERROR(ret);
+    }
+
+    ts->shards        = av_calloc(ts->nb_shards + 1, sizeof(*ts->shards));
+    ts->batch_shard   = av_malloc(MAX_BATCH_PACKETS);
+    ts->batch_filters = av_malloc_array(NB_PID_MAX, sizeof(*ts->batch_filters));
+    if (!ts->shards || !ts->batch_shard || !ts->batch_filters)
+        return AVERROR(ENOMEM);
+    for (i = 0; i <= ts->nb_shards; i++) {
+        ts->shards[i].pkt = av_packet_alloc();
+        if (!ts->shards[i].pkt)
+            return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static void free_demux_threads(MpegTSContext *ts)
+{
+    int i;
+
+    if (!ts->slicethread)
+        return;
+    avpriv_slicethread_free(&ts->slicethread);
+    ff_mutex_destroy(&ts->pools_lock);
+
+    if (ts->shards) {
+        for (i = 0; i <= ts->nb_shards; i++) {
+            av_packet_free(&ts->shards[i].pkt);
+            avpriv_packet_list_free(&ts->shards[i].out);
+            av_freep(&ts->shards[i].out_index);
+        }
+    }
+    av_freep(&ts->shards);
+    av_freep(&ts->batch_shard);
+    av_freep(&ts->batch_filters);
+    avpriv_packet_list_free(&ts->queue);
+}
+
 static int mpegts_probe(const AVProbeData *p)
 {
     const int size = p->buf_size;
@@ -3282,6 +3801,16 @@ static int mpegts_read_header(AVFormatContext *s)
         av_log(ts->stream, AV_LOG_TRACE, "tuning done\n");
 
         s->ctx_flags |= AVFMTCTX_NOHEADER;
+
+        if (ts->demux_threads) {
+            int ret = init_demux_threads(ts);
+            if (ret < 0) {
+                free_demux_threads(ts);
+                if (ret != AVERROR(ENOSYS))
+                    return ret;
+                av_log(s, AV_LOG_WARNING, "Threads not available, demuxing in a single thread\n");
+            }
+        }
     } else {
         AVStream *st;
         int pcr_pid, pid, nb_packets, nb_pcrs, ret, pcr_l;
@@ -3400,7 +3929,10 @@ static int mpegts_read_packet(AVFormatContext *s, AVPacket *pkt)
 
     pkt->size = -1;
     ts->pkt = pkt;
-    ret = handle_packets(ts, 0);
+    if (ts->slicethread)
+        ret = handle_packets_threaded(ts);
+    else
+        ret = handle_packets(ts, 0);
     if (ret < 0) {
         av_packet_unref(ts->pkt);
         /* flush pes data left */
@@ -3427,6 +3959,7 @@ static void mpegts_free(MpegTSContext *ts)
 {
     int i;
 
+    free_demux_threads(ts);
     clear_programs(ts);
 
     for (i = 0; i < FF_ARRAY_ELEMS(ts->pools); i++)
@@ -3440,6 +3973,8 @@ static void mpegts_free(MpegTSContext *ts)
 static int mpegts_read_close(AVFormatContext *s)
 {
     MpegTSContext *ts = s->priv_data;
+    av_log(s, AV_LOG_DEBUG, "%"PRId64" packets skipped without parsing\n",
+           ts->nb_skipped_packets);
     mpegts_free(ts);
     return 0;
 }
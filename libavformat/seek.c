@@ -643,6 +643,8 @@ int av_seek_frame(AVFormatContext *s, int stream_index,
 {
     int ret;
 
+    ff_index_cache_load(s);
+
     if (ffifmt(s->iformat)->read_seek2 && !ffifmt(s->iformat)->read_seek) {
         int64_t min_ts = INT64_MIN, max_ts = INT64_MAX;
         if ((flags & AVSEEK_FLAG_BACKWARD))
@@ -672,6 +674,8 @@ int avformat_seek_file(AVFormatContext *s, int stream_index, int64_t min_ts,
     if (stream_index < -1 || stream_index >= (int)s->nb_streams)
         return AVERROR(EINVAL);
 
+    ff_index_cache_load(s);
+
     if (s->seek2any > 0)
         flags |= AVSEEK_FLAG_ANY;
     flags &= ~AVSEEK_FLAG_BACKWARD;
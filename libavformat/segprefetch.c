@@ -0,0 +1,511 @@
+/*
+ * Concurrent segment prefetching for segmented streaming demuxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "libavutil/avstring.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+
+#include "avio_internal.h"
+#include "internal.h"
+#include "segprefetch.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+enum JobState {
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE,
+};
+
+struct SegPrefetchJob {
+    SegPrefetchJob *next;
+    const void *owner;
+    int64_t seq_no;
+    int prio;
+
+    char *url;
+    int64_t offset;
+    int64_t size;
+    AVDictionary *opts;
+
+    enum JobState state;
+    int taken;      ///< being read by the demuxer
+    int released;   ///< released while running, the worker frees it
+    int error;
+
+    uint8_t *data;
+    size_t allocated;
+    size_t filled;
+    size_t pos;
+};
+
+struct SegPrefetch {
+    AVFormatContext *s;
+    SegPrefetchOpen open;
+    int64_t max_bytes;
+
+    /* Everything below is protected by mutex. */
+    SegPrefetchJob *jobs;
+    int64_t bytes;
+    int abort;
+
+#if HAVE_THREADS
+    pthread_t *workers;
+    int nb_workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_worker;
+    pthread_cond_t cond_reader;
+#endif
+};
+
+#if HAVE_THREADS
+
+static void job_free(SegPrefetch *sp, SegPrefetchJob *job)
+{
+    sp->bytes -= job->filled;
+    av_dict_free(&job->opts);
+    av_free(job->url);
+    av_free(job->data);
+    av_free(job);
+}
+
+static void job_unlink(SegPrefetch *sp, SegPrefetchJob *job)
+{
+    for (SegPrefetchJob **p = &sp->jobs; *p; p = &(*p)->next) {
+        if (*p == job) {
+            *p = job->next;
+            job->next = NULL;
+            return;
+        }
+    }
+}
+
+/* Must be called with the job unlinked and the mutex held. */
+static void job_release(SegPrefetch *sp, SegPrefetchJob *job)
+{
+    if (job->state == JOB_RUNNING)
+        job->released = 1;
+    else
+        job_free(sp, job);
+    /* Wake up workers waiting for the job or for memory. */
+    pthread_cond_broadcast(&sp->cond_worker);
+}
+
+static SegPrefetchJob *job_find(SegPrefetch *sp, const void *owner, int64_t seq_no)
+{
+    for (SegPrefetchJob *job = sp->jobs; job; job = job->next)
+        if (job->owner == owner && job->seq_no == seq_no)
+            return job;
+    return NULL;
+}
+
+static int job_append(SegPrefetch *sp, SegPrefetchJob *job, const uint8_t *buf, int len)
+{
+    size_t needed = job->filled + len;
+
+    if (needed > job->allocated) {
+        size_t new_size = FFMAX(needed, 2 * job->allocated);
+        uint8_t *data;
+
+        if (job->size >= 0)
+            new_size = FFMAX(needed, job->size);
+        data = av_realloc(job->data, new_size);
+        if (!data)
+            return AVERROR(ENOMEM);
+        job->data      = data;
+        job->allocated = new_size;
+    }
+    memcpy(job->data + job->filled, buf, len);
+    job->filled += len;
+    sp->bytes   += len;
+    return 0;
+}
+
+/**
+ * @param pb connection of the worker, left open after a complete download
+ *           so that it can be reused for the next one
+ */
+static void download(SegPrefetch *sp, SegPrefetchJob *job, AVIOContext **pb, uint8_t *buf)
+{
+    int ret;
+
+    pthread_mutex_unlock(&sp->mutex);
+    ret = sp->open(sp->s, pb, job->url, job->offset, job->size, &job->opts);
+    pthread_mutex_lock(&sp->mutex);
+
+    while (ret >= 0 && !job->released && !sp->abort) {
+        int len = READ_CHUNK_SIZE;
+
+        /* Only the segment being read may exceed the memory budget. */
+        if (!job->taken && sp->bytes >= sp->max_bytes) {
+            pthread_cond_wait(&sp->cond_worker, &sp->mutex);
+            continue;
+        }
+        if (job->size >= 0)
+            len = FFMIN(len, job->size - job->filled);
+        if (len <= 0) {
+            ret = AVERROR_EOF;
+            break;
+        }
+
+        pthread_mutex_unlock(&sp->mutex);
+        ret = avio_read(*pb, buf, len);
+        pthread_mutex_lock(&sp->mutex);
+
+        if (ret > 0) {
+            ret = job_append(sp, job, buf, ret);
+            pthread_cond_broadcast(&sp->cond_reader);
+        } else if (!ret) {
+            ret = AVERROR_EOF;
+        }
+    }
+
+    if (ret != AVERROR_EOF || job->released) {
+        pthread_mutex_unlock(&sp->mutex);
+        ff_format_io_close(sp->s, pb);
+        pthread_mutex_lock(&sp->mutex);
+    }
+
+    if (job->released) {
+        job_free(sp, job);
+    } else {
+        if (ret < 0 && ret != AVERROR_EOF && !sp->abort)
+            av_log(sp->s, AV_LOG_WARNING, "Prefetching '%s' failed: %s\n",
+                   job->url, av_err2str(ret));
+        job->state = JOB_DONE;
+        job->error = ret == AVERROR_EOF ? 0 : ret;
+        pthread_cond_broadcast(&sp->cond_reader);
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    SegPrefetch *sp = arg;
+    AVIOContext *pb = NULL;
+    uint8_t *buf = av_malloc(READ_CHUNK_SIZE);
+
+    if (!buf)
+        return NULL;
+
+    pthread_mutex_lock(&sp->mutex);
+    while (!sp->abort) {
+        SegPrefetchJob *job = NULL;
+
+        if (sp->bytes < sp->max_bytes) {
+            for (SegPrefetchJob *j = sp->jobs; j; j = j->next)
+                if (j->state == JOB_PENDING && (!job || j->prio < job->prio))
+                    job = j;
+        }
+        if (!job) {
+            pthread_cond_wait(&sp->cond_worker, &sp->mutex);
+            continue;
+        }
+        job->state = JOB_RUNNING;
+        download(sp, job, &pb, buf);
+    }
+    pthread_mutex_unlock(&sp->mutex);
+
+    ff_format_io_close(sp->s, &pb);
+    av_free(buf);
+    return NULL;
+}
+
+int ff_segprefetch_alloc(SegPrefetch **psp, AVFormatContext *s,
+                         SegPrefetchOpen open, int nb_workers, int64_t max_bytes)
+{
+    SegPrefetch *sp;
+    int ret;
+
+    sp = av_mallocz(sizeof(*sp));
+    if (!sp)
+        return AVERROR(ENOMEM);
+    sp->workers = av_calloc(nb_workers, sizeof(*sp->workers));
+    if (!sp->workers) {
+        av_free(sp);
+        return AVERROR(ENOMEM);
+    }
+    sp->s         = s;
+    sp->open      = open;
+    sp->max_bytes = max_bytes;
+
+    pthread_mutex_init(&sp->mutex, NULL);
+    pthread_cond_init(&sp->cond_worker, NULL);
+    pthread_cond_init(&sp->cond_reader, NULL);
+
+    for (; sp->nb_workers < nb_workers; sp->nb_workers++) {
+        ret = pthread_create(&sp->workers[sp->nb_workers], NULL, worker_thread, sp);
+        if (ret) {
+            av_log(s, AV_LOG_ERROR, "pthread_create failed: %s\n", av_err2str(AVERROR(ret)));
+            ff_segprefetch_freep(&sp);
+            return AVERROR(ret);
+        }
+    }
+
+    *psp = sp;
+    return 0;
+}
+
+void ff_segprefetch_freep(SegPrefetch **psp)
+{
+    SegPrefetch *sp = *psp;
+
+    if (!sp)
+        return;
+
+    pthread_mutex_lock(&sp->mutex);
+    sp->abort = 1;
+    pthread_cond_broadcast(&sp->cond_worker);
+    pthread_mutex_unlock(&sp->mutex);
+
+    for (int i = 0; i < sp->nb_workers; i++)
+        pthread_join(sp->workers[i], NULL);
+
+    while (sp->jobs) {
+        SegPrefetchJob *job = sp->jobs;
+        sp->jobs = job->next;
+        job_free(sp, job);
+    }
+
+    pthread_cond_destroy(&sp->cond_reader);
+    pthread_cond_destroy(&sp->cond_worker);
+    pthread_mutex_destroy(&sp->mutex);
+    av_free(sp->workers);
+    av_freep(psp);
+}
+
+int ff_segprefetch_has(SegPrefetch *sp, const void *owner, int64_t seq_no)
+{
+    int ret;
+
+    pthread_mutex_lock(&sp->mutex);
+    ret = !!job_find(sp, owner, seq_no);
+    pthread_mutex_unlock(&sp->mutex);
+    return ret;
+}
+
+int ff_segprefetch_add(SegPrefetch *sp, const void *owner, int64_t seq_no,
+                       int prio, const char *url, int64_t offset, int64_t size,
+                       const AVDictionary *opts)
+{
+    SegPrefetchJob *job, **p;
+    int ret;
+
+    job = av_mallocz(sizeof(*job));
+    if (!job)
+        return AVERROR(ENOMEM);
+    job->owner  = owner;
+    job->seq_no = seq_no;
+    job->prio   = prio;
+    job->offset = offset;
+    job->size   = size;
+    job->url    = av_strdup(url);
+    if (!job->url || (ret = av_dict_copy(&job->opts, opts, 0)) < 0) {
+        av_dict_free(&job->opts);
+        av_free(job->url);
+        av_free(job);
+        return AVERROR(ENOMEM);
+    }
+
+    pthread_mutex_lock(&sp->mutex);
+    for (p = &sp->jobs; *p; p = &(*p)->next)
+        ;
+    *p = job;
+    pthread_cond_signal(&sp->cond_worker);
+    pthread_mutex_unlock(&sp->mutex);
+    return 0;
+}
+
+void ff_segprefetch_reprioritize(SegPrefetch *sp, const void *owner, int64_t cur_seq_no)
+{
+    SegPrefetchJob **p;
+
+    pthread_mutex_lock(&sp->mutex);
+    p = &sp->jobs;
+    while (*p) {
+        SegPrefetchJob *job = *p;
+        if (job->owner == owner && job->seq_no < cur_seq_no) {
+            /* Skipped by the demuxer, e.g. because it failed to open. */
+            *p = job->next;
+            job->next = NULL;
+            job_release(sp, job);
+            continue;
+        }
+        if (job->owner == owner)
+            job->prio = av_clip64(job->seq_no - cur_seq_no, INT_MIN, INT_MAX);
+        p = &job->next;
+    }
+    pthread_mutex_unlock(&sp->mutex);
+}
+
+SegPrefetchJob *ff_segprefetch_take(SegPrefetch *sp, const void *owner, int64_t seq_no)
+{
+    SegPrefetchJob *job;
+
+    pthread_mutex_lock(&sp->mutex);
+    job = job_find(sp, owner, seq_no);
+    if (job) {
+        job_unlink(sp, job);
+        if (job->state == JOB_PENDING ||
+            (job->state == JOB_DONE && job->error && !job->filled)) {
+            /* Not started or failed: let the caller open it with its usual
+             * retry handling. */
+            job_free(sp, job);
+            job = NULL;
+        } else {
+            job->taken = 1;
+            pthread_cond_broadcast(&sp->cond_worker);
+        }
+    }
+    pthread_mutex_unlock(&sp->mutex);
+    return job;
+}
+
+int ff_segprefetch_read(SegPrefetch *sp, SegPrefetchJob *job, uint8_t *buf, int buf_size)
+{
+    int ret;
+
+    pthread_mutex_lock(&sp->mutex);
+    while (job->pos >= job->filled && job->state != JOB_DONE && !sp->abort)
+        pthread_cond_wait(&sp->cond_reader, &sp->mutex);
+    if (job->pos < job->filled) {
+        ret = FFMIN(buf_size, job->filled - job->pos);
+        memcpy(buf, job->data + job->pos, ret);
+        job->pos += ret;
+    } else {
+        ret = job->error ? job->error : AVERROR_EOF;
+    }
+    pthread_mutex_unlock(&sp->mutex);
+    return ret;
+}
+
+int64_t ff_segprefetch_seek(SegPrefetch *sp, SegPrefetchJob *job, int64_t offset, int whence)
+{
+    int64_t ret;
+
+    pthread_mutex_lock(&sp->mutex);
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        ret = job->size >= 0        ? job->size   :
+              job->state == JOB_DONE ? job->filled : AVERROR(ENOSYS);
+        break;
+    case SEEK_CUR:
+        offset += job->pos;
+        /* fall through */
+    case SEEK_SET:
+        while (offset > job->filled && job->state != JOB_DONE && !sp->abort)
+            pthread_cond_wait(&sp->cond_reader, &sp->mutex);
+        if (offset < 0 || offset > job->filled) {
+            ret = AVERROR(EINVAL);
+        } else {
+            job->pos = offset;
+            ret      = offset;
+        }
+        break;
+    default:
+        ret = AVERROR(ENOSYS);
+    }
+    pthread_mutex_unlock(&sp->mutex);
+    return ret;
+}
+
+void ff_segprefetch_release(SegPrefetch *sp, SegPrefetchJob **job)
+{
+    if (!*job)
+        return;
+    pthread_mutex_lock(&sp->mutex);
+    job_release(sp, *job);
+    pthread_mutex_unlock(&sp->mutex);
+    *job = NULL;
+}
+
+void ff_segprefetch_flush(SegPrefetch *sp, const void *owner)
+{
+    SegPrefetchJob **p;
+
+    pthread_mutex_lock(&sp->mutex);
+    p = &sp->jobs;
+    while (*p) {
+        SegPrefetchJob *job = *p;
+        if (job->owner == owner) {
+            *p = job->next;
+            job->next = NULL;
+            job_release(sp, job);
+        } else {
+            p = &job->next;
+        }
+    }
+    pthread_mutex_unlock(&sp->mutex);
+}
+
+#else /* HAVE_THREADS */
+
+int ff_segprefetch_alloc(SegPrefetch **psp, AVFormatContext *s,
+                         SegPrefetchOpen open, int nb_workers, int64_t max_bytes)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_segprefetch_freep(SegPrefetch **psp)
+{
+}
+
+int ff_segprefetch_has(SegPrefetch *sp, const void *owner, int64_t seq_no)
+{
+    return 0;
+}
+
+int ff_segprefetch_add(SegPrefetch *sp, const void *owner, int64_t seq_no,
+                       int prio, const char *url, int64_t offset, int64_t size,
+                       const AVDictionary *opts)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_segprefetch_reprioritize(SegPrefetch *sp, const void *owner, int64_t cur_seq_no)
+{
+}
+
+SegPrefetchJob *ff_segprefetch_take(SegPrefetch *sp, const void *owner, int64_t seq_no)
+{
+    return NULL;
+}
+
+int ff_segprefetch_read(SegPrefetch *sp, SegPrefetchJob *job, uint8_t *buf, int buf_size)
+{
+    return AVERROR(ENOSYS);
+}
+
+int64_t ff_segprefetch_seek(SegPrefetch *sp, SegPrefetchJob *job, int64_t offset, int whence)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_segprefetch_release(SegPrefetch *sp, SegPrefetchJob **job)
+{
+}
+
+void ff_segprefetch_flush(SegPrefetch *sp, const void *owner)
+{
+}
+
+#endif /* HAVE_THREADS */
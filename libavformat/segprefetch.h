@@ -0,0 +1,136 @@
+/*
+ * Concurrent segment prefetching for segmented streaming demuxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_SEGPREFETCH_H
+#define AVFORMAT_SEGPREFETCH_H
+
+#include <stdint.h>
+
+#include "libavutil/dict.h"
+
+#include "avformat.h"
+
+/**
+ * @file
+ * A pool of worker threads downloading media segments ahead of the
+ * demuxer into memory.
+ *
+ * Segments are identified by an owner (e.g. a playlist or representation)
+ * and a sequence number. The demuxer adds the segments it will need next,
+ * the workers download them in order of priority, and the demuxer takes
+ * a segment over once it gets to it, reading from it while it is still
+ * being downloaded if needed.
+ *
+ * All functions must be called from the demuxer thread.
+ */
+
+typedef struct SegPrefetch SegPrefetch;
+typedef struct SegPrefetchJob SegPrefetchJob;
+
+/**
+ * Callback opening a segment for reading in a worker thread.
+ *
+ * @param s      the demuxer context
+ * @param pb     connection left open by the previous download of the same
+ *               worker, or NULL; the callback must reuse or close it, and
+ *               set it to the opened IO context
+ * @param url    URL of the segment
+ * @param offset byte offset of the segment in the resource
+ * @param size   size of the segment in bytes, or -1 for the whole resource
+ * @param opts   private copy of the IO options given to ff_segprefetch_add()
+ */
+typedef int (*SegPrefetchOpen)(AVFormatContext *s, AVIOContext **pb,
+                               const char *url, int64_t offset, int64_t size,
+                               AVDictionary **opts);
+
+/**
+ * Create a prefetch pool.
+ *
+ * @param nb_workers maximum number of concurrent downloads
+ * @param max_bytes  total size of downloaded data held in memory before
+ *                   workers pause; segments being read are not limited
+ * @return 0 on success, AVERROR(ENOSYS) if threads are not available,
+ *         another negative AVERROR code on failure
+ */
+int ff_segprefetch_alloc(SegPrefetch **sp, AVFormatContext *s,
+                         SegPrefetchOpen open, int nb_workers, int64_t max_bytes);
+
+/**
+ * Stop all workers and free the pool and its segments.
+ */
+void ff_segprefetch_freep(SegPrefetch **sp);
+
+/**
+ * Check whether a segment is queued or downloaded.
+ */
+int ff_segprefetch_has(SegPrefetch *sp, const void *owner, int64_t seq_no);
+
+/**
+ * Queue a segment for download.
+ *
+ * @param prio download priority, lower values are downloaded first
+ */
+int ff_segprefetch_add(SegPrefetch *sp, const void *owner, int64_t seq_no,
+                       int prio, const char *url, int64_t offset, int64_t size,
+                       const AVDictionary *opts);
+
+/**
+ * Update the priority of the segments of an owner to their distance from
+ * the segment currently read, and drop the segments before it.
+ */
+void ff_segprefetch_reprioritize(SegPrefetch *sp, const void *owner, int64_t cur_seq_no);
+
+/**
+ * Take over a segment for reading. Segments still waiting for a worker
+ * are dropped, so that the caller opens them itself without waiting.
+ *
+ * @return the segment, or NULL if it has not been started
+ */
+SegPrefetchJob *ff_segprefetch_take(SegPrefetch *sp, const void *owner, int64_t seq_no);
+
+/**
+ * Read data of a segment taken with ff_segprefetch_take(), waiting for
+ * the download if needed.
+ *
+ * @return number of bytes read, AVERROR_EOF at the end of the segment,
+ *         or the error the download failed with
+ */
+int ff_segprefetch_read(SegPrefetch *sp, SegPrefetchJob *job, uint8_t *buf, int buf_size);
+
+/**
+ * Seek in a segment taken with ff_segprefetch_take(), relative to its
+ * start, waiting for the download if needed. Supports AVSEEK_SIZE if the
+ * segment size is known or the download is complete.
+ *
+ * @return the new position, or a negative AVERROR code on failure
+ */
+int64_t ff_segprefetch_seek(SegPrefetch *sp, SegPrefetchJob *job, int64_t offset, int whence);
+
+/**
+ * Release a segment taken with ff_segprefetch_take().
+ */
+void ff_segprefetch_release(SegPrefetch *sp, SegPrefetchJob **job);
+
+/**
+ * Drop all segments of an owner, e.g. after seeking.
+ */
+void ff_segprefetch_flush(SegPrefetch *sp, const void *owner);
+
+#endif /* AVFORMAT_SEGPREFETCH_H */
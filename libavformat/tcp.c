@@ -18,8 +18,12 @@
  * License along with FFmpeg; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
+
+#define _DEFAULT_SOURCE /* Needed for SO_ZEROCOPY */
+
 #include "avformat.h"
 #include "libavutil/avassert.h"
+#include "libavutil/buffer.h"
 #include "libavutil/mem.h"
 #include "libavutil/parseutils.h"
 #include "libavutil/opt.h"
@@ -32,6 +36,35 @@
 #if HAVE_POLL_H
 #include <poll.h>
 #endif
+#if HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#if HAVE_LINUX_ERRQUEUE_H && HAVE_POLL_H && defined(SO_ZEROCOPY) && \
+    defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define ZEROCOPY_SUPPORTED 1
+#else
+#define ZEROCOPY_SUPPORTED 0
+#endif
+
+/* Size of the AVIOContext buffers handed over to zero-copy sends. Pinning
+ * pages has a fixed cost, so larger sends are cheaper per byte. */
+#define ZEROCOPY_BUFFER_SIZE (256 * 1024)
+/* Smaller writes are copied, pinning the pages and reading the completion
+ * notification would cost more than the copy */
+#define ZEROCOPY_MIN_SIZE 16384
+/* Maximum number of buffers the kernel may still be sending from */
+#define ZEROCOPY_MAX_PENDING 32
+/* Number of completions after which zero-copy sends are disabled if the
+ * kernel copied all the data anyway, e.g. on loopback */
+#define ZEROCOPY_PROBE_COUNT 64
+
+typedef struct ZeroCopyPending {
+    AVBufferRef *buf;
+    uint32_t first_id;  ///< notification id of the first send from buf
+    int nb_ids;         ///< number of sends from buf
+    int nb_completed;   ///< number of those sends completed
+} ZeroCopyPending;
 
 typedef struct TCPContext {
     const AVClass *class;
@@ -49,6 +82,16 @@ typedef struct TCPContext {
 #if !HAVE_WINSOCK2_H
     int tcp_mss;
 #endif /* !HAVE_WINSOCK2_H */
+    int zerocopy;
+#if ZEROCOPY_SUPPORTED
+    int zerocopy_active;
+    ZeroCopyPending pending[ZEROCOPY_MAX_PENDING];
+    int pending_start, nb_pending;
+    uint32_t next_id;
+    int64_t zerocopy_sends;
+    int64_t zerocopy_completed;
+    int64_t zerocopy_copied;
+#endif
 } TCPContext;
 
 #define OFFSET(x) offsetof(TCPContext, x)
@@ -67,6 +110,7 @@ static const AVOption options[] = {
 #if !HAVE_WINSOCK2_H
     { "tcp_mss",     "Maximum segment size for outgoing TCP packets",          OFFSET(tcp_mss),     AV_OPT_TYPE_INT, { .i64 = -1 },         -1, INT_MAX, .flags = D|E },
 #endif /* !HAVE_WINSOCK2_H */
+    { "zerocopy",    "Send output data without copying it to the kernel (MSG_ZEROCOPY)", OFFSET(zerocopy), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = E },
     { NULL }
 };
 
@@ -145,6 +189,219 @@ static int customize_fd(void *ctx, int fd, int family)
     return 0;
 }
 
+#if ZEROCOPY_SUPPORTED
+static void zerocopy_enable(URLContext *h)
+{
+    TCPContext *s = h->priv_data;
+    int one = 1;
+
+    if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+        ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(SO_ZEROCOPY)");
+        return;
+    }
+    s->zerocopy_active = 1;
+}
+
+/**
+ * Release the buffers the kernel is done with, in send order.
+ */
+static void zerocopy_release(TCPContext *s)
+{
+    while (s->nb_pending) {
+        ZeroCopyPending *p = &s->pending[s->pending_start];
+        /* an entry without ids is the one being sent from */
+        if (!p->nb_ids || p->nb_completed < p->nb_ids)
+            break;
+        av_buffer_unref(&p->buf);
+        s->pending_start = (s->pending_start + 1) % ZEROCOPY_MAX_PENDING;
+        s->nb_pending--;
+    }
+}
+
+/**
+ * Account the completion of the sends with ids lo to hi.
+ */
+static void zerocopy_complete(URLContext *h, uint32_t lo, uint32_t hi, int copied)
+{
+    TCPContext *s = h->priv_data;
+    int64_t count = (uint32_t)(hi - lo) + 1LL;
+
+    for (int i = 0; i < s->nb_pending; i++) {
+        ZeroCopyPending *p = &s->pending[(s->pending_start + i) % ZEROCOPY_MAX_PENDING];
+        /* ids wrap around, compare them relative to the first one of p */
+        int64_t start = FFMAX((int32_t)(lo - p->first_id), 0);
+        int64_t end   = FFMIN((int32_t)(hi - p->first_id), p->nb_ids - 1);
+        if (end >= start)
+            p->nb_completed += end - start + 1;
+    }
+    zerocopy_release(s);
+
+    s->zerocopy_completed += count;
+    if (copied)
+        s->zerocopy_copied += count;
+    if (s->zerocopy_active && s->zerocopy_completed >= ZEROCOPY_PROBE_COUNT &&
+        s->zerocopy_copied == s->zerocopy_completed) {
+        av_log(h, AV_LOG_VERBOSE,
+               "The kernel copies the zero-copy sends, disabling them\n");
+        s->zerocopy_active = 0;
+    }
+}
+
+/**
+ * Read the pending completion notifications without blocking.
+ *
+ * @return the number of notifications read, or a negative AVERROR code
+ */
+static int zerocopy_reap(URLContext *h)
+{
+    TCPContext *s = h->priv_data;
+    int nb = 0;
+
+    while (s->nb_pending) {
+        char control[128];
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+        int ret;
+
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        ret = recvmsg(s->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            return ret == AVERROR(EAGAIN) ? nb : ret;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            const struct sock_extended_err *serr;
+            if (!(cmsg->cmsg_level == IPPROTO_IP   && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            serr = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno)
+                continue;
+            zerocopy_complete(h, serr->ee_info, serr->ee_data,
+                              serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            nb++;
+        }
+    }
+    return nb;
+}
+
+/**
+ * Wait until at least one pending send completes.
+ */
+static int zerocopy_wait(URLContext *h)
+{
+    TCPContext *s = h->priv_data;
+    int64_t wait_start = 0;
+
+    while (1) {
+        /* notifications are signalled with POLLERR */
+        struct pollfd p = { .fd = s->fd, .events = 0, .revents = 0 };
+        int ret;
+
+        if (ff_check_interrupt(&h->interrupt_callback))
+            return AVERROR_EXIT;
+        ret = poll(&p, 1, POLLING_TIME);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret != AVERROR(EINTR))
+                return ret;
+        } else if (ret > 0) {
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+
+            ret = zerocopy_reap(h);
+            if (ret)
+                return ret;
+            /* POLLERR without notification: the connection failed */
+            if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &err_len))
+                return ff_neterrno();
+            if (err)
+                return AVERROR(err);
+            if (p.revents & POLLHUP)
+                return AVERROR(EPIPE);
+        }
+        if (h->rw_timeout > 0) {
+            if (!wait_start)
+                wait_start = av_gettime_relative();
+            else if (av_gettime_relative() - wait_start > h->rw_timeout)
+                return AVERROR(ETIMEDOUT);
+        }
+    }
+}
+
+static int tcp_write_buffer(URLContext *h, AVBufferRef *buf, int size)
+{
+    TCPContext *s = h->priv_data;
+    ZeroCopyPending *p;
+    int ret, copy = 0, written = 0;
+
+    if (!buf)
+        return s->zerocopy_active && !(h->flags & AVIO_FLAG_NONBLOCK) ?
+               ZEROCOPY_BUFFER_SIZE : AVERROR(ENOSYS);
+
+    if ((ret = zerocopy_reap(h)) < 0)
+        return ret;
+    while (s->nb_pending == ZEROCOPY_MAX_PENDING)
+        if ((ret = zerocopy_wait(h)) < 0)
+            return ret;
+
+    p = &s->pending[(s->pending_start + s->nb_pending) % ZEROCOPY_MAX_PENDING];
+    p->buf = av_buffer_ref(buf);
+    if (!p->buf)
+        return AVERROR(ENOMEM);
+    p->first_id     = s->next_id;
+    p->nb_ids       = 0;
+    p->nb_completed = 0;
+    s->nb_pending++;
+
+    while (written < size) {
+        int flags = MSG_NOSIGNAL;
+
+        ret = ff_network_wait_fd_timeout(s->fd, 1, h->rw_timeout, &h->interrupt_callback);
+        if (ret < 0)
+            break;
+        if (s->zerocopy_active && !copy && size >= ZEROCOPY_MIN_SIZE)
+            flags |= MSG_ZEROCOPY;
+        ret = send(s->fd, buf->data + written, size - written, flags);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret == AVERROR(EAGAIN)) {
+                /* woken up by completion notifications */
+                ret = zerocopy_reap(h);
+            } else if (ret == AVERROR(ENOBUFS) && (flags & MSG_ZEROCOPY)) {
+                /* too much memory pinned: wait until the kernel releases
+                 * some, or copy this time if there is nothing to wait for */
+                if (s->zerocopy_sends > s->zerocopy_completed) {
+                    ret = zerocopy_wait(h);
+                } else {
+                    copy = 1;
+                    ret  = 0;
+                }
+            }
+            if (ret < 0)
+                break;
+            continue;
+        }
+        if (flags & MSG_ZEROCOPY) {
+            s->next_id++;
+            s->zerocopy_sends++;
+            p->nb_ids++;
+        }
+        copy     = 0;
+        written += ret;
+    }
+
+    if (!p->nb_ids) {
+        /* nothing references buf, p is still the last entry */
+        av_buffer_unref(&p->buf);
+        s->nb_pending--;
+    }
+    zerocopy_release(s);
+    return ret < 0 ? ret : written;
+}
+#endif /* ZEROCOPY_SUPPORTED */
+
 /* return non zero if error */
 static int tcp_open(URLContext *h, const char *uri, int flags)
 {
@@ -237,6 +494,13 @@ static int tcp_open(URLContext *h, const char *uri, int flags)
 
     h->is_streamed = 1;
     s->fd = fd;
+    if (s->zerocopy && s->listen != 2 && (h->flags & AVIO_FLAG_WRITE)) {
+#if ZEROCOPY_SUPPORTED
+        zerocopy_enable(h);
+#else
+        av_log(h, AV_LOG_WARNING, "Zero-copy sends are not supported\n");
+#endif
+    }
 
     freeaddrinfo(ai);
     return 0;
@@ -263,6 +527,10 @@ static int tcp_accept(URLContext *s, URLContext **c)
         return ret;
     }
     cc->fd = ret;
+#if ZEROCOPY_SUPPORTED
+    if (sc->zerocopy && ((*c)->flags & AVIO_FLAG_WRITE))
+        zerocopy_enable(*c);
+#endif
     return 0;
 }
 
@@ -271,6 +539,11 @@ static int tcp_read(URLContext *h, uint8_t *buf, int size)
     TCPContext *s = h->priv_data;
     int ret;
 
+#if ZEROCOPY_SUPPORTED
+    /* pending notifications would make the wait below return at once */
+    if (s->nb_pending && (ret = zerocopy_reap(h)) < 0)
+        return ret;
+#endif
     if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = ff_network_wait_fd_timeout(s->fd, 0, h->rw_timeout, &h->interrupt_callback);
         if (ret)
@@ -287,6 +560,10 @@ static int tcp_write(URLContext *h, const uint8_t *buf, int size)
     TCPContext *s = h->priv_data;
     int ret;
 
+#if ZEROCOPY_SUPPORTED
+    if (s->nb_pending && (ret = zerocopy_reap(h)) < 0)
+        return ret;
+#endif
     if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = ff_network_wait_fd_timeout(s->fd, 1, h->rw_timeout, &h->interrupt_callback);
         if (ret)
@@ -315,7 +592,28 @@ static int tcp_shutdown(URLContext *h, int flags)
 static int tcp_close(URLContext *h)
 {
     TCPContext *s = h->priv_data;
+#if ZEROCOPY_SUPPORTED
+    /* the buffers must not be reused before the kernel is done with them */
+    while (s->nb_pending) {
+        if (zerocopy_wait(h) < 0) {
+            av_log(h, AV_LOG_WARNING,
+                   "Closing with %d zero-copy buffers still being sent\n",
+                   s->nb_pending);
+            break;
+        }
+    }
+    if (s->zerocopy_sends)
+        av_log(h, AV_LOG_VERBOSE,
+               "%"PRId64" zero-copy sends, %"PRId64" copied by the kernel\n",
+               s->zerocopy_sends, s->zerocopy_copied);
+#endif
     closesocket(s->fd);
+#if ZEROCOPY_SUPPORTED
+    for (; s->nb_pending; s->nb_pending--) {
+        av_buffer_unref(&s->pending[s->pending_start].buf);
+        s->pending_start = (s->pending_start + 1) % ZEROCOPY_MAX_PENDING;
+    }
+#endif
     return 0;
 }
 
@@ -351,6 +649,9 @@ const URLProtocol ff_tcp_protocol = {
     .url_accept          = tcp_accept,
     .url_read            = tcp_read,
     .url_write           = tcp_write,
+#if ZEROCOPY_SUPPORTED
+    .url_write_buffer    = tcp_write_buffer,
+#endif
     .url_close           = tcp_close,
     .url_get_file_handle = tcp_get_file_handle,
     .url_get_short_seek  = tcp_get_window_size,
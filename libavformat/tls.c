@@ -110,6 +110,19 @@ int ff_tls_open_underlying(TLSShared *c, URLContext *parent, const char *uri, AV
     return ret;
 }
 
+int ff_tls_set_interrupt_callback(URLContext *h, const AVIOInterruptCB *int_cb)
+{
+    /* all TLS backends start their private context with TLSShared */
+    TLSShared *c = h->priv_data;
+
+    if (c->is_dtls || c->external_sock || !c->tcp || strcmp(c->tcp->prot->name, "tcp"))
+        return AVERROR(ENOSYS);
+
+    h->interrupt_callback      = *int_cb;
+    c->tcp->interrupt_callback = *int_cb;
+    return 0;
+}
+
 /**
  * Read all data from the given URL url and store it in the given buffer bp.
  */
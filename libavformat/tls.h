@@ -101,6 +101,15 @@ int ff_url_read_all(const char *url, AVBPrint *bp);
 
 int ff_tls_set_external_socket(URLContext *h, URLContext *sock);
 
+/**
+ * Set the interrupt callback of a TLS client connection and of the TCP
+ * connection it runs over.
+ *
+ * @return 0 on success, AVERROR(ENOSYS) if the TLS connection does not run
+ *         directly over TCP
+ */
+int ff_tls_set_interrupt_callback(URLContext *h, const AVIOInterruptCB *int_cb);
+
 int ff_dtls_export_materials(URLContext *h, char *dtls_srtp_materials, size_t materials_sz);
 
 int ff_ssl_read_key_cert(char *key_url, char *cert_url, char *key_buf, size_t key_sz, char *cert_buf, size_t cert_sz, char **fingerprint);
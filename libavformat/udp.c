@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
 
 #include "avformat.h"
 #include "libavutil/avassert.h"
@@ -69,6 +70,10 @@
 #include "libavutil/thread.h"
 #endif
 
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+#include <netinet/udp.h>
+#endif
+
 #ifndef IPV6_ADD_MEMBERSHIP
 #define IPV6_ADD_MEMBERSHIP IPV6_JOIN_GROUP
 #define IPV6_DROP_MEMBERSHIP IPV6_LEAVE_GROUP
@@ -78,6 +83,11 @@
 #define UDP_RX_BUF_SIZE 393216
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_MAX_BATCH_SIZE 1024
+/* Limits of a single UDP_SEGMENT send: the kernel accepts at most 64
+ * segments, and the payload has to fit a single IPv6 datagram. */
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_BYTES (65535 - UDP_HEADER_SIZE - 40)
 
 typedef struct UDPQueuedPacketHeader {
     int pkt_size;
@@ -85,6 +95,19 @@ typedef struct UDPQueuedPacketHeader {
     socklen_t addr_len;
 } UDPQueuedPacketHeader;
 
+/* One datagram (or one GRO/GSO train of datagrams) of a batch. */
+typedef struct UDPBatchSlot {
+    UDPQueuedPacketHeader hdr;
+    uint8_t *data;
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        uint8_t buf[64];
+    } control;
+#endif
+} UDPBatchSlot;
+
 typedef struct UDPContext {
     const AVClass *class;
     int udp_fd;
@@ -114,8 +137,20 @@ typedef struct UDPContext {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int thread_started;
+    UDPBatchSlot *slots;
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    struct mmsghdr *msgs;
+#endif
+    uint8_t *batch_buf;
+    int batch_buf_size;
 #endif
-    uint8_t tmp[UDP_MAX_PKT_SIZE + sizeof(UDPQueuedPacketHeader)];
+    int batch_size;
+    int gro;
+    int gso;
+    int64_t dropped_packets;
+    int64_t kernel_dropped;
+    int64_t batch_calls;
+    int64_t batch_packets;
     int remaining_in_dg;
     char *localaddr;
     int timeout;
@@ -151,6 +186,13 @@ static const AVOption options[] = {
     { "timeout",        "set raise error timeout, in microseconds (only in read mode)",OFFSET(timeout),         AV_OPT_TYPE_INT,  {.i64 = 0}, 0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
+    { "batch_size",     "Maximum number of datagrams per system call (circular buffer only)", OFFSET(batch_size), AV_OPT_TYPE_INT, { .i64 = 1 }, 1, UDP_MAX_BATCH_SIZE, .flags = D|E },
+    { "gro",            "Use UDP generic receive offload (circular buffer only)", OFFSET(gro),     AV_OPT_TYPE_BOOL,   { .i64 = 0  },     0, 1,       D },
+    { "gso",            "Use UDP generic segmentation offload (circular buffer only)", OFFSET(gso), AV_OPT_TYPE_BOOL,  { .i64 = 0  },     0, 1,       E },
+    { "dropped_packets", "export the number of datagrams dropped on circular buffer overrun", OFFSET(dropped_packets), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "kernel_dropped", "export the number of datagrams dropped by the socket receive buffer", OFFSET(kernel_dropped), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "batch_calls",    "export the number of batched system calls",       OFFSET(batch_calls),    AV_OPT_TYPE_INT64,  { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "batch_packets",  "export the number of datagrams moved by batched system calls", OFFSET(batch_packets), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { NULL }
 };
 
@@ -526,6 +568,174 @@ static int udp_get_file_handle(URLContext *h)
 }
 
 #if HAVE_PTHREAD_CANCEL
+static void udp_batch_free(UDPContext *s)
+{
+    av_freep(&s->slots);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    av_freep(&s->msgs);
+#endif
+    av_freep(&s->batch_buf);
+}
+
+static int udp_batch_init(URLContext *h, int is_output)
+{
+    UDPContext *s = h->priv_data;
+    int64_t buf_size;
+
+    if (!is_output) {
+#if !HAVE_RECVMMSG
+        if (s->batch_size > 1)
+            av_log(h, AV_LOG_WARNING, "'batch_size' option was set but it is not "
+                   "supported on this build (recvmmsg support is required)\n");
+        s->batch_size = 1;
+#endif
+        if (s->gro) {
+#if HAVE_RECVMMSG && defined(UDP_GRO)
+            int one = 1;
+            if (setsockopt(s->udp_fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+                ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(UDP_GRO)");
+                s->gro = 0;
+            }
+#else
+            av_log(h, AV_LOG_WARNING, "'gro' option was set but it is not "
+                   "supported on this build\n");
+            s->gro = 0;
+#endif
+        }
+#if HAVE_RECVMMSG && defined(SO_RXQ_OVFL)
+        {
+            /* Failure only means the kernel drop counter stays at zero. */
+            int one = 1;
+            setsockopt(s->udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+        }
+#endif
+        buf_size = (int64_t)s->batch_size * UDP_MAX_PKT_SIZE;
+    } else {
+        if (s->gso) {
+#if HAVE_SENDMMSG && defined(UDP_SEGMENT)
+            /* Only probe for support, the segment size is set per message. */
+            int zero = 0;
+            if (setsockopt(s->udp_fd, IPPROTO_UDP, UDP_SEGMENT, &zero, sizeof(zero)) < 0) {
+                ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(UDP_SEGMENT)");
+                s->gso = 0;
+            }
+#else
+            av_log(h, AV_LOG_WARNING, "'gso' option was set but it is not "
+                   "supported on this build\n");
+            s->gso = 0;
+#endif
+        }
+        buf_size = FFMAX((int64_t)s->batch_size * h->max_packet_size,
+                         UDP_MAX_PKT_SIZE);
+    }
+    if (buf_size > INT_MAX)
+        return AVERROR(EINVAL);
+    s->batch_buf_size = buf_size;
+
+    s->slots     = av_calloc(s->batch_size, sizeof(*s->slots));
+    s->batch_buf = av_malloc(s->batch_buf_size);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    s->msgs      = av_calloc(s->batch_size, sizeof(*s->msgs));
+    if (!s->msgs)
+        return AVERROR(ENOMEM);
+#endif
+    if (!s->slots || !s->batch_buf)
+        return AVERROR(ENOMEM);
+
+    if (!is_output) {
+        for (int i = 0; i < s->batch_size; i++) {
+            UDPBatchSlot *slot = &s->slots[i];
+
+            slot->data = s->batch_buf + (size_t)i * UDP_MAX_PKT_SIZE;
+#if HAVE_RECVMMSG
+            slot->iov.iov_base = slot->data;
+            slot->iov.iov_len  = UDP_MAX_PKT_SIZE;
+            s->msgs[i].msg_hdr.msg_name    = &slot->hdr.addr;
+            s->msgs[i].msg_hdr.msg_iov     = &slot->iov;
+            s->msgs[i].msg_hdr.msg_iovlen  = 1;
+            s->msgs[i].msg_hdr.msg_control = slot->control.buf;
+#endif
+        }
+    }
+
+    return 0;
+}
+
+static int udp_recv_batch(UDPContext *s)
+{
+#if HAVE_RECVMMSG
+    for (int i = 0; i < s->batch_size; i++) {
+        struct msghdr *msg = &s->msgs[i].msg_hdr;
+        msg->msg_namelen    = sizeof(s->slots[i].hdr.addr);
+        msg->msg_controllen = sizeof(s->slots[i].control);
+        msg->msg_flags      = 0;
+    }
+    return recvmmsg(s->udp_fd, s->msgs, s->batch_size, MSG_WAITFORONE, NULL);
+#else
+    UDPQueuedPacketHeader *hdr = &s->slots[0].hdr;
+
+    hdr->addr_len = sizeof(hdr->addr);
+    hdr->pkt_size = recvfrom(s->udp_fd, s->slots[0].data, UDP_MAX_PKT_SIZE, 0,
+                             (struct sockaddr *)&hdr->addr, &hdr->addr_len);
+    return hdr->pkt_size < 0 ? hdr->pkt_size : 1;
+#endif
+}
+
+/**
+ * Complete the header of a received batch slot.
+ *
+ * @return the GRO segment size, or 0 if the slot holds a single datagram
+ */
+static int udp_recv_slot(UDPContext *s, int i)
+{
+    int segment_size = 0;
+#if HAVE_RECVMMSG
+    struct msghdr *msg = &s->msgs[i].msg_hdr;
+    UDPBatchSlot *slot = &s->slots[i];
+
+    slot->hdr.pkt_size = s->msgs[i].msg_len;
+    slot->hdr.addr_len = msg->msg_namelen;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef UDP_GRO
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+            memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+#endif
+#ifdef SO_RXQ_OVFL
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t dropped;
+            memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+            s->kernel_dropped = dropped;
+        }
+#endif
+    }
+#endif
+    return segment_size;
+}
+
+static int udp_queue_packet(URLContext *h, const UDPQueuedPacketHeader *hdr,
+                            const uint8_t *data)
+{
+    UDPContext *s = h->priv_data;
+
+    if (av_fifo_can_write(s->rx_fifo) < hdr->pkt_size + sizeof(*hdr)) {
+        /* No Space left */
+        s->dropped_packets++;
+        if (s->overrun_nonfatal) {
+            av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                    "Surviving due to overrun_nonfatal option\n");
+            return 0;
+        } else {
+            av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                    "To avoid, increase fifo_size URL option. "
+                    "To survive in such case, use overrun_nonfatal option\n");
+            return AVERROR(EIO);
+        }
+    }
+    av_fifo_write(s->rx_fifo, hdr, sizeof(*hdr));
+    av_fifo_write(s->rx_fifo, data, hdr->pkt_size);
+    return 0;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -542,43 +752,47 @@ static void *circular_buffer_task_rx( void *_URLContext)
         goto end;
     }
     while(1) {
-        UDPQueuedPacketHeader pkt_header;
-        pkt_header.addr_len = sizeof(pkt_header.addr);
+        int nb_slots;
 
         pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancellation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        pkt_header.pkt_size = recvfrom(s->udp_fd, s->tmp + sizeof(pkt_header), sizeof(s->tmp) - sizeof(pkt_header), 0, (struct sockaddr *)&pkt_header.addr, &pkt_header.addr_len);
+        nb_slots = udp_recv_batch(s);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
         pthread_mutex_lock(&s->mutex);
-        if (pkt_header.pkt_size < 0) {
+        if (nb_slots < 0) {
             if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
                 s->circular_buffer_error = ff_neterrno();
                 goto end;
             }
             continue;
         }
-        if (ff_ip_check_source_lists(&pkt_header.addr, &s->filters))
-            continue;
-        memcpy(s->tmp, &pkt_header, sizeof(pkt_header));
-
-        if (av_fifo_can_write(s->rx_fifo) < pkt_header.pkt_size + sizeof(pkt_header)) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
+        s->batch_calls++;
+        for (int i = 0; i < nb_slots; i++) {
+            int segment_size = udp_recv_slot(s, i);
+            UDPQueuedPacketHeader pkt_header = s->slots[i].hdr;
+            const uint8_t *data = s->slots[i].data;
+            int left = pkt_header.pkt_size;
+
+            if (ff_ip_check_source_lists(&pkt_header.addr, &s->filters))
                 continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
-            }
+            /* A GRO train is queued as the datagrams it was built from. */
+            do {
+                int ret;
+
+                pkt_header.pkt_size = segment_size > 0 ? FFMIN(segment_size, left) : left;
+                ret = udp_queue_packet(h, &pkt_header, data);
+                if (ret < 0) {
+                    s->circular_buffer_error = ret;
+                    goto end;
+                }
+                s->batch_packets++;
+                data += pkt_header.pkt_size;
+                left -= pkt_header.pkt_size;
+            } while (left > 0);
         }
-        av_fifo_write(s->rx_fifo, s->tmp, pkt_header.pkt_size + sizeof(pkt_header));
         pthread_cond_signal(&s->cond);
     }
 
@@ -588,6 +802,96 @@ end:
     return NULL;
 }
 
+static int udp_send_batch(URLContext *h, int nb_slots)
+{
+    UDPContext *s = h->priv_data;
+#if HAVE_SENDMMSG
+    int nb_msgs = 0;
+
+    for (int i = 0; i < nb_slots; nb_msgs++) {
+        UDPBatchSlot *slot = &s->slots[nb_msgs];
+        struct msghdr *msg = &s->msgs[nb_msgs].msg_hdr;
+        int segment_size = s->slots[i].hdr.pkt_size;
+        int n = 1, size = segment_size;
+
+        /* Consecutive datagrams of equal size, of which only the last one
+         * may be shorter, are sent as one GSO train. They are contiguous
+         * in the batch buffer. */
+        if (s->gso) {
+            while (i + n < nb_slots && n < UDP_GSO_MAX_SEGMENTS &&
+                   s->slots[i + n - 1].hdr.pkt_size == segment_size &&
+                   s->slots[i + n].hdr.pkt_size > 0 &&
+                   s->slots[i + n].hdr.pkt_size <= segment_size &&
+                   size + s->slots[i + n].hdr.pkt_size <= UDP_GSO_MAX_BYTES) {
+                size += s->slots[i + n].hdr.pkt_size;
+                n++;
+            }
+        }
+
+        memset(msg, 0, sizeof(*msg));
+        if (!s->is_connected) {
+            msg->msg_name    = &s->dest_addr;
+            msg->msg_namelen = s->dest_addr_len;
+        }
+        slot->iov.iov_base = s->slots[i].data;
+        slot->iov.iov_len  = size;
+        msg->msg_iov    = &slot->iov;
+        msg->msg_iovlen = 1;
+#ifdef UDP_SEGMENT
+        if (n > 1) {
+            uint16_t gso_size = segment_size;
+            struct cmsghdr *cmsg;
+
+            msg->msg_control    = slot->control.buf;
+            msg->msg_controllen = CMSG_SPACE(sizeof(gso_size));
+            cmsg = CMSG_FIRSTHDR(msg);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type  = UDP_SEGMENT;
+            cmsg->cmsg_len   = CMSG_LEN(sizeof(gso_size));
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        }
+#endif
+        i += n;
+    }
+
+    for (int i = 0; i < nb_msgs;) {
+        int ret = sendmmsg(s->udp_fd, s->msgs + i, nb_msgs - i, 0);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                return ret;
+            continue;
+        }
+        i += ret;
+    }
+#else
+    for (int i = 0; i < nb_slots; i++) {
+        const uint8_t *p = s->slots[i].data;
+        int len = s->slots[i].hdr.pkt_size;
+
+        while (len) {
+            int ret;
+            av_assert0(len > 0);
+            if (!s->is_connected) {
+                ret = sendto (s->udp_fd, p, len, 0,
+                            (struct sockaddr *) &s->dest_addr,
+                            s->dest_addr_len);
+            } else
+                ret = send(s->udp_fd, p, len, 0);
+            if (ret >= 0) {
+                len -= ret;
+                p   += ret;
+            } else {
+                ret = ff_neterrno();
+                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                    return ret;
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
 static void *circular_buffer_task_tx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -609,8 +913,7 @@ static void *circular_buffer_task_tx( void *_URLContext)
     }
 
     for(;;) {
-        int len;
-        const uint8_t *p;
+        int len, ret, size = 0, nb_slots = 0;
         uint8_t tmp[4];
         int64_t timestamp;
 
@@ -623,14 +926,27 @@ static void *circular_buffer_task_tx( void *_URLContext)
             len = av_fifo_can_read(s->tx_fifo);
         }
 
-        av_fifo_read(s->tx_fifo, tmp, 4);
-        len = AV_RL32(tmp);
+        /* Take as many queued datagrams as fit in one batch. */
+        do {
+            UDPBatchSlot *slot = &s->slots[nb_slots];
 
-        av_assert0(len >= 0);
-        av_assert0(len <= sizeof(s->tmp));
+            av_fifo_peek(s->tx_fifo, tmp, 4, 0);
+            len = AV_RL32(tmp);
 
-        av_fifo_read(s->tx_fifo, s->tmp, len);
+            av_assert0(len >= 0);
+            av_assert0(len <= s->batch_buf_size);
 
+            if (size + len > s->batch_buf_size)
+                break;
+            av_fifo_drain2(s->tx_fifo, 4);
+            slot->data         = s->batch_buf + size;
+            slot->hdr.pkt_size = len;
+            av_fifo_read(s->tx_fifo, slot->data, len);
+            size += len;
+        } while (++nb_slots < s->batch_size && av_fifo_can_read(s->tx_fifo) >= 4);
+
+        /* Wake up udp_write() if it is waiting for space. */
+        pthread_cond_signal(&s->cond);
         pthread_mutex_unlock(&s->mutex);
 
         if (s->bitrate) {
@@ -649,35 +965,21 @@ static void *circular_buffer_task_tx( void *_URLContext)
                     sent_bits = 0;
                 }
             }
-            sent_bits += len * 8;
+            sent_bits += size * 8;
             target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
-        p = s->tmp;
-        while (len) {
-            int ret;
-            av_assert0(len > 0);
-            if (!s->is_connected) {
-                ret = sendto (s->udp_fd, p, len, 0,
-                            (struct sockaddr *) &s->dest_addr,
-                            s->dest_addr_len);
-            } else
-                ret = send(s->udp_fd, p, len, 0);
-            if (ret >= 0) {
-                len -= ret;
-                p   += ret;
-            } else {
-                ret = ff_neterrno();
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
-                    pthread_mutex_lock(&s->mutex);
-                    s->circular_buffer_error = ret;
-                    pthread_mutex_unlock(&s->mutex);
-                    return NULL;
-                }
-            }
-        }
+        ret = udp_send_batch(h, nb_slots);
 
         pthread_mutex_lock(&s->mutex);
+        if (ret < 0) {
+            s->circular_buffer_error = ret;
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+            return NULL;
+        }
+        s->batch_calls++;
+        s->batch_packets += nb_slots;
     }
 
 end:
@@ -715,8 +1017,8 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             goto fail;
     }
     if (!HAVE_PTHREAD_CANCEL) {
-        int64_t      optvals[] = {s->overrun_nonfatal, s->bitrate, s->circular_buffer_size};
-        const char* optnames[] = {  "overrun_nonfatal",  "bitrate",  "fifo_size"};
+        int64_t      optvals[] = {s->overrun_nonfatal, s->bitrate, s->circular_buffer_size, s->batch_size > 1, s->gro, s->gso};
+        const char* optnames[] = {  "overrun_nonfatal",  "bitrate",  "fifo_size",            "batch_size",        "gro",  "gso"};
         for (unsigned i = 0; i < FF_ARRAY_ELEMS(optvals); i++) {
             if (optvals[i])
                 av_log(h, AV_LOG_WARNING,
@@ -908,6 +1210,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
       Create thread in case of:
       1. Input and circular_buffer_size is set
       2. Output and bitrate and circular_buffer_size is set
+      3. Output and batching or GSO and circular_buffer_size is set
     */
 
     if (is_output && s->bitrate && !s->circular_buffer_size) {
@@ -915,7 +1218,8 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         av_log(h, AV_LOG_WARNING,"'bitrate' option was set but 'circular_buffer_size' is not, but required\n");
     }
 
-    if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
+    if ((!is_output && s->circular_buffer_size) ||
+        (is_output && (s->bitrate || s->batch_size > 1 || s->gso) && s->circular_buffer_size)) {
         /* start the task going */
         AVFifo *fifo = av_fifo_alloc2(s->circular_buffer_size, 1, 0);
         if (!fifo) {
@@ -926,6 +1230,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             s->tx_fifo = fifo;
         else
             s->rx_fifo = fifo;
+        ret = udp_batch_init(h, is_output);
+        if (ret < 0)
+            goto fail;
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -960,6 +1267,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         closesocket(udp_fd);
     av_fifo_freep2(&s->rx_fifo);
     av_fifo_freep2(&s->tx_fifo);
+#if HAVE_PTHREAD_CANCEL
+    udp_batch_free(s);
+#endif
     ff_ip_reset_filters(&s->filters);
     return ret;
 }
@@ -1052,6 +1362,13 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
 
         pthread_mutex_lock(&s->mutex);
 
+        /* Without a bitrate the thread sends as fast as it can, so wait
+         * for it to make room instead of failing. */
+        while (!s->bitrate && !(h->flags & AVIO_FLAG_NONBLOCK) &&
+               !s->circular_buffer_error && size + 4 <= s->circular_buffer_size &&
+               av_fifo_can_write(s->tx_fifo) < size + 4)
+            pthread_cond_wait(&s->cond, &s->mutex);
+
         /*
           Return error if last tx failed.
           Here we can't know on which packet error was, but it needs to know that error exists.
@@ -1128,7 +1445,12 @@ static int udp_close(URLContext *h)
             av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", strerror(ret));
         pthread_mutex_destroy(&s->mutex);
         pthread_cond_destroy(&s->cond);
+        if (s->batch_calls)
+            av_log(h, AV_LOG_VERBOSE, "%"PRId64" datagrams in %"PRId64" system calls, "
+                   "%"PRId64" dropped on overrun, %"PRId64" dropped by the kernel\n",
+                   s->batch_packets, s->batch_calls, s->dropped_packets, s->kernel_dropped);
     }
+    udp_batch_free(s);
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep2(&s->rx_fifo);
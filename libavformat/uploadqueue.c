@@ -0,0 +1,503 @@
+/*
+ * Asynchronous uploads for segmented streaming muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "config_components.h"
+
+#include <string.h>
+
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#include "avio_internal.h"
+#include "http.h"
+#include "internal.h"
+#include "uploadqueue.h"
+#include "url.h"
+
+#define RETRY_DELAY     100000
+#define RETRY_DELAY_MAX 2000000
+
+typedef struct UploadFile {
+    AVIOContext **pb;   ///< where the muxer holds the IO context
+    AVIOContext *dyn;
+    char *url;
+    AVDictionary *opts;
+    int flags;
+} UploadFile;
+
+typedef struct UploadJob {
+    struct UploadJob *next;
+    char *url;
+    AVDictionary *opts;
+    int flags;
+    int running;
+
+    uint8_t *data;
+    int size;
+    int64_t queued;     ///< time the job was queued at
+} UploadJob;
+
+struct UploadQueue {
+    AVFormatContext *s;
+    int max_retries;
+    int64_t max_bytes;
+    int persistent;
+
+    /* Only accessed by the muxer thread. */
+    UploadFile *files;
+    int nb_files;
+
+    /* Everything below is protected by mutex. */
+    UploadJob *jobs;
+    int64_t bytes;
+    int error;
+    int abort;
+
+    /* statistics */
+    int nb_queued;
+    int nb_uploaded;
+    int nb_retries;
+    int nb_failed;
+    int max_depth;
+    int64_t sum_depth;
+    int64_t bytes_uploaded;
+    int64_t max_latency;
+    int64_t blocked;
+
+#if HAVE_THREADS
+    pthread_t *workers;
+    int nb_workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_worker;
+    pthread_cond_t cond_muxer;
+#endif
+};
+
+#if HAVE_THREADS
+
+static void job_free(UploadJob *job)
+{
+    av_dict_free(&job->opts);
+    av_free(job->url);
+    av_free(job->data);
+    av_free(job);
+}
+
+static void job_unlink(UploadQueue *uq, UploadJob *job)
+{
+    for (UploadJob **p = &uq->jobs; *p; p = &(*p)->next) {
+        if (*p == job) {
+            *p = job->next;
+            job->next = NULL;
+            uq->bytes -= job->size;
+            return;
+        }
+    }
+}
+
+static int queue_depth(UploadQueue *uq)
+{
+    int depth = 0;
+    for (UploadJob *job = uq->jobs; job; job = job->next)
+        depth++;
+    return depth;
+}
+
+/*
+ * Ordered jobs can only start once all the jobs queued before them are
+ * done, i.e. when they are at the head of the queue.
+ */
+static UploadJob *next_job(UploadQueue *uq)
+{
+    for (UploadJob *job = uq->jobs; job; job = job->next)
+        if (!job->running && (!(job->flags & FF_UPLOAD_ORDERED) || job == uq->jobs))
+            return job;
+    return NULL;
+}
+
+/**
+ * Upload a job once, without holding the mutex.
+ *
+ * @param pb connection of the worker, left open after a successful upload
+ *           if connections are persistent
+ */
+static int upload(UploadQueue *uq, const UploadJob *job, AVIOContext **pb)
+{
+    AVFormatContext *s = uq->s;
+    AVDictionary *opts = NULL;
+    int ret, ret2;
+
+    ret = av_dict_copy(&opts, job->opts, 0);
+    if (ret < 0)
+        return ret;
+
+#if CONFIG_HTTP_PROTOCOL
+    if (*pb) {
+        URLContext *uc = ffio_geturlcontext(*pb);
+        /* The connection keeps the method of its previous request, e.g.
+         * DELETE, unless it is set explicitly. POST is the HTTP protocol
+         * default for writing. */
+        if (!av_dict_get(opts, "method", NULL, 0))
+            ret = av_dict_set(&opts, "method", "POST", 0);
+        if (ret >= 0)
+            ret = uc ? ff_http_do_new_request2(uc, job->url, &opts) : AVERROR(EINVAL);
+        if (ret < 0)
+            ff_format_io_close(s, pb);
+    }
+#endif
+    if (!*pb)
+        ret = s->io_open(s, pb, job->url, AVIO_FLAG_WRITE, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+
+    avio_write(*pb, job->data, job->size);
+    avio_flush(*pb);
+    ret = (*pb)->error;
+
+#if CONFIG_HTTP_PROTOCOL
+    /* see hlsenc_io_close() */
+    if (ret >= 0 && uq->persistent) {
+        URLContext *uc = ffio_geturlcontext(*pb);
+        ret = uc ? ffurl_shutdown(uc, AVIO_FLAG_WRITE) : AVERROR(EINVAL);
+        if (ret >= 0)
+            return 0;
+    }
+#endif
+    ret2 = ff_format_io_close(s, pb);
+    return ret < 0 ? ret : ret2;
+}
+
+static void run_job(UploadQueue *uq, UploadJob *job, AVIOContext **pb)
+{
+    int64_t delay = RETRY_DELAY;
+    int64_t start;
+    int ret, tries = 0;
+
+    job->running = 1;
+    pthread_mutex_unlock(&uq->mutex);
+
+    start = av_gettime_relative();
+    for (;;) {
+        int abort;
+
+        ret = upload(uq, job, pb);
+        if (ret >= 0 || tries++ >= uq->max_retries ||
+            ff_check_interrupt(&uq->s->interrupt_callback))
+            break;
+
+        pthread_mutex_lock(&uq->mutex);
+        abort = uq->abort;
+        uq->nb_retries++;
+        pthread_mutex_unlock(&uq->mutex);
+        if (abort)
+            break;
+
+        av_log(uq->s, AV_LOG_WARNING, "Upload of '%s' failed: %s, retrying\n",
+               job->url, av_err2str(ret));
+        av_usleep(delay);
+        delay = FFMIN(2 * delay, RETRY_DELAY_MAX);
+    }
+
+    if (ret < 0) {
+        av_log(uq->s, AV_LOG_ERROR, "Failed to upload '%s': %s\n",
+               job->url, av_err2str(ret));
+    } else {
+        av_log(uq->s, AV_LOG_DEBUG, "Uploaded '%s', %d bytes in %.3fs\n",
+               job->url, job->size, (av_gettime_relative() - start) / 1000000.0);
+    }
+
+    pthread_mutex_lock(&uq->mutex);
+    if (ret < 0) {
+        uq->nb_failed++;
+        if (!uq->error)
+            uq->error = ret;
+    } else {
+        uq->nb_uploaded++;
+        uq->bytes_uploaded += job->size;
+    }
+    uq->max_latency = FFMAX(uq->max_latency, av_gettime_relative() - job->queued);
+    job_unlink(uq, job);
+    job_free(job);
+    /* The next ordered job may be at the head now. */
+    pthread_cond_broadcast(&uq->cond_worker);
+    pthread_cond_broadcast(&uq->cond_muxer);
+}
+
+static void *worker_thread(void *arg)
+{
+    UploadQueue *uq = arg;
+    AVIOContext *pb = NULL;
+
+    pthread_mutex_lock(&uq->mutex);
+    while (!uq->abort) {
+        UploadJob *job = next_job(uq);
+        if (!job) {
+            pthread_cond_wait(&uq->cond_worker, &uq->mutex);
+            continue;
+        }
+        run_job(uq, job, &pb);
+    }
+    pthread_mutex_unlock(&uq->mutex);
+
+    ff_format_io_close(uq->s, &pb);
+    return NULL;
+}
+
+int ff_uploadqueue_alloc(UploadQueue **puq, AVFormatContext *s, int nb_workers,
+                         int max_retries, int64_t max_bytes, int persistent)
+{
+    UploadQueue *uq;
+    int ret;
+
+    uq = av_mallocz(sizeof(*uq));
+    if (!uq)
+        return AVERROR(ENOMEM);
+    uq->workers = av_calloc(nb_workers, sizeof(*uq->workers));
+    if (!uq->workers) {
+        av_free(uq);
+        return AVERROR(ENOMEM);
+    }
+    uq->s           = s;
+    uq->max_retries = max_retries;
+    uq->max_bytes   = max_bytes;
+    uq->persistent  = persistent;
+
+    pthread_mutex_init(&uq->mutex, NULL);
+    pthread_cond_init(&uq->cond_worker, NULL);
+    pthread_cond_init(&uq->cond_muxer, NULL);
+
+    for (; uq->nb_workers < nb_workers; uq->nb_workers++) {
+        ret = pthread_create(&uq->workers[uq->nb_workers], NULL, worker_thread, uq);
+        if (ret) {
+            av_log(s, AV_LOG_ERROR, "pthread_create failed: %s\n", av_err2str(AVERROR(ret)));
+            ff_uploadqueue_freep(&uq);
+            return AVERROR(ret);
+        }
+    }
+
+    *puq = uq;
+    return 0;
+}
+
+void ff_uploadqueue_freep(UploadQueue **puq)
+{
+    UploadQueue *uq = *puq;
+    int dropped = 0;
+
+    if (!uq)
+        return;
+
+    for (int i = 0; i < uq->nb_files; i++) {
+        UploadFile *f = &uq->files[i];
+        if (*f->pb == f->dyn)
+            *f->pb = NULL;
+        ffio_free_dyn_buf(&f->dyn);
+        av_dict_free(&f->opts);
+        av_free(f->url);
+    }
+    av_freep(&uq->files);
+
+    pthread_mutex_lock(&uq->mutex);
+    uq->abort = 1;
+    pthread_cond_broadcast(&uq->cond_worker);
+    pthread_mutex_unlock(&uq->mutex);
+
+    for (int i = 0; i < uq->nb_workers; i++)
+        pthread_join(uq->workers[i], NULL);
+
+    while (uq->jobs) {
+        UploadJob *job = uq->jobs;
+        uq->jobs = job->next;
+        job_free(job);
+        dropped++;
+    }
+    if (dropped)
+        av_log(uq->s, AV_LOG_WARNING, "%d queued uploads dropped\n", dropped);
+
+    if (uq->nb_queued)
+        av_log(uq->s, AV_LOG_VERBOSE,
+               "Uploads: %d done, %"PRId64" bytes, %d retries, %d failed; "
+               "queue depth avg %.1f max %d; "
+               "max latency %.3fs; muxer blocked %.3fs\n",
+               uq->nb_uploaded, uq->bytes_uploaded, uq->nb_retries,
+               uq->nb_failed,
+               (double)uq->sum_depth / uq->nb_queued, uq->max_depth,
+               uq->max_latency / 1000000.0, uq->blocked / 1000000.0);
+
+    pthread_cond_destroy(&uq->cond_muxer);
+    pthread_cond_destroy(&uq->cond_worker);
+    pthread_mutex_destroy(&uq->mutex);
+    av_free(uq->workers);
+    av_freep(puq);
+}
+
+int ff_uploadqueue_open(UploadQueue *uq, AVIOContext **pb, const char *url,
+                        AVDictionary **opts, int flags)
+{
+    UploadFile *files, *f;
+    int ret;
+
+    pthread_mutex_lock(&uq->mutex);
+    ret = uq->error;
+    uq->error = 0;
+    pthread_mutex_unlock(&uq->mutex);
+    if (ret < 0)
+        return ret;
+
+    files = av_realloc_array(uq->files, uq->nb_files + 1, sizeof(*files));
+    if (!files)
+        return AVERROR(ENOMEM);
+    uq->files = files;
+    f = &files[uq->nb_files];
+    memset(f, 0, sizeof(*f));
+
+    f->url = av_strdup(url);
+    if (!f->url)
+        return AVERROR(ENOMEM);
+    if (opts && (ret = av_dict_copy(&f->opts, *opts, 0)) < 0)
+        goto fail;
+    if ((ret = avio_open_dyn_buf(&f->dyn)) < 0)
+        goto fail;
+    f->pb    = pb;
+    f->flags = flags;
+    *pb      = f->dyn;
+    uq->nb_files++;
+    return 0;
+
+fail:
+    av_dict_free(&f->opts);
+    av_free(f->url);
+    return ret;
+}
+
+int ff_uploadqueue_is_open(UploadQueue *uq, const AVIOContext *pb)
+{
+    for (int i = 0; i < uq->nb_files; i++)
+        if (uq->files[i].dyn == pb)
+            return 1;
+    return 0;
+}
+
+int ff_uploadqueue_close(UploadQueue *uq, AVIOContext **pb)
+{
+    UploadFile f;
+    UploadJob *job, **p;
+    int64_t start;
+    int i, depth;
+
+    for (i = 0; i < uq->nb_files; i++)
+        if (uq->files[i].dyn == *pb)
+            break;
+    if (i == uq->nb_files)
+        return AVERROR(EINVAL);
+    f = uq->files[i];
+    memmove(&uq->files[i], &uq->files[i + 1], (uq->nb_files - i - 1) * sizeof(f));
+    uq->nb_files--;
+    *pb = NULL;
+
+    job = av_mallocz(sizeof(*job));
+    if (!job) {
+        ffio_free_dyn_buf(&f.dyn);
+        av_dict_free(&f.opts);
+        av_free(f.url);
+        return AVERROR(ENOMEM);
+    }
+    job->url   = f.url;
+    job->opts  = f.opts;
+    job->flags = f.flags;
+    job->size  = avio_close_dyn_buf(f.dyn, &job->data);
+
+    pthread_mutex_lock(&uq->mutex);
+
+    /* Wait for memory, unless the queue is empty so that any file fits. */
+    start = av_gettime_relative();
+    while (uq->jobs && uq->bytes + job->size > uq->max_bytes && !uq->abort)
+        pthread_cond_wait(&uq->cond_muxer, &uq->mutex);
+    job->queued  = av_gettime_relative();
+    uq->blocked += job->queued - start;
+
+    for (p = &uq->jobs; *p; p = &(*p)->next)
+        ;
+    *p = job;
+    uq->bytes += job->size;
+
+    depth = queue_depth(uq);
+    uq->nb_queued++;
+    uq->sum_depth += depth;
+    uq->max_depth  = FFMAX(uq->max_depth, depth);
+    av_log(uq->s, AV_LOG_DEBUG, "Queued upload of '%s', %d bytes, queue depth %d\n",
+           job->url, job->size, depth);
+
+    pthread_cond_broadcast(&uq->cond_worker);
+    pthread_mutex_unlock(&uq->mutex);
+    return 0;
+}
+
+int ff_uploadqueue_flush(UploadQueue *uq)
+{
+    int ret;
+
+    pthread_mutex_lock(&uq->mutex);
+    while (uq->jobs && !uq->abort)
+        pthread_cond_wait(&uq->cond_muxer, &uq->mutex);
+    ret = uq->error;
+    uq->error = 0;
+    pthread_mutex_unlock(&uq->mutex);
+    return ret;
+}
+
+#else /* HAVE_THREADS */
+
+int ff_uploadqueue_alloc(UploadQueue **puq, AVFormatContext *s, int nb_workers,
+                         int max_retries, int64_t max_bytes, int persistent)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_uploadqueue_freep(UploadQueue **puq)
+{
+}
+
+int ff_uploadqueue_open(UploadQueue *uq, AVIOContext **pb, const char *url,
+                        AVDictionary **opts, int flags)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_uploadqueue_is_open(UploadQueue *uq, const AVIOContext *pb)
+{
+    return 0;
+}
+
+int ff_uploadqueue_close(UploadQueue *uq, AVIOContext **pb)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_uploadqueue_flush(UploadQueue *uq)
+{
+    return 0;
+}
+
+#endif /* HAVE_THREADS */
@@ -0,0 +1,103 @@
+/*
+ * Asynchronous uploads for segmented streaming muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_UPLOADQUEUE_H
+#define AVFORMAT_UPLOADQUEUE_H
+
+#include <stdint.h>
+
+#include "libavutil/dict.h"
+
+#include "avformat.h"
+
+/**
+ * @file
+ * A pool of worker threads uploading the files written by a muxer.
+ *
+ * The muxer writes each file into memory, and the file is queued for
+ * upload when the muxer closes it. Files are uploaded concurrently, and
+ * retried on failure. Files queued with FF_UPLOAD_ORDERED, i.e. playlists,
+ * manifests and deletions, are only started once all the files queued
+ * before them have been uploaded, so that they never reference a segment
+ * that is not available yet.
+ *
+ * All functions must be called from the muxer thread.
+ */
+
+typedef struct UploadQueue UploadQueue;
+
+/**
+ * Start the upload only once all files queued before have been uploaded.
+ */
+#define FF_UPLOAD_ORDERED 1
+
+/**
+ * Create an upload queue.
+ *
+ * @param nb_workers  maximum number of concurrent uploads
+ * @param max_retries number of times a failed upload is retried
+ * @param max_bytes   total size of queued files before closing a file
+ *                    blocks until uploads complete
+ * @param persistent  reuse the HTTP connection of a worker between uploads
+ * @return 0 on success, AVERROR(ENOSYS) if threads are not available,
+ *         another negative AVERROR code on failure
+ */
+int ff_uploadqueue_alloc(UploadQueue **uq, AVFormatContext *s, int nb_workers,
+                         int max_retries, int64_t max_bytes, int persistent);
+
+/**
+ * Stop all workers, drop the uploads not started yet and free the queue.
+ * Files still open are discarded and their IO context pointers set to NULL.
+ */
+void ff_uploadqueue_freep(UploadQueue **uq);
+
+/**
+ * Open a file to be uploaded to url.
+ *
+ * @param pb    set to a memory IO context; it must stay at this address
+ *              until it is closed with ff_uploadqueue_close()
+ * @param opts  IO options used to open url, copied
+ * @param flags FF_UPLOAD_* flags
+ * @return 0 on success, a negative AVERROR code on failure, including the
+ *         error of an upload that failed since the last call
+ */
+int ff_uploadqueue_open(UploadQueue *uq, AVIOContext **pb, const char *url,
+                        AVDictionary **opts, int flags);
+
+/**
+ * Check whether pb was opened with ff_uploadqueue_open().
+ */
+int ff_uploadqueue_is_open(UploadQueue *uq, const AVIOContext *pb);
+
+/**
+ * Close a file opened with ff_uploadqueue_open() and queue it for upload.
+ * *pb is set to NULL.
+ */
+int ff_uploadqueue_close(UploadQueue *uq, AVIOContext **pb);
+
+/**
+ * Wait until all queued files have been uploaded.
+ *
+ * @return 0 on success, or the error of an upload that failed since the
+ *         last call to ff_uploadqueue_open() or ff_uploadqueue_flush()
+ */
+int ff_uploadqueue_flush(UploadQueue *uq);
+
+#endif /* AVFORMAT_UPLOADQUEUE_H */
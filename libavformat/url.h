@@ -26,6 +26,7 @@
 
 #include "avio.h"
 
+#include "libavutil/buffer.h"
 #include "libavutil/dict.h"
 #include "libavutil/log.h"
 
@@ -83,6 +84,28 @@ typedef struct URLProtocol {
     int (*url_get_multi_file_handle)(URLContext *h, int **handles,
                                      int *numhandles);
     int (*url_get_short_seek)(URLContext *h);
+    /**
+     * Return a reference to size bytes of the resource starting at pos
+     * without copying them, for protocols keeping the resource in memory.
+     * Does not change the read position.
+     *
+     * @return size on success, a negative AVERROR code if the data cannot
+     *         be referenced, in which case it must be read normally
+     */
+    int (*url_get_buffer)(URLContext *h, int64_t pos, int size, AVBufferRef **buf);
+    /**
+     * Write size bytes from buf->data, for protocols able to send data
+     * without copying it. The protocol may keep a reference to buf until
+     * the data has been sent; the caller must not modify the data after
+     * the call, and must use a new buffer for the next write.
+     *
+     * If buf is NULL, only check whether zero-copy writes are enabled.
+     *
+     * @return the number of bytes written, the preferred buffer size if buf
+     *         is NULL, or a negative AVERROR code; AVERROR(ENOSYS) if
+     *         zero-copy writes are not enabled
+     */
+    int (*url_write_buffer)(URLContext *h, AVBufferRef *buf, int size);
     int (*url_shutdown)(URLContext *h, int flags);
     const AVClass *priv_data_class;
     int priv_data_size;
@@ -204,6 +227,14 @@ static inline int ffurl_write(URLContext *h, const uint8_t *buf, int size)
     return ffurl_write2(h, buf, size);
 }
 
+/**
+ * Write size bytes from buf->data to the resource accessed by h without
+ * copying them, see URLProtocol.url_write_buffer.
+ *
+ * @return the number of bytes written, or a negative AVERROR code
+ */
+int ffurl_write_buffer(void *urlcontext, AVBufferRef *buf, int size);
+
 int64_t ffurl_seek2(void *urlcontext, int64_t pos, int whence);
 /**
  * Change the position that will be used by the next read/write
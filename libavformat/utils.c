@@ -111,6 +111,34 @@ FF_ENABLE_DEPRECATION_WARNINGS
     return append_packet_chunked(s, pkt, size);
 }
 
+static int packet_ref_supported(enum AVCodecID codec_id)
+{
+    return codec_id == AV_CODEC_ID_RAWVIDEO ||
+           (codec_id >= AV_CODEC_ID_PCM_S16LE && codec_id < AV_CODEC_ID_PCM_S24DAUD);
+}
+
+int ff_get_packet_ref(AVIOContext *s, AVPacket *pkt, int size,
+                      const AVCodecParameters *par)
+{
+    int ret;
+
+    if (size <= 0 || !packet_ref_supported(par->codec_id))
+        return av_get_packet(s, pkt, size);
+
+    av_packet_unref(pkt);
+    pkt->pos = avio_tell(s);
+
+    ret = ffio_read_ref(s, size, AV_INPUT_BUFFER_PADDING_SIZE, &pkt->buf);
+    if (ret == AVERROR(ENOSYS))
+        return av_get_packet(s, pkt, size);
+    if (ret < 0)
+        return ret;
+
+    pkt->data = pkt->buf->data;
+    pkt->size = ret;
+    return ret;
+}
+
 int av_append_packet(AVIOContext *s, AVPacket *pkt, int size)
 {
     if (!pkt->size)
@@ -275,7 +275,10 @@ AVBufferPool *av_buffer_pool_init2(size_t size, void *opaque,
     pool->alloc     = av_buffer_alloc; // fallback
     pool->pool_free = pool_free;
 
-    atomic_init(&pool->refcount, 1);
+    atomic_init(&pool->released,  0);
+    atomic_init(&pool->nb_hits,   0);
+    atomic_init(&pool->nb_misses, 0);
+    atomic_init(&pool->refcount,  1);
 
     return pool;
 }
@@ -294,13 +297,26 @@ AVBufferPool *av_buffer_pool_init(size_t size, AVBufferRef* (*alloc)(size_t size
     pool->size     = size;
     pool->alloc    = alloc ? alloc : av_buffer_alloc;
 
-    atomic_init(&pool->refcount, 1);
+    atomic_init(&pool->released,  0);
+    atomic_init(&pool->nb_hits,   0);
+    atomic_init(&pool->nb_misses, 0);
+    atomic_init(&pool->refcount,  1);
 
     return pool;
 }
 
 static void buffer_pool_flush(AVBufferPool *pool)
 {
+    BufferPoolEntry *released = (BufferPoolEntry*)
+        atomic_exchange_explicit(&pool->released, 0, memory_order_acquire);
+
+    while (released) {
+        BufferPoolEntry *buf = released;
+        released   = buf->next;
+        buf->next  = pool->pool;
+        pool->pool = buf;
+    }
+
     while (pool->pool) {
         BufferPoolEntry *buf = pool->pool;
         pool->pool = buf->next;
@@ -346,11 +362,14 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
 {
     BufferPoolEntry *buf = opaque;
     AVBufferPool *pool = buf->pool;
+    uintptr_t head = atomic_load_explicit(&pool->released, memory_order_relaxed);
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    do {
+        buf->next = (BufferPoolEntry*)head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->released, &head,
+                                                    (uintptr_t)buf,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -394,6 +413,11 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 
     ff_mutex_lock(&pool->mutex);
     buf = pool->pool;
+    if (!buf) {
+        buf = (BufferPoolEntry*)atomic_exchange_explicit(&pool->released, 0,
+                                                         memory_order_acquire);
+        pool->pool = buf;
+    }
     if (buf) {
         memset(&buf->buffer, 0, sizeof(buf->buffer));
         ret = buffer_create(&buf->buffer, buf->data, pool->size,
@@ -402,9 +426,12 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
             pool->pool = buf->next;
             buf->next = NULL;
             buf->buffer.flags_internal |= BUFFER_FLAG_NO_FREE;
+            atomic_fetch_add_explicit(&pool->nb_hits, 1, memory_order_relaxed);
         }
     } else {
         ret = pool_alloc_buffer(pool);
+        if (ret)
+            atomic_fetch_add_explicit(&pool->nb_misses, 1, memory_order_relaxed);
     }
     ff_mutex_unlock(&pool->mutex);
 
@@ -414,6 +441,17 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
     return ret;
 }
 
+void av_buffer_pool_get_stats(AVBufferPool *pool, uint64_t *hits,
+                              uint64_t *misses, size_t *outstanding)
+{
+    if (hits)
+        *hits   = atomic_load_explicit(&pool->nb_hits,   memory_order_relaxed);
+    if (misses)
+        *misses = atomic_load_explicit(&pool->nb_misses, memory_order_relaxed);
+    if (outstanding)
+        *outstanding = atomic_load_explicit(&pool->refcount, memory_order_relaxed) - 1;
+}
+
 void *av_buffer_pool_buffer_get_opaque(const AVBufferRef *ref)
 {
     BufferPoolEntry *buf = ref->buffer->opaque;
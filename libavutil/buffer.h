@@ -244,7 +244,8 @@ int av_buffer_replace(AVBufferRef **dst, const AVBufferRef *src);
  *
  * Allocating and releasing buffers with this API is thread-safe as long as
  * either the default alloc callback is used, or the user-supplied one is
- * thread-safe.
+ * thread-safe. Releasing a buffer never blocks on other threads using the
+ * same pool.
  */
 
 /**
@@ -302,6 +303,22 @@ void av_buffer_pool_uninit(AVBufferPool **pool);
  */
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool);
 
+/**
+ * Retrieve usage statistics of a buffer pool. This function may be called
+ * simultaneously with other functions operating on the pool, in which case
+ * the values are only approximate.
+ *
+ * @param pool        the buffer pool
+ * @param hits        if non-NULL, set to the number of av_buffer_pool_get()
+ *                    calls that reused a previously released buffer
+ * @param misses      if non-NULL, set to the number of av_buffer_pool_get()
+ *                    calls that allocated a new buffer
+ * @param outstanding if non-NULL, set to the number of buffers obtained from
+ *                    the pool that have not been released yet
+ */
+void av_buffer_pool_get_stats(AVBufferPool *pool, uint64_t *hits,
+                              uint64_t *misses, size_t *outstanding);
+
 /**
  * Query the original opaque parameter of an allocated buffer in the pool.
  *
@@ -87,8 +87,22 @@ typedef struct BufferPoolEntry {
 
 struct AVBufferPool {
     AVMutex mutex;
+    /* free entries, only accessed with mutex locked */
     BufferPoolEntry *pool;
 
+    /*
+     * BufferPoolEntry pointer to a stack of entries returned by
+     * pool_release_buffer(). Buffers are pushed onto it without taking the
+     * mutex; av_buffer_pool_get() takes the whole stack at once when pool
+     * runs empty, so no entry is ever popped concurrently.
+     */
+    atomic_uintptr_t released;
+
+    /* av_buffer_pool_get() calls served from a released buffer */
+    atomic_uint_least64_t nb_hits;
+    /* av_buffer_pool_get() calls which allocated a new buffer */
+    atomic_uint_least64_t nb_misses;
+
     /*
      * This is used to track when the pool is to be freed.
      * The pointer to the pool itself held by the caller is considered to
@@ -90,6 +90,9 @@ fate-filter-lavd-testsrc: CMD = framecrc -f lavfi -i testsrc=r=7:n=2:d=10
 FATE_FILTER-$(call FILTERFRAMECRC, TESTSRC2) += $(addprefix fate-filter-testsrc2-, yuv420p yuv444p rgb24 rgba)
 fate-filter-testsrc2-%: CMD = framecrc -lavfi testsrc2=r=7:d=10 -pix_fmt $(word 4, $(subst -, ,$(@)))
 
+FATE_FILTER-$(call FILTERFRAMECRC, TESTSRC2 FORMAT LUT LUTYUV) += fate-filter-lut-fuse
+fate-filter-lut-fuse: CMD = framecrc -filter_fuse -lavfi testsrc2=r=5:d=1,format=yuv420p,lutyuv=y=negval,lutyuv=u=val/2,lut=c0=val+20:c2=negval -pix_fmt yuv420p
+
 FATE_FILTER-$(call FILTERFRAMECRC, ALLRGB) += fate-filter-allrgb
 fate-filter-allrgb: CMD = framecrc -lavfi allrgb=rate=5:duration=1 -pix_fmt rgb24
 
@@ -281,8 +281,31 @@ fate-matroska-side-data-pref-packet: CMD = run ffprobe$(PROGSSUF)$(EXESUF) $(TAR
     -select_streams v:0 -show_streams -show_frames -show_entries stream=stream_side_data:frame=frame_side_data_list -side_data_prefer_packet mastering_display_metadata,content_light_level
 FATE_MATROSKA_FFPROBE-$(call ALLYES, MATROSKA_DEMUXER HEVC_DECODER) += fate-matroska-side-data-pref-codec fate-matroska-side-data-pref-packet
 
+# Tests that seeking in a file without Cues gives the same results with the
+# index built by scanning the clusters with index_threads as with the index
+# built while reading the file. Clusters of the live mode have known sizes.
+tests/data/matroska-no-cues.mkv: TAG = GEN
+tests/data/matroska-no-cues.mkv: tests/data/vsynth1.yuv
+tests/data/matroska-no-cues.mkv: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv \
+        -f lavfi -i "sine=d=2" -fflags +bitexact -flags +bitexact \
+        -c:v mpeg4 -qscale:v 5 -g 12 -threads 1 -c:a pcm_s16le -t 2 \
+        -cluster_time_limit 400 -live 1 \
+        -y $(TARGET_PATH)/tests/data/matroska-no-cues.mkv 2>/dev/null
+
+FATE_MATROSKA_SEEK-$(call ALLYES, MATROSKA_DEMUXER MATROSKA_MUXER RAWVIDEO_DEMUXER \
+                                  LAVFI_INDEV SINE_FILTER MPEG4_ENCODER       \
+                                  PCM_S16LE_ENCODER FILE_PROTOCOL)            \
+    += fate-matroska-no-cues-seek fate-matroska-no-cues-seek-threads
+fate-matroska-no-cues-seek fate-matroska-no-cues-seek-threads: tests/data/matroska-no-cues.mkv libavformat/tests/seek$(EXESUF)
+fate-matroska-no-cues-seek:         CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/matroska-no-cues.mkv
+fate-matroska-no-cues-seek-threads: CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/matroska-no-cues.mkv -index_threads 2
+fate-matroska-no-cues-seek fate-matroska-no-cues-seek-threads: REF = $(SRC_PATH)/tests/ref/fate/matroska-no-cues-seek
+
 FATE_SAMPLES_AVCONV += $(FATE_MATROSKA-yes)
 FATE_SAMPLES_FFPROBE += $(FATE_MATROSKA_FFPROBE-yes)
 FATE_SAMPLES_FFMPEG_FFPROBE += $(FATE_MATROSKA_FFMPEG_FFPROBE-yes)
+FATE_FFMPEG += $(FATE_MATROSKA_SEEK-yes)
 
-fate-matroska: $(FATE_MATROSKA-yes) $(FATE_MATROSKA_FFPROBE-yes) $(FATE_MATROSKA_FFMPEG_FFPROBE-yes)
+fate-matroska: $(FATE_MATROSKA-yes) $(FATE_MATROSKA_FFPROBE-yes) $(FATE_MATROSKA_FFMPEG_FFPROBE-yes) $(FATE_MATROSKA_SEEK-yes)
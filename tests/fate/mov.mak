@@ -263,6 +263,14 @@ FATE_MOV_FFMPEG-$(call TRANSCODE, PCM_F32LE, MP4 MOV, WAV_DEMUXER PAN_FILTER) \
 fate-mov-mp4-pcm-float: tests/data/asynth-44100-1.wav
 fate-mov-mp4-pcm-float: CMD = transcode wav $(TARGET_PATH)/tests/data/asynth-44100-1.wav mp4 "-af aresample,pan=FR+FL+FR|c0=c0|c1=c0|c2=c0 -c:a pcm_f32le" "-map 0 -c copy -frames:a 0"
 
+# Test reserving the space of the moov atom ahead of the mdat, with the size
+# predicted from the durations of the inputs and with a size too small for it
+FATE_MOV_FFMPEG-$(call TRANSCODE, PCM_S16LE, MP4 MOV, WAV_DEMUXER RAWVIDEO_DEMUXER MPEG4_ENCODER) \
+                          += fate-mov-reserve-moov fate-mov-reserve-moov-shift
+fate-mov-reserve-moov fate-mov-reserve-moov-shift: tests/data/asynth-44100-1.wav tests/data/vsynth1.yuv
+fate-mov-reserve-moov: CMD = transcode wav $(TARGET_PATH)/tests/data/asynth-44100-1.wav mp4 "-map 0:a -map 1:v -c:a pcm_s16le -c:v mpeg4 -qscale:v 10 -threads 1 -movflags +reserve_moov" "-map 0 -c copy" "" "-f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv"
+fate-mov-reserve-moov-shift: CMD = transcode wav $(TARGET_PATH)/tests/data/asynth-44100-1.wav mp4 "-map 0:a -map 1:v -c:a pcm_s16le -c:v mpeg4 -qscale:v 10 -threads 1 -movflags +reserve_moov -moov_size 600" "-map 0 -c copy" "" "-f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv"
+
 fate-mov-pcm-remux: tests/data/asynth-44100-1.wav
 fate-mov-pcm-remux: CMD = md5 -i $(TARGET_PATH)/tests/data/asynth-44100-1.wav -map 0 -c copy -fflags +bitexact -f mp4
 fate-mov-pcm-remux: CMP = oneline
@@ -22,4 +22,30 @@ fate-mpegts-probe-pmt-merge: CMD = run $(PROBE_CODEC_NAME_COMMAND) -merge_pmt_ve
 
 FATE_SAMPLES_FFPROBE += $(FATE_MPEGTS_PROBE-yes)
 
-fate-mpegts: $(FATE_MPEGTS_PROBE-yes)
+#
+# Test that demuxing the PES streams in threads gives the same packets as
+# demuxing them in the calling thread, for a stream with two programs
+#
+tests/data/mpegts-programs.ts: TAG = GEN
+tests/data/mpegts-programs.ts: tests/data/vsynth1.yuv
+tests/data/mpegts-programs.ts: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv \
+        -f lavfi -i "sine=440:d=2" -f lavfi -i "sine=880:d=2" \
+        -map 0:v -map 1:a -map 0:v -map 2:a -fflags +bitexact -flags +bitexact \
+        -c:v mpeg2video -qscale:v 10 -threads 1 -c:a mp2fixed -t 2 \
+        -program title=first:st=0:st=1 -program title=second:st=2:st=3 \
+        -y $(TARGET_PATH)/tests/data/mpegts-programs.ts 2>/dev/null
+
+FATE_MPEGTS-$(call REMUX, FRAMECRC MPEGTS, RAWVIDEO_DEMUXER LAVFI_INDEV   \
+                                           SINE_FILTER MPEG2VIDEO_ENCODER \
+                                           MP2FIXED_ENCODER MPEGTS_MUXER) \
+    += fate-mpegts-demux-serial fate-mpegts-demux-threads
+fate-mpegts-demux-serial fate-mpegts-demux-threads: tests/data/mpegts-programs.ts
+fate-mpegts-demux-serial:  CMD = framecrc -demux_threads 0 -i $(TARGET_PATH)/tests/data/mpegts-programs.ts -map 0 -c copy
+fate-mpegts-demux-threads: CMD = framecrc -demux_threads 4 -i $(TARGET_PATH)/tests/data/mpegts-programs.ts -map 0 -c copy
+fate-mpegts-demux-serial fate-mpegts-demux-threads: REF = $(SRC_PATH)/tests/ref/fate/mpegts-demux-threads
+
+FATE_FFMPEG += $(FATE_MPEGTS-yes)
+
+fate-mpegts: $(FATE_MPEGTS_PROBE-yes) $(FATE_MPEGTS-yes)